@@ -14,10 +14,131 @@
 #define CCA_TOK_END 6
 #define CCA_TOK_ADDRESS 7
 #define CCA_TOK_STRING 8
+#define CCA_TOK_DEFINITION 9
+#define CCA_TOK_OPERATOR 10
+
+#define CCA_OPERAND_NONE 0
+#define CCA_OPERAND_REGISTER 1
+#define CCA_OPERAND_NUMBER 2
+#define CCA_OPERAND_ADDRESS 3
+#define CCA_OPERAND_MARKER 4
+#define CCA_OPERAND_RELATIVE 5
+#define CCA_OPERAND_DEFINITION 6
+
+#define CCA_ENCODING_STANDARD 0
+#define CCA_ENCODING_COMPACT 1
+#define CCA_ENCODING_WIDE 2
+
+// wide code is made of little endian records of one or two 8 byte words: opcode, the register operands in order
+// padded to 3 bytes and the first immediate, then the other immediates in the next word if there are more. code
+// addresses in wide code count words instead of bytes
+#define CCA_WIDE_WORD 8
+
+#define CCA_OP_STP 0x00
+#define CCA_OP_PSH_NUM 0x01
+#define CCA_OP_PSH_REG 0x02
+#define CCA_OP_POP_REG 0x03
+#define CCA_OP_POP_ADDR 0x04
+#define CCA_OP_DUP 0x05
+#define CCA_OP_MOV_REG_NUM 0x06
+#define CCA_OP_MOV_ADDR_NUM 0x07
+#define CCA_OP_MOV_REG_ADDR 0x08
+#define CCA_OP_MOV_ADDR_REG 0x09
+#define CCA_OP_MOV_REG_REG 0x0a
+#define CCA_OP_PSH_ADDR 0x0b
+#define CCA_OP_ADD_REG 0x10
+#define CCA_OP_ADD 0x11
+#define CCA_OP_SUB_REG 0x12
+#define CCA_OP_SUB 0x13
+#define CCA_OP_MUL_REG 0x14
+#define CCA_OP_MUL 0x15
+#define CCA_OP_DIV_REG 0x16
+#define CCA_OP_DIV 0x17
+#define CCA_OP_NOT_REG 0x18
+#define CCA_OP_NOT 0x19
+#define CCA_OP_AND_REG 0x20
+#define CCA_OP_AND 0x21
+#define CCA_OP_OR_REG 0x22
+#define CCA_OP_OR 0x23
+#define CCA_OP_XOR_REG 0x24
+#define CCA_OP_XOR 0x25
+#define CCA_OP_CMP_REG_REG 0x30
+#define CCA_OP_CMP_REG_NUM 0x31
+#define CCA_OP_CMP_NUM 0x32
+#define CCA_OP_JE 0x33
+#define CCA_OP_JNE 0x34
+#define CCA_OP_JG 0x35
+#define CCA_OP_JS 0x36
+#define CCA_OP_JO 0x37
+// jmp used to be written as 0x20, the same byte as 'and reg, reg', so a vm could not tell them apart. containers
+// say so with CCB_VERSION, flat output has no version and has to be assembled again
+#define CCA_OP_JMP 0x38
+#define CCA_OP_FRS 0x40
+#define CCA_OP_INC_REG 0x50
+#define CCA_OP_DEC_REG 0x51
+#define CCA_OP_INC 0x52
+#define CCA_OP_DEC 0x53
+#define CCA_OP_CALL 0x60
+#define CCA_OP_RET 0x61
+#define CCA_OP_SYSCALL 0xff
+
+// compact forms with 1 and 2 byte immediates, 2 byte addresses and branches relative to the next instruction
+#define CCA_OP_PSH_NUM8 0x80
+#define CCA_OP_PSH_NUM16 0x81
+#define CCA_OP_MOV_REG_NUM8 0x82
+#define CCA_OP_MOV_REG_NUM16 0x83
+#define CCA_OP_CMP_REG_NUM8 0x84
+#define CCA_OP_CMP_REG_NUM16 0x85
+#define CCA_OP_CMP_NUM8 0x86
+#define CCA_OP_CMP_NUM16 0x87
+#define CCA_OP_PSH_ADDR16 0x88
+#define CCA_OP_POP_ADDR16 0x89
+#define CCA_OP_MOV_REG_ADDR16 0x8a
+#define CCA_OP_MOV_ADDR16_REG 0x8b
+#define CCA_OP_MOV_ADDR16_NUM8 0x8c
+#define CCA_OP_MOV_ADDR16_NUM16 0x8d
+#define CCA_OP_JE8 0x90
+#define CCA_OP_JNE8 0x91
+#define CCA_OP_JG8 0x92
+#define CCA_OP_JS8 0x93
+#define CCA_OP_JO8 0x94
+#define CCA_OP_JMP8 0x95
+#define CCA_OP_CALL8 0x96
+#define CCA_OP_JE16 0x98
+#define CCA_OP_JNE16 0x99
+#define CCA_OP_JG16 0x9a
+#define CCA_OP_JS16 0x9b
+#define CCA_OP_JO16 0x9c
+#define CCA_OP_JMP16 0x9d
+#define CCA_OP_CALL16 0x9e
+
+// superinstructions, several instructions fused into one by cca_optimize_fuse
+#define CCA_OP_CMP_NUM_JE 0xa0
+#define CCA_OP_CMP_NUM_JNE 0xa1
+#define CCA_OP_CMP_REG_JE 0xa2
+#define CCA_OP_CMP_REG_JNE 0xa3
+#define CCA_OP_PSH_PSH_ADD 0xa4
+#define CCA_OP_PSH_NUM_ADD 0xa5
+#define CCA_OP_INC_CMP_JNE 0xa6
+#define CCA_OP_INC_CMP_NUM_JNE 0xa7
+
+#define CCA_MARKER_UNDEFINED 0xffffffff
+
+#define CCA_MAX_OPERANDS 3
+
+#define CCA_REGISTER_COUNT 4
+#define CCA_REGISTER_VIRTUAL 4
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <ctype.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <pthread.h>
 
 typedef struct cca_file_content {
 	unsigned int fileSize;
@@ -26,26 +147,36 @@ typedef struct cca_file_content {
 
 typedef struct cca_token {
 	char type;
+	// the file the token is from, 0 for the one being assembled and the number of an include plus 1 otherwise
+	unsigned int file;
 	union value {
 		unsigned int numeric;
 		char* string;
 	} value;
+	// where the token starts in the source, both counting from 1
+	unsigned int line;
+	unsigned int column;
 } cca_token;
 
 typedef struct cca_marker {
 	char* name;
 	unsigned int marks;
+	unsigned int instruction;
 } cca_marker;
 
 typedef struct cca_definition {
 	char* name;
 	char* value;
 	unsigned int pointer;
+	// values can hold nuls. incbin values have no bytes in memory, they are copied from file once the output is written
+	unsigned int length;
+	char* file;
 } cca_definition;
 
 typedef struct cca_definition_list {
 	cca_definition* definitions;
 	unsigned int length;
+	BOOL error;
 } cca_definition_list;
 
 char* cca_token_type_str(char type) {
@@ -59,42 +190,72 @@ char* cca_token_type_str(char type) {
 		case 6: return "end";
 		case 7: return "address";
 		case 8: return "string";
+		case 9: return "definition";
+		case 10: return "operator";
 		default: return "unknown";
 	}
 }
 
 void cca_token_print(cca_token tok) {
-	if (tok.type == 1 || tok.type == 7) {
+	if (tok.type == 1 || tok.type == 7 || tok.type == 9) {
 		printf("Token[type: %s(%d), value: %d]\n", cca_token_type_str(tok.type), tok.type, tok.value.numeric);
 	} else {
 		printf("Token[type: %s(%d), value: %s]\n", cca_token_type_str(tok.type), tok.type, tok.type == 6 ? "EOP" : tok.value.string);
 	}
 }
 
-cca_file_content ccvm_program_load(char *filename) {
-    cca_file_content content;
+// files are read in chunks of this much unless they tell their size, pipes don't
+#define CCA_READ_CHUNK (1 << 20)
 
+// reads a whole file into content, - reads stdin. returns FALSE when it can't
+BOOL cca_load_file(char* filename, cca_file_content* content) {
     // open file
-    FILE *fp = fopen(filename, "rb");
+    int fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
 
     // error detection
-    if (fp == NULL) {
+    if (fd < 0) {
         printf("[ERROR] could not open file: %s\n", filename);
-        exit(1);
+        return FALSE;
     }
 
-    // get buffer size
-    fseek(fp, 0L, SEEK_END);
-    size_t size = ftell(fp);
-    fseek(fp, 0L, SEEK_SET);
+    // get buffer size, regular files in one read and everything else a chunk at a time
+    struct stat info;
+    size_t capacity = fstat(fd, &info) == 0 && S_ISREG(info.st_mode) ? info.st_size + 1 : CCA_READ_CHUNK;
+    char *buffer = (char *) malloc(capacity);
+    size_t size = 0;
+
+    while (TRUE) {
+        if (size + 1 >= capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+        }
+
+        ssize_t n = read(fd, buffer + size, capacity - size - 1);
+        if (n == 0)
+            break;
+        if (n < 0) {
+            printf("[ERROR] could not read file: %s\n", filename);
+            free(buffer);
+            if (fd != STDIN_FILENO)
+                close(fd);
+            return FALSE;
+        }
+        size += n;
+    }
 
-    // buffer allocation
-    char *buffer = (char *) malloc(size + 1 * sizeof(char*));
+    buffer[size] = '\0';
+    if (fd != STDIN_FILENO)
+        close(fd);
 
-    fread(buffer, 1, size, fp);
+    content->fileSize = size;
+    content->content = buffer;
+    return TRUE;
+}
 
-    content.fileSize = size;
-    content.content = buffer;
+cca_file_content ccvm_program_load(char *filename) {
+    cca_file_content content;
+    if (!cca_load_file(filename, &content))
+        exit(1);
 
     return content;
 }
@@ -132,6 +293,11 @@ char cca_is_marker(char character) {
 	return character == ':';
 }
 
+char cca_is_operator(char character) {
+	return character == '+' || character == '-' || character == '*' || character == '/' || character == '%' || character == '|'
+		|| character == '^' || character == '~' || character == '(' || character == ')' || character == '<' || character == '>';
+}
+
 char strContainedIn(char* string, char* array[], unsigned int arrayLength) {
 	for (int i = 0; i < arrayLength; i++) {
 		if (strcmp(string, array[i]) == 0) {
@@ -142,6 +308,19 @@ char strContainedIn(char* string, char* array[], unsigned int arrayLength) {
 	return 0;
 }
 
+// virtual registers are written v0, v1, ... and get mapped onto a-d by the register allocator
+char cca_is_virtual_register(char* string) {
+	if (string[0] != 'v' || string[1] == '\0')
+		return 0;
+
+	for (int i = 1; string[i] != '\0'; i++) {
+		if (!cca_is_number(string[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
 char cca_is_opcode_or_register(cca_token t) {
 	char* mnemonics[] = { "mov", "stp", "psh", "pop", "dup", "mov", "add", "sub", "mul", "div", "not", "and", "or", "xor", "jmp", "cmp", "frs", "inc", "dec", "call", "ret", "syscall", "je", "jne", "jg", "js", "jo" };
 	unsigned int mnemonicsCount = 27;
@@ -151,6 +330,9 @@ char cca_is_opcode_or_register(cca_token t) {
 
 	else if (strcmp(t.value.string, "a") == 0 || strcmp(t.value.string, "b") == 0 || strcmp(t.value.string, "c") == 0 || strcmp(t.value.string, "d") == 0)
 		return CCA_TOK_REGISTER;
+
+	else if (cca_is_virtual_register(t.value.string))
+		return CCA_TOK_REGISTER;
 		
 	else
 		return CCA_TOK_IDENTIFIER;
@@ -165,7 +347,7 @@ cca_token cca_parse_identifier(char* code, unsigned int* readingPos) {
 	unsigned int stringLen = 0;
 	char* string = malloc(stringCap * sizeof(char));
 
-	while(cca_is_identifier(code[*readingPos])) {
+	while(cca_is_identifier(code[*readingPos]) || cca_is_number(code[*readingPos])) {
 		++stringLen;
 
 		if (stringLen >= stringCap) {
@@ -179,7 +361,7 @@ cca_token cca_parse_identifier(char* code, unsigned int* readingPos) {
 	}
 
 	--*readingPos;
-	string = realloc(string, stringLen * sizeof(char));
+	string = realloc(string, (stringLen + 1) * sizeof(char));
 	string[stringLen] = '\0';
 
 	tok.value.string = string;
@@ -187,41 +369,171 @@ cca_token cca_parse_identifier(char* code, unsigned int* readingPos) {
 	return tok;
 }
 
-cca_token cca_parse_number(char* code, unsigned int* readingPos) {
-	unsigned int n = 0;
+// numbers are read a word at a time, 8 digits per 64 bit load. bytes before the end of the source are read in
+// whole words, the few that are left one at a time. the first digit is the lowest byte of a word, the way the
+// source lies in memory on a little endian machine
+#define CCA_LITERAL_OK 0
+#define CCA_LITERAL_EMPTY 1
+#define CCA_LITERAL_OVERFLOW 2
+
+#define CCA_SWAR_ONES 0x0101010101010101ull
+#define CCA_SWAR_HIGH 0x8080808080808080ull
+
+unsigned long long cca_swar_scales[9] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+
+unsigned long long cca_swar_load(char* code) {
+	unsigned long long word;
+	memcpy(&word, code, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
+}
 
-	cca_token tok = {0};
-	tok.type = CCA_TOK_NUMBER;
+// the high bit of every byte that is between low and high, neither above 0x7f
+unsigned long long cca_swar_between(unsigned long long word, unsigned char low, unsigned char high) {
+	unsigned long long above = ((word | CCA_SWAR_HIGH) - CCA_SWAR_ONES * low) & CCA_SWAR_HIGH;
+	unsigned long long below = (CCA_SWAR_ONES * (0x80 + high) - (word & ~CCA_SWAR_HIGH)) & CCA_SWAR_HIGH;
+	return above & below & ~word;
+}
 
-	while(cca_is_number(code[*readingPos])) {
-		n = n*10 + code[*readingPos] - 48;
-		++*readingPos;
+// the high bit of every byte of the word that isn't a hex digit
+unsigned long long cca_swar_hex_others(unsigned long long word) {
+	return ~(cca_swar_between(word, '0', '9') | cca_swar_between(word | CCA_SWAR_ONES * 0x20, 'a', 'f')) & CCA_SWAR_HIGH;
+}
+
+// the value of the 8 digits of a word, the ones in front of the number are zero
+unsigned long long cca_swar_decimal(unsigned long long word) {
+	word = word * 10 + (word >> 8);
+	return ((word & 0x000000ff000000ffull) * (100 + (1000000ull << 32))
+		+ ((word >> 16) & 0x000000ff000000ffull) * (1 + (10000ull << 32))) >> 32;
+}
+
+unsigned long long cca_swar_hex(unsigned long long word) {
+	word = ((word << 4) | (word >> 8)) & 0x00ff00ff00ff00ffull;
+	word = ((word << 8) | (word >> 16)) & 0x0000ffff0000ffffull;
+	return ((word << 16) | (word >> 32)) & 0xffffffffull;
+}
+
+unsigned long long cca_swar_binary(unsigned long long word) {
+	return (word * 0x8040201008040201ull) >> 56;
+}
+
+// reads 123, 0x7b or 0b1111011 at code[*readingPos] and leaves readingPos on its last character. the whole
+// literal is read even when it doesn't fit
+char cca_parse_literal(char* code, unsigned int size, unsigned int* readingPos, unsigned int* value) {
+	unsigned int position = *readingPos;
+	unsigned int base = 10;
+	if (code[position] == '0' && position + 1 < size && (code[position + 1] | 0x20) == 'x')
+		base = 16;
+	else if (code[position] == '0' && position + 1 < size && (code[position + 1] | 0x20) == 'b')
+		base = 2;
+	if (base != 10)
+		position += 2;
+
+	unsigned int bits = base == 16 ? 4 : 1;
+	unsigned long long n = 0;
+	unsigned int start = position;
+	BOOL overflow = FALSE;
+	while (TRUE) {
+		unsigned int count;
+		unsigned long long chunk;
+		// a word that isn't all digits holds the end of the number
+		BOOL ended = FALSE;
+		if (position + 8 <= size) {
+			unsigned long long word = cca_swar_load(code + position);
+
+			// something is set in every byte that isn't a digit. the borrows and carries of decimal and binary
+			// only run towards later bytes, past the first one that isn't a digit, where nothing is looked at
+			unsigned long long others;
+			if (base == 16) {
+				others = cca_swar_hex_others(word);
+				word = (word & CCA_SWAR_ONES * 0x0f) + ((word & CCA_SWAR_ONES * 0x40) >> 6) * 9;
+			} else {
+				word -= CCA_SWAR_ONES * '0';
+				others = base == 2 ? word & CCA_SWAR_ONES * 0xfe : (word | (word + CCA_SWAR_ONES * 6)) & CCA_SWAR_ONES * 0xf0;
+			}
+			count = others == 0 ? 8 : __builtin_ctzll(others) / 8;
+			if (count == 0)
+				break;
+
+			// the digits go to the top, the bytes below them are zeros in front of the number
+			word <<= (8 - count) * 8;
+			chunk = base == 10 ? cca_swar_decimal(word) : base == 16 ? cca_swar_hex(word) : cca_swar_binary(word);
+			ended = count < 8;
+		} else {
+			// the end of the source
+			char c = position < size ? code[position] : '\0';
+			char lower = c | 0x20;
+			if (c >= '0' && c <= (base == 2 ? '1' : '9'))
+				chunk = c - '0';
+			else if (base == 16 && lower >= 'a' && lower <= 'f')
+				chunk = lower - 'a' + 10;
+			else
+				break;
+			count = 1;
+		}
+
+		if (base == 10)
+			n = n * cca_swar_scales[count] + chunk;
+		else
+			n = (n << (count * bits)) | chunk;
+		// it stays below 2^32 while it fits, so the next chunk can't carry past 64 bits
+		if (n > 0xffffffffull) {
+			overflow = TRUE;
+			n &= 0xffffffffull;
+		}
+		position += count;
+		if (ended)
+			break;
 	}
 
-	tok.value.numeric = n;
-	--*readingPos;
-	return tok;
+	*value = (unsigned int) n;
+	*readingPos = position - 1;
+	if (position == start)
+		return CCA_LITERAL_EMPTY;
+	return overflow ? CCA_LITERAL_OVERFLOW : CCA_LITERAL_OK;
 }
 
-cca_token cca_parse_address(char* code, unsigned int* readingPos) {
-	unsigned int n = 0;
+cca_token cca_parse_number(char* code, unsigned int size, unsigned int* readingPos, char* status) {
+	cca_token tok = {0};
+	tok.type = CCA_TOK_NUMBER;
+
+	*status = cca_parse_literal(code, size, readingPos, &tok.value.numeric);
+	return tok;
+}
 
+cca_token cca_parse_address(char* code, unsigned int size, unsigned int* readingPos, char* status) {
 	cca_token tok = {0};
 	tok.type = CCA_TOK_ADDRESS;
 
 	++*readingPos;
-	while(cca_is_number(code[*readingPos])) {
-		n = n * 10 + code[*readingPos] - 48;
-		++*readingPos;
+	*status = cca_parse_literal(code, size, readingPos, &tok.value.numeric);
+	return tok;
+}
+
+// & is an address when a number follows it, and otherwise an operator
+cca_token cca_parse_operator(char* code, unsigned int* readingPos) {
+	char* operators[] = { "<<", ">>", "+", "-", "*", "/", "%", "|", "^", "~", "(", ")", "&" };
+
+	cca_token tok = {0};
+	tok.type = CCA_TOK_OPERATOR;
+
+	for (int i = 0; i < sizeof(operators) / sizeof(char*); i++) {
+		unsigned int length = strlen(operators[i]);
+		if (strncmp(code + *readingPos, operators[i], length) == 0) {
+			tok.value.string = operators[i];
+			*readingPos += length - 1;
+			return tok;
+		}
 	}
 
-	tok.value.numeric = n;
-	--*readingPos;
+	tok.value.string = NULL;
 	return tok;
 }
 
 void cca_parse_comment(char* code, unsigned int* readingPos) {
-	while(code[*readingPos] != '\n') {
+	while(code[*readingPos] != '\n' && code[*readingPos] != '\0') {
 		++*readingPos;
 	}
 }
@@ -234,7 +546,7 @@ cca_marker cca_parse_marker(char* code, unsigned int* readingPos) {
 
 	char* string = malloc(stringCap * sizeof(char));
 	++*readingPos;
-	while(cca_is_identifier(code[*readingPos])) {
+	while(cca_is_identifier(code[*readingPos]) || cca_is_number(code[*readingPos])) {
 		++stringLen;
 
 		if (stringLen >= stringCap) {
@@ -248,7 +560,7 @@ cca_marker cca_parse_marker(char* code, unsigned int* readingPos) {
 	}
 
 	--*readingPos;
-	string = realloc(string, stringLen * sizeof(char));
+	string = realloc(string, (stringLen + 1) * sizeof(char));
 	string[stringLen] = '\0';
 
 	mark.name = string;
@@ -256,16 +568,23 @@ cca_marker cca_parse_marker(char* code, unsigned int* readingPos) {
 	return mark;
 }
 
-cca_token cca_parse_string(char* code, unsigned int* readingPos) {
+// leaves readingPos on the closing quote, or on the end of the source when there is none
+cca_token cca_parse_string(char* code, unsigned int* readingPos, unsigned int line, BOOL* error) {
 	cca_token tok = {0};
 	tok.type = 8;
 	unsigned int stringCap = 100;
-	unsigned int stringLen = 1;
+	unsigned int stringLen = 0;
 	char* string = malloc(stringCap * sizeof(char));
 	char quote = code[*readingPos];
 	++*readingPos;
 	
 	while(code[*readingPos] != quote) {
+		if (code[*readingPos] == '\0') {
+			printf("[ERROR] unterminated string at line %u\n", line);
+			*error = TRUE;
+			break;
+		}
+
 		++stringLen;
 
 		if (stringLen >= stringCap) {
@@ -273,11 +592,11 @@ cca_token cca_parse_string(char* code, unsigned int* readingPos) {
 			string = realloc(string, stringCap * sizeof(char));
 		}
 
-		string[stringLen-2] = code[*readingPos];
+		string[stringLen-1] = code[*readingPos];
 		++*readingPos;
 	}
 
-	string = realloc(string, stringLen * sizeof(char));
+	string = realloc(string, (stringLen + 1) * sizeof(char));
 
 	string[stringLen] = '\0';
 
@@ -285,42 +604,66 @@ cca_token cca_parse_string(char* code, unsigned int* readingPos) {
 	return tok;
 }
 
-cca_token* cca_assembler_lex(cca_file_content content) {
+// numbers that don't fit are errors, like anything else the lexer can't read
+void cca_lex_literal_check(char* code, unsigned int start, unsigned int end, unsigned int line, char status, BOOL* error) {
+	if (status == CCA_LITERAL_EMPTY) {
+		printf("[ERROR] %.*s has no digits at line %u\n", end - start + 1, code + start, line);
+		*error = TRUE;
+	}
+	if (status == CCA_LITERAL_OVERFLOW) {
+		printf("[ERROR] %.*s doesn't fit in 32 bits at line %u\n", end - start + 1, code + start, line);
+		*error = TRUE;
+	}
+}
+
+// the tokens always end in an end token. error is set when something can't be read, the lexer goes on past it so
+// every such place is reported
+cca_token* cca_assembler_lex(cca_file_content content, BOOL* error) {
 	// file data
 	unsigned int size = content.fileSize;
 	char* assembly = content.content;
-	unsigned int byteIndex = 0;
-
-	// markers
-	unsigned int markerCapacity = 100;
-	cca_marker* markers = malloc(markerCapacity * sizeof(cca_marker));
-	unsigned int markerCount = 0;
 
 	// tokens
 	unsigned int tokCapacity = 100;
 	cca_token* tokens = malloc(tokCapacity * sizeof(cca_token));
 	unsigned int readingPos = 0;
 	unsigned int tokCount = 0;
-	BOOL foundDef = FALSE;
+
+	// source position, newlines are counted up to where the next token starts
+	unsigned int line = 1;
+	unsigned int lineStart = 0;
+	unsigned int counted = 0;
 
 	// first lexing loop
-	while(readingPos < size - 1) {
+	while(readingPos < size) {
 		char current = assembly[readingPos];
+		unsigned int previousCount = tokCount;
+		unsigned int tokenStart = readingPos;
 
 		if (current == 0x00)
 			break;
 
+		for (; counted < readingPos; counted++) {
+			if (assembly[counted] == '\n') {
+				++line;
+				lineStart = counted + 1;
+			}
+		}
+
 		if (cca_is_ignorable(current)) {
 			// ignore it and continue to next itteration
 		} else if (cca_is_marker(current)) {
+			// markers stay in the token stream, they are resolved to offsets once the code is laid out
 			cca_marker newMarker = cca_parse_marker(assembly, &readingPos);
-			newMarker.marks = byteIndex;
-			++markerCount;
-			if (markerCount >= markerCapacity) {
-				markerCapacity *= 2;
-				markers = realloc(markers, markerCapacity);
+			cca_token newTok = {0};
+			newTok.type = CCA_TOK_LABEL;
+			newTok.value.string = newMarker.name;
+			++tokCount;
+			if (tokCount >= tokCapacity) {
+				tokCapacity *= 2;
+				tokens = realloc(tokens, tokCapacity * sizeof(cca_token));
 			}
-			markers[markerCount - 1] = newMarker;
+			tokens[tokCount - 1] = newTok;
 		} else if (cca_is_divider(current)) {
 			cca_token newTok = {0};
 			newTok.type = CCA_TOK_DIVIDER;
@@ -328,7 +671,7 @@ cca_token* cca_assembler_lex(cca_file_content content) {
 			++tokCount;
 			if (tokCount >= tokCapacity) {
 				tokCapacity *= 2;
-				tokens = realloc(tokens, tokCapacity);
+				tokens = realloc(tokens, tokCapacity * sizeof(cca_token));
 			}
 			tokens[tokCount - 1] = newTok;
 		} else if (cca_is_identifier(current)){
@@ -337,81 +680,311 @@ cca_token* cca_assembler_lex(cca_file_content content) {
 			++tokCount;
 			if (tokCount >= tokCapacity) {
 				tokCapacity *= 2;
-				tokens = realloc(tokens, tokCapacity);
+				tokens = realloc(tokens, tokCapacity * sizeof(cca_token));
 			}
 			tokens[tokCount - 1] = newTok;
-			byteIndex += 1;
-
-			if (foundDef) {
-				foundDef = FALSE;
-				--byteIndex;
-			} else if (newTok.type == CCA_TOK_IDENTIFIER && strcmp(newTok.value.string, "def") == 0) {
-				foundDef = TRUE;
-				--byteIndex;
-			} else if (newTok.type == CCA_TOK_IDENTIFIER) {
-				byteIndex += 3;
-			}
 		} else if (cca_is_number(current)) {
-			cca_token newTok = cca_parse_number(assembly, &readingPos);
+			char status;
+			cca_token newTok = cca_parse_number(assembly, size, &readingPos, &status);
+			cca_lex_literal_check(assembly, tokenStart, readingPos, line, status, error);
 			++tokCount;
 			if (tokCount >= tokCapacity) {
 				tokCapacity *= 2;
-				tokens = realloc(tokens, tokCapacity);
+				tokens = realloc(tokens, tokCapacity * sizeof(cca_token));
 			}
 			tokens[tokCount - 1] = newTok;
-			byteIndex += 4;
-		} else if (cca_is_address(current)){
-			cca_token newTok = cca_parse_address(assembly, &readingPos);
+		} else if (cca_is_address(current) && cca_is_number(assembly[readingPos + 1])) {
+			char status;
+			cca_token newTok = cca_parse_address(assembly, size, &readingPos, &status);
+			cca_lex_literal_check(assembly, tokenStart, readingPos, line, status, error);
 			++tokCount;
 			if (tokCount >= tokCapacity) {
 				tokCapacity *= 2;
-				tokens = realloc(tokens, tokCapacity);
+				tokens = realloc(tokens, tokCapacity * sizeof(cca_token));
 			}
 			tokens[tokCount - 1] = newTok;
-			byteIndex += 4;
 		} else if (cca_is_string(current)) {
-			cca_token newTok = cca_parse_string(assembly, &readingPos);
+			cca_token newTok = cca_parse_string(assembly, &readingPos, line, error);
 			++tokCount;
 			if (tokCount >= tokCapacity) {
 				tokCapacity *= 2;
-				tokens = realloc(tokens, tokCapacity);
+				tokens = realloc(tokens, tokCapacity * sizeof(cca_token));
 			}
 			tokens[tokCount - 1] = newTok;
+		} else if (cca_is_operator(current) || cca_is_address(current)) {
+			cca_token newTok = cca_parse_operator(assembly, &readingPos);
+			if (newTok.value.string == NULL) {
+				printf("[ERROR] unknown syntax: %c at line %u\n", current, line);
+				*error = TRUE;
+			} else {
+				++tokCount;
+				if (tokCount >= tokCapacity) {
+					tokCapacity *= 2;
+					tokens = realloc(tokens, tokCapacity * sizeof(cca_token));
+				}
+				tokens[tokCount - 1] = newTok;
+			}
 		} else if (cca_is_comment(current)) {
 			cca_parse_comment(assembly, &readingPos);
+			if (assembly[readingPos] == '\0')
+				break;
 		} else {
-			printf("[ERROR] unknown syntax: %c\n", current);
-			exit(1);
+			printf("[ERROR] unknown syntax: %c at line %u\n", current, line);
+			*error = TRUE;
+		}
+
+		if (tokCount != previousCount) {
+			tokens[tokCount - 1].line = line;
+			tokens[tokCount - 1].column = tokenStart - lineStart + 1;
 		}
 
 		++readingPos;
 	}
 
-	// shrink marker array
-	markers = realloc(markers, markerCount * sizeof(cca_token));
-
 	// shrink tokens array
 	tokens = realloc(tokens, (tokCount + 1) * sizeof(cca_token));
-	cca_token end;
+	cca_token end = {0};
 	end.type = CCA_TOK_END;
 	tokens[tokCount] = end;
 
-	// marker replacement
-	for (int i = 0; i < markerCount; i++) {
-		int j = 0;
-		while(tokens[j].type != 6) {
-			if (tokens[j].type == 0) {
-				if (strcmp(tokens[j].value.string, markers[i].name) == 0) {
-					tokens[j].type = 7;
-					tokens[j].value.numeric = markers[i].marks;
-				}
-			}
+	return tokens;
+}
+
+// constant expressions, in operands and data. numbers are 32 bits and wrap around like they do in the vm. a
+// definition or a label can have a number added to it, the number is kept apart until the header or the code is
+// laid out and the place of the definition or label is known
+typedef struct cca_value {
+	char type;
+	// the number, or what is added to the definition or label
+	unsigned int number;
+	unsigned int definition;
+	char* marker;
+} cca_value;
+
+typedef struct cca_expression {
+	cca_token* tokens;
+	unsigned int position;
+	// only numbers, for equ and data
+	BOOL constant;
+	BOOL error;
+} cca_expression;
+
+BOOL cca_token_is_operator(cca_token* tok, char* operator) {
+	return tok->type == CCA_TOK_OPERATOR && strcmp(tok->value.string, operator) == 0;
+}
+
+BOOL cca_expression_starts(cca_token* tok) {
+	if (tok->type == CCA_TOK_OPERATOR)
+		return cca_token_is_operator(tok, "(") || cca_token_is_operator(tok, "-") || cca_token_is_operator(tok, "~")
+			|| cca_token_is_operator(tok, "+") || cca_token_is_operator(tok, "&");
+
+	return tok->type == CCA_TOK_NUMBER || tok->type == CCA_TOK_ADDRESS || tok->type == CCA_TOK_DEFINITION || tok->type == CCA_TOK_IDENTIFIER;
+}
+
+// binding of a binary operator, 0 for anything else. an address right after a value is that value and the number
+unsigned int cca_expression_precedence(cca_token* tok) {
+	if (tok->type == CCA_TOK_ADDRESS)
+		return 3;
+	if (tok->type != CCA_TOK_OPERATOR)
+		return 0;
+
+	char* operators[] = { "|", "^", "&", "<<", ">>", "+", "-", "*", "/", "%" };
+	unsigned int precedences[] = { 1, 2, 3, 4, 4, 5, 5, 6, 6, 6 };
+	for (int i = 0; i < sizeof(precedences) / sizeof(unsigned int); i++) {
+		if (strcmp(tok->value.string, operators[i]) == 0)
+			return precedences[i];
+	}
 
-			++j;
+	return 0;
+}
+
+cca_value cca_expression_number(unsigned int number) {
+	cca_value value = { CCA_OPERAND_NUMBER, number, 0, NULL };
+	return value;
+}
+
+cca_value cca_expression_apply(cca_expression* expression, cca_token* tok, cca_value left, cca_value right) {
+	char* operator = tok->type == CCA_TOK_ADDRESS ? "&" : tok->value.string;
+
+	if (left.type != CCA_OPERAND_NUMBER || right.type != CCA_OPERAND_NUMBER) {
+		if (strcmp(operator, "+") == 0 && (left.type == CCA_OPERAND_NUMBER || right.type == CCA_OPERAND_NUMBER)) {
+			cca_value value = left.type != CCA_OPERAND_NUMBER ? left : right;
+			value.number = left.number + right.number;
+			return value;
 		}
+		if (strcmp(operator, "-") == 0 && right.type == CCA_OPERAND_NUMBER) {
+			left.number -= right.number;
+			return left;
+		}
+
+		printf("[ERROR] only numbers can be added to or taken from a label or definition at line %u\n", tok->line);
+		expression->error = TRUE;
+		return left;
 	}
-	
-	return tokens;
+
+	unsigned int x = left.number;
+	unsigned int y = right.number;
+	if ((strcmp(operator, "/") == 0 || strcmp(operator, "%") == 0) && y == 0) {
+		printf("[ERROR] division by zero at line %u\n", tok->line);
+		expression->error = TRUE;
+		return left;
+	}
+
+	switch (operator[0]) {
+		case '|': return cca_expression_number(x | y);
+		case '^': return cca_expression_number(x ^ y);
+		case '&': return cca_expression_number(x & y);
+		case '<': return cca_expression_number(y < 32 ? x << y : 0);
+		case '>': return cca_expression_number(y < 32 ? x >> y : 0);
+		case '+': return cca_expression_number(x + y);
+		case '-': return cca_expression_number(x - y);
+		case '*': return cca_expression_number(x * y);
+		case '/': return cca_expression_number(x / y);
+		default: return cca_expression_number(x % y);
+	}
+}
+
+cca_value cca_expression_binary(cca_expression* expression, cca_value left, unsigned int minimum);
+
+cca_value cca_expression_primary(cca_expression* expression) {
+	cca_token* tok = &expression->tokens[expression->position];
+
+	if (tok->type == CCA_TOK_NUMBER) {
+		++expression->position;
+		return cca_expression_number(tok->value.numeric);
+	}
+
+	if (tok->type == CCA_TOK_DEFINITION && !expression->constant) {
+		++expression->position;
+		cca_value value = { CCA_OPERAND_DEFINITION, 0, tok->value.numeric, NULL };
+		return value;
+	}
+
+	if (tok->type == CCA_TOK_IDENTIFIER && !expression->constant && strcmp(tok->value.string, "sizeof") != 0) {
+		++expression->position;
+		cca_value value = { CCA_OPERAND_MARKER, 0, 0, tok->value.string };
+		return value;
+	}
+
+	if (cca_token_is_operator(tok, "(")) {
+		++expression->position;
+		cca_value value = cca_expression_binary(expression, cca_expression_primary(expression), 1);
+		if (!cca_token_is_operator(&expression->tokens[expression->position], ")")) {
+			printf("[ERROR] missing ) at line %u\n", tok->line);
+			expression->error = TRUE;
+			return value;
+		}
+		++expression->position;
+		return value;
+	}
+
+	if (cca_token_is_operator(tok, "-") || cca_token_is_operator(tok, "~") || cca_token_is_operator(tok, "+")) {
+		++expression->position;
+		cca_value value = cca_expression_primary(expression);
+		if (value.type != CCA_OPERAND_NUMBER) {
+			printf("[ERROR] %s only works on numbers at line %u\n", tok->value.string, tok->line);
+			expression->error = TRUE;
+			return value;
+		}
+		if (tok->value.string[0] == '-')
+			value.number = -value.number;
+		else if (tok->value.string[0] == '~')
+			value.number = ~value.number;
+		return value;
+	}
+
+	if (tok->type == CCA_TOK_IDENTIFIER && strcmp(tok->value.string, "sizeof") == 0)
+		printf("[ERROR] sizeof wants a definition in parentheses at line %u\n", tok->line);
+	else if (tok->type == CCA_TOK_IDENTIFIER)
+		printf("[ERROR] '%s' isn't a constant at line %u\n", tok->value.string, tok->line);
+	else if (tok->type == CCA_TOK_END)
+		puts("[ERROR] the source ends in the middle of an expression");
+	else
+		printf("[ERROR] expected a value at line %u\n", tok->line);
+	// a name is skipped, anything else can still start the next instruction
+	if (tok->type == CCA_TOK_IDENTIFIER)
+		++expression->position;
+	expression->error = TRUE;
+	return cca_expression_number(0);
+}
+
+// precedence climbing, everything binding at least as tight as minimum is folded into left
+cca_value cca_expression_binary(cca_expression* expression, cca_value left, unsigned int minimum) {
+	while (TRUE) {
+		cca_token* tok = &expression->tokens[expression->position];
+		unsigned int precedence = cca_expression_precedence(tok);
+		if (precedence == 0 || precedence < minimum)
+			return left;
+
+		++expression->position;
+		cca_value right = tok->type == CCA_TOK_ADDRESS ? cca_expression_number(tok->value.numeric) : cca_expression_primary(expression);
+		while (cca_expression_precedence(&expression->tokens[expression->position]) > precedence)
+			right = cca_expression_binary(expression, right, precedence + 1);
+
+		left = cca_expression_apply(expression, tok, left, right);
+	}
+}
+
+cca_value cca_expression_evaluate(cca_expression* expression) {
+	return cca_expression_binary(expression, cca_expression_primary(expression), 1);
+}
+
+// bytes per value of a data directive, 0 if it isn't one
+unsigned int cca_data_width(char* directive) {
+	if (strcmp(directive, "db") == 0)
+		return 1;
+	if (strcmp(directive, "dw") == 0)
+		return 2;
+	if (strcmp(directive, "dd") == 0)
+		return 4;
+	return 0;
+}
+
+// the values of a db, dw or dd after the directive, big endian numbers separated by commas and for db strings too.
+// returns where the tokens after them start
+unsigned int cca_parse_data(cca_token* tokens, unsigned int position, unsigned int width, cca_definition* def, BOOL* error) {
+	unsigned int capacity = 16;
+	unsigned int length = 0;
+	char* bytes = malloc(capacity);
+	char* directive = tokens[position - 1].value.string;
+
+	while (TRUE) {
+		cca_token* token = &tokens[position];
+		unsigned int valueLength = token->type == CCA_TOK_STRING ? strlen(token->value.string) : width;
+		while (length + valueLength > capacity) {
+			capacity *= 2;
+			bytes = realloc(bytes, capacity);
+		}
+
+		if (token->type == CCA_TOK_STRING && width == 1) {
+			memcpy(bytes + length, token->value.string, valueLength);
+			length += valueLength;
+			++position;
+		} else if (cca_expression_starts(token)) {
+			cca_expression expression = { tokens, position, TRUE, FALSE };
+			unsigned int number = cca_expression_evaluate(&expression).number;
+			if (width < 4 && number >> (width * 8) != 0) {
+				printf("[ERROR] %u doesn't fit in a %s at line %u\n", number, directive, token->line);
+				*error = TRUE;
+			}
+			for (int shift = (width - 1) * 8; shift >= 0; shift -= 8)
+				bytes[length++] = (number >> shift) & 0xff;
+			*error |= expression.error;
+			position = expression.position;
+		} else {
+			printf("[ERROR] %s wants %s at line %u\n", directive, width == 1 ? "numbers or strings" : "numbers", tokens[position - 1].line);
+			*error = TRUE;
+			break;
+		}
+
+		if (tokens[position].type != CCA_TOK_DIVIDER)
+			break;
+		++position;
+	}
+
+	def->value = bytes;
+	def->length = length;
+	return position;
 }
 
 cca_definition_list cca_assembler_define_parser(cca_token** tokens) {
@@ -422,29 +995,51 @@ cca_definition_list cca_assembler_define_parser(cca_token** tokens) {
 
 	unsigned int definitionCapacity = 100;
 	unsigned int definitionLength = 0;
-	cca_definition* definitions = malloc(definitionCapacity * sizeof(cca_definition*));
+	cca_definition* definitions = malloc(definitionCapacity * sizeof(cca_definition));
 
 	unsigned int totalHeaderLength = 0;
+	BOOL error = FALSE;
 
 	while ((*tokens)[readingPosition].type != 6) {
 		// check if define
-		if ((*tokens)[readingPosition].type == 0 && strcmp((*tokens)[readingPosition].value.string, "def") == 0) {			
+		if ((*tokens)[readingPosition].type == 0 && strcmp((*tokens)[readingPosition].value.string, "def") == 0) {
+			cca_token* value = &(*tokens)[readingPosition+2];
 			cca_definition def = {
 				.name = (*tokens)[readingPosition+1].value.string,
-				.value = (*tokens)[readingPosition+2].value.string,
+				.value = value->value.string,
 				.pointer = totalHeaderLength
 			};
 
-			totalHeaderLength += strlen((*tokens)[readingPosition+2].value.string);
+			if (value->type == CCA_TOK_IDENTIFIER && strcmp(value->value.string, "incbin") == 0) {
+				// only the length is needed until the output is written
+				struct stat info;
+				if (value[1].type != CCA_TOK_STRING || stat(value[1].value.string, &info) != 0 || !S_ISREG(info.st_mode)) {
+					printf("[ERROR] incbin wants a file at line %u\n", value->line);
+					error = TRUE;
+				} else if (info.st_size > 0xffffffffu - totalHeaderLength) {
+					printf("[ERROR] '%s' is too big to include at line %u\n", value[1].value.string, value->line);
+					error = TRUE;
+				} else {
+					def.value = "";
+					def.file = value[1].value.string;
+					def.length = info.st_size;
+				}
+				readingPosition += value[1].type != CCA_TOK_END ? 4 : 3;
+			} else if (value->type == CCA_TOK_IDENTIFIER && cca_data_width(value->value.string) != 0) {
+				readingPosition = cca_parse_data(*tokens, readingPosition + 3, cca_data_width(value->value.string), &def, &error);
+			} else {
+				def.length = strlen(def.value);
+				readingPosition += 3;
+			}
+
+			totalHeaderLength += def.length;
 
 			if (definitionLength >= definitionCapacity) {
 				definitionCapacity *= 2;
-				cca_definition* definitions = realloc(definitions, definitionCapacity * sizeof(cca_definition*));
+				definitions = realloc(definitions, definitionCapacity * sizeof(cca_definition));
 			}
 
 			definitions[definitionLength++] = def;
-			
-			readingPosition += 3;
 			continue;
 		}
 
@@ -475,58 +1070,75 @@ cca_definition_list cca_assembler_define_parser(cca_token** tokens) {
 
 	cca_definition_list definitionList = {
 		.definitions = definitions,
-		.length = definitionLength
+		.length = definitionLength,
+		.error = error
 	};
 
 	return definitionList;
 }
 
-void cca_assembler_replace_defs(cca_token** tokens, cca_definition_list defs) {
-	// replace defs
-	for (int i = 0; i < defs.length; i++) {
-		int j = 0;
-		while ((*tokens)[j].type != CCA_TOK_END) {
-			if ((*tokens)[j].type == CCA_TOK_IDENTIFIER) {
-				(*tokens)[j].type = CCA_TOK_NUMBER;
-				(*tokens)[j].value.numeric = defs.definitions[i].pointer;
-			}
-			++j;
-		}
-	}
-}
+// bytes of a file that go in front of the byte at position, they stay in the file until the output is written
+typedef struct cca_splice {
+	unsigned int position;
+	unsigned int length;
+	char* file;
+} cca_splice;
 
 typedef struct cca_bytecode {
 	char* bytecode;
 	unsigned int bytecodeCapacity;
 	unsigned int bytecodeLength;
+	cca_splice* splices;
+	unsigned int spliceCount;
+	unsigned int spliceCapacity;
 } cca_bytecode;
 
+cca_bytecode cca_bytecode_create(unsigned int capacity) {
+	cca_bytecode bytecode = {0};
+	bytecode.bytecodeCapacity = capacity;
+	bytecode.bytecodeLength = 0;
+	bytecode.bytecode = malloc(bytecode.bytecodeCapacity);
+	return bytecode;
+}
+
 void cca_bytecode_add_byte(cca_bytecode* bytecode, char byte) {
 	bytecode->bytecodeLength += 1;
 	
 	if (bytecode->bytecodeLength >= bytecode->bytecodeCapacity) {
-		bytecode->bytecodeCapacity *= 2;
-		bytecode->bytecode = realloc(bytecode->bytecode, bytecode->bytecodeLength);
+		while (bytecode->bytecodeLength >= bytecode->bytecodeCapacity)
+			bytecode->bytecodeCapacity *= 2;
+		bytecode->bytecode = realloc(bytecode->bytecode, bytecode->bytecodeCapacity);
 	}
 
 	bytecode->bytecode[bytecode->bytecodeLength - 1] = byte;
 }
 
-void cca_bytecode_add_reg(cca_bytecode* bytecode, char* reg) {
+unsigned int cca_register_index(char* reg) {
 	switch(reg[0]) {
-		case 'a': {cca_bytecode_add_byte(bytecode, 0x00);break;}
-		case 'b': {cca_bytecode_add_byte(bytecode, 0x01);break;}
-		case 'c': {cca_bytecode_add_byte(bytecode, 0x02);break;}
-		case 'd': {cca_bytecode_add_byte(bytecode, 0x03);break;}
+		case 'a': return 0x00;
+		case 'b': return 0x01;
+		case 'c': return 0x02;
+		case 'v': return CCA_REGISTER_VIRTUAL + strtoul(reg + 1, NULL, 10);
+		default: return 0x03;
 	}
 }
 
+void cca_bytecode_add_reg(cca_bytecode* bytecode, unsigned int reg) {
+	cca_bytecode_add_byte(bytecode, reg & 0xff);
+}
+
+void cca_bytecode_add_short(cca_bytecode* bytecode, unsigned int n) {
+	cca_bytecode_add_byte(bytecode, (n >> 8) & 0xff);
+	cca_bytecode_add_byte(bytecode, n & 0xff);
+}
+
 void cca_bytecode_add_uint(cca_bytecode* bytecode, unsigned int n) {
 	bytecode->bytecodeLength += 4;
 	
 	if (bytecode->bytecodeLength >= bytecode->bytecodeCapacity) {
-		bytecode->bytecodeCapacity *= 2;
-		bytecode->bytecode = realloc(bytecode->bytecode, bytecode->bytecodeLength);
+		while (bytecode->bytecodeLength >= bytecode->bytecodeCapacity)
+			bytecode->bytecodeCapacity *= 2;
+		bytecode->bytecode = realloc(bytecode->bytecode, bytecode->bytecodeCapacity);
 	}
 
 	bytecode->bytecode[bytecode->bytecodeLength - 4] = (n >> 24) & 0xff;
@@ -535,420 +1147,1959 @@ void cca_bytecode_add_uint(cca_bytecode* bytecode, unsigned int n) {
 	bytecode->bytecode[bytecode->bytecodeLength - 1] = n & 0xff;
 }
 
-char cca_assembler_bytegeneration(cca_token* tokens, cca_definition_list defs) {
-	FILE* fp = fopen("test.ccb", "wb+");
+void cca_bytecode_add_uint_le(cca_bytecode* bytecode, unsigned int n) {
+	cca_bytecode_add_byte(bytecode, n & 0xff);
+	cca_bytecode_add_byte(bytecode, (n >> 8) & 0xff);
+	cca_bytecode_add_byte(bytecode, (n >> 16) & 0xff);
+	cca_bytecode_add_byte(bytecode, (n >> 24) & 0xff);
+}
 
-	cca_bytecode bytecode;
-	bytecode.bytecodeCapacity = 100;
-	bytecode.bytecodeLength = 0;
-	bytecode.bytecode = malloc(bytecode.bytecodeCapacity);
+void cca_bytecode_splice(cca_bytecode* bytecode, char* file, unsigned int length) {
+	if (bytecode->spliceCount >= bytecode->spliceCapacity) {
+		bytecode->spliceCapacity = bytecode->spliceCapacity != 0 ? bytecode->spliceCapacity * 2 : 4;
+		bytecode->splices = realloc(bytecode->splices, bytecode->spliceCapacity * sizeof(cca_splice));
+	}
 
-	// generate bytes of the header
-	for (int i = 0; i < defs.length; i++) {
-		char* bytes = defs.definitions[i].value;
-		for (int j = 0; bytes[j] != '\0'; j++) {
-			cca_bytecode_add_byte(&bytecode, bytes[j]);
+	cca_splice splice = { bytecode->bytecodeLength, length, file };
+	bytecode->splices[bytecode->spliceCount++] = splice;
+}
+
+// length with the splices
+unsigned int cca_bytecode_size(cca_bytecode* bytecode) {
+	unsigned int size = bytecode->bytecodeLength;
+	for (unsigned int i = 0; i < bytecode->spliceCount; i++)
+		size += bytecode->splices[i].length;
+	return size;
+}
+
+void cca_bytecode_free(cca_bytecode* bytecode) {
+	free(bytecode->bytecode);
+	free(bytecode->splices);
+}
+
+// appends another bytecode, its splices stay splices
+void cca_bytecode_append(cca_bytecode* bytecode, cca_bytecode* other) {
+	unsigned int position = 0;
+	for (unsigned int i = 0; i <= other->spliceCount; i++) {
+		unsigned int end = i < other->spliceCount ? other->splices[i].position : other->bytecodeLength;
+		for (; position < end; position++)
+			cca_bytecode_add_byte(bytecode, other->bytecode[position]);
+		if (i < other->spliceCount)
+			cca_bytecode_splice(bytecode, other->splices[i].file, other->splices[i].length);
+	}
+}
+
+// reads the splices into the bytes, for everything that wants the output in memory
+BOOL cca_bytecode_materialize(cca_bytecode* bytecode) {
+	if (bytecode->spliceCount == 0)
+		return TRUE;
+
+	cca_bytecode result = cca_bytecode_create(cca_bytecode_size(bytecode) + 1);
+	BOOL ok = TRUE;
+	unsigned int position = 0;
+
+	for (unsigned int i = 0; i <= bytecode->spliceCount; i++) {
+		unsigned int end = i < bytecode->spliceCount ? bytecode->splices[i].position : bytecode->bytecodeLength;
+		memcpy(result.bytecode + result.bytecodeLength, bytecode->bytecode + position, end - position);
+		result.bytecodeLength += end - position;
+		position = end;
+		if (i == bytecode->spliceCount)
+			break;
+
+		cca_splice* splice = &bytecode->splices[i];
+		FILE* fp = fopen(splice->file, "rb");
+		if (fp == NULL || fread(result.bytecode + result.bytecodeLength, 1, splice->length, fp) != splice->length) {
+			printf("[ERROR] could not read %u bytes of '%s'\n", splice->length, splice->file);
+			ok = FALSE;
 		}
+		if (fp != NULL)
+			fclose(fp);
+		result.bytecodeLength += splice->length;
 	}
 
-	
+	cca_bytecode_free(bytecode);
+	*bytecode = result;
+	return ok;
+}
 
-	cca_bytecode_add_uint(&bytecode, 0x1d1d1d1d);
+BOOL cca_write_all(int fd, char* bytes, unsigned int length) {
+	while (length > 0) {
+		ssize_t written = write(fd, bytes, length);
+		if (written <= 0)
+			return FALSE;
+		bytes += written;
+		length -= written;
+	}
 
-	char error = 0;
-	unsigned int i = 0;
-	while(tokens[i].type != CCA_TOK_END) {
-		if (tokens[i].type != CCA_TOK_OPCODE) {
-			if (tokens[i].type == CCA_TOK_NUMBER || tokens[i].type == CCA_TOK_ADDRESS)
-				printf("[ERROR] unexpected token: '%d' while generating bytecode\n", tokens[i].value.numeric);
-			else
-				printf("[ERROR] unexpected token: '%s' while generating bytecode\n", tokens[i].value.string);
-			i += 1;
-			error = 1;
-		} else if (strcmp(tokens[i].value.string, "stp") == 0) {
-			if (tokens[i + 1].type == CCA_TOK_OPCODE || tokens[i + 1].type == CCA_TOK_END) {
-				cca_bytecode_add_byte(&bytecode, 0x00);
-				i += 1;
-			} else {
-				puts("[ERROR] on 'stp' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "psh") == 0) {
-			if (tokens[i + 1].type == CCA_TOK_NUMBER) {
-				cca_bytecode_add_byte(&bytecode, 0x01);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 1].value.numeric);
-				i += 2;
-			} else if (tokens[i + 1].type == CCA_TOK_REGISTER) {
-                cca_bytecode_add_byte(&bytecode, 0x02);
-                cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-                i += 2;
-            } else if (tokens[i + 1].type == CCA_TOK_ADDRESS) {
-                cca_bytecode_add_byte(&bytecode, 0x0B);
-                cca_bytecode_add_uint(&bytecode, tokens[i + 1].value.numeric);
-                i += 2;
-			} else {
-				puts("[ERROR] on 'psh' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "pop") == 0) {
-			if (tokens[i + 1].type == CCA_TOK_REGISTER) {
-				cca_bytecode_add_byte(&bytecode, 0x03);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				i += 2;
-			} else if (tokens[i + 1].type == 7) {
-				cca_bytecode_add_byte(&bytecode, 0x04);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 1].value.numeric);
-				i += 2;
-			} else {
-				puts("[ERROR] on 'pop' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "dup") == 0) {
-			if (tokens[i + 1].type == 3 || tokens[i + 1].type == 6) {
-				cca_bytecode_add_byte(&bytecode, 0x05);
-				i += 1;
-			} else {
-				puts("[ERROR] on 'dup' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "mov") == 0) {
-			if (tokens[i + 1].type == CCA_TOK_REGISTER && tokens[i + 2].type == CCA_TOK_DIVIDER && tokens[i + 3].type == CCA_TOK_NUMBER) {
-				cca_bytecode_add_byte(&bytecode, 0x06);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 3].value.numeric);
-				i += 4;
-			} else if (tokens[i + 1].type == CCA_TOK_ADDRESS && tokens[i + 2].type == CCA_TOK_DIVIDER && tokens[i + 3].type == CCA_TOK_NUMBER) {
-				cca_bytecode_add_byte(&bytecode, 0x07);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 1].value.numeric);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 3].value.numeric);
-				i += 4;
-			} else if (tokens[i + 1].type == CCA_TOK_REGISTER && tokens[i + 2].type == CCA_TOK_DIVIDER && tokens[i + 3].type == CCA_TOK_ADDRESS) {
-				cca_bytecode_add_byte(&bytecode, 0x08);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 3].value.numeric);
-				i += 4;
-			} else if (tokens[i + 1].type == CCA_TOK_ADDRESS && tokens[i + 2].type == CCA_TOK_DIVIDER && tokens[i + 3].type == CCA_TOK_REGISTER) {
-				cca_bytecode_add_byte(&bytecode, 0x09);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 1].value.numeric);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 3].value.string);
-				i += 4;
-			} else if (tokens[i + 1].type == CCA_TOK_REGISTER && tokens[i + 2].type == CCA_TOK_DIVIDER && tokens[i + 3].type == CCA_TOK_REGISTER) {
-                cca_bytecode_add_byte(&bytecode, 0x0a);
-                cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-                cca_bytecode_add_reg(&bytecode, tokens[i + 3].value.string);
-                i += 4;
-            } else if (tokens[i + 1].type == CCA_TOK_ADDRESS && tokens[i + 2].type == CCA_TOK_DIVIDER && tokens[i + 3].type == CCA_TOK_REGISTER) {
-			    cca_bytecode_add_byte(&bytecode, 0x0B);
-			    cca_bytecode_add_uint(&bytecode, tokens[i + 1].value.numeric);
-			    cca_bytecode_add_uint(&bytecode, tokens[i + 3].value.numeric);
-			    i += 4;
-			} else {
-				puts("[ERROR] on 'mov' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "add") == 0) {
-			if (tokens[i + 1].type == 4 && tokens[i + 2].type == 2 && tokens[i + 3].type == 4) {
-				cca_bytecode_add_byte(&bytecode, 0x10);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 3].value.string);
-				i += 4;
-			} else if (tokens[i + 1].type == 3 || tokens[i + 1].type == 6) {
-				cca_bytecode_add_byte(&bytecode, 0x11);
-				i += 1;
-			} else {
-				puts("[ERROR] on 'add' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "sub") == 0) {
-			if (tokens[i + 1].type == 4 && tokens[i + 2].type == 2 && tokens[i + 3].type == 4) {
-				cca_bytecode_add_byte(&bytecode, 0x12);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 3].value.string);
-				i += 4;
-			} else if (tokens[i + 1].type == 3 || tokens[i + 1].type == 6) {
-				cca_bytecode_add_byte(&bytecode, 0x13);
-				i += 1;
-			} else {
-				puts("[ERROR] on 'sub' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "mul") == 0) {
-			if (tokens[i + 1].type == 4 && tokens[i + 2].type == 2 && tokens[i + 3].type == 4) {
-				cca_bytecode_add_byte(&bytecode, 0x14);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 3].value.string);
-				i += 4;
-			} else if (tokens[i + 1].type == 3 || tokens[i + 1].type == 6) {
-				cca_bytecode_add_byte(&bytecode, 0x15);
-				i += 1;
-			} else {
-				puts("[ERROR] on 'mul' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "div") == 0) {
-			if (tokens[i + 1].type == 4 && tokens[i + 2].type == 2 && tokens[i + 3].type == 4) {
-				cca_bytecode_add_byte(&bytecode, 0x16);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 3].value.string);
-				i += 4;
-			} else if (tokens[i + 1].type == 3 || tokens[i + 1].type == 6) {
-				cca_bytecode_add_byte(&bytecode, 0x17);
-				i += 1;
-			} else {
-				puts("[ERROR] on 'div' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "not") == 0) {
-			if (tokens[i + 1].type == 4) {
-				cca_bytecode_add_byte(&bytecode, 0x18);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				i += 2;
-			} else if (tokens[i + 1].type == 3 || tokens[i + 1].type == 6) {
-				cca_bytecode_add_byte(&bytecode, 0x19);
-				i += 1;
-			} else {
-				puts("[ERROR] on 'not' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "and") == 0) {
-			if (tokens[i + 1].type == 4 && tokens[i + 2].type == 2 && tokens[i + 3].type == 4) {
-				cca_bytecode_add_byte(&bytecode, 0x20);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 3].value.string);
-				i += 4;
-			} else if (tokens[i + 1].type == 3 || tokens[i + 1].type == 6) {
-				cca_bytecode_add_byte(&bytecode, 0x21);
-				i += 1;
-			} else {
-				puts("[ERROR] on 'and' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "or") == 0) {
-			if (tokens[i + 1].type == 4 && tokens[i + 2].type == 2 && tokens[i + 3].type == 4) {
-				cca_bytecode_add_byte(&bytecode, 0x22);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 3].value.string);
-				i += 4;
-			} else if (tokens[i + 1].type == 3 || tokens[i + 1].type == 6) {
-				cca_bytecode_add_byte(&bytecode, 0x23);
-				i += 1;
-			} else {
-				puts("[ERROR] on 'or' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "xor") == 0) {
-			if (tokens[i + 1].type == 4 && tokens[i + 2].type == 2 && tokens[i + 3].type == 4) {
-				cca_bytecode_add_byte(&bytecode, 0x24);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 3].value.string);
-				i += 4;
-			} else if (tokens[i + 1].type == 3 || tokens[i + 1].type == 6) {
-				cca_bytecode_add_byte(&bytecode, 0x25);
-				i += 1;
-			} else {
-				puts("[ERROR] on 'xor' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "inc") == 0) {
-			if (tokens[i + 1].type == 4) {
-				cca_bytecode_add_byte(&bytecode, 0x50);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				i += 2;
-			} else if (tokens[i + 1].type == 3 || tokens[i + 1].type == 6) {
-				cca_bytecode_add_byte(&bytecode, 0x52);
-				i += 1;
-			} else {
-				puts("[ERROR] on 'inc' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "dec") == 0) {
-			if (tokens[i + 1].type == 4) {
-				cca_bytecode_add_byte(&bytecode, 0x51);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				i += 2;
-			} else if (tokens[i + 1].type == 3 || tokens[i + 1].type == 6) {
-				cca_bytecode_add_byte(&bytecode, 0x53);
-				i += 1;
-			} else {
-				puts("[ERROR] on 'dec' instruction, illegal combination of operands");
-				error = 1;
-				i += 1;
-			}
-		} else if (strcmp(tokens[i].value.string, "syscall") == 0) {
-			if (tokens[i + 1].type == 3 || tokens[i + 1].type == 6) {
-				cca_bytecode_add_byte(&bytecode, 0xff);
-			} else {
-				error = 1;
-				puts("[ERROR] on 'syscall' instuction, illegal combination of operands");
-			}
+	return TRUE;
+}
 
-			i += 1;
-		} else if (strcmp(tokens[i].value.string, "frs") == 0) {
-			if (tokens[i + 1].type == 3 || tokens[i + 1].type == 6) {
-				cca_bytecode_add_byte(&bytecode, 0x40);
-			} else {
-				error = 1;
-				puts("[ERROR] on 'syscall' instuction, illegal combination of operands");
-			}
+// copies length bytes of a file to fd in the kernel. copy_file_range can share extents on filesystems that support
+// it, sendfile still works where it can't like across filesystems or into a pipe, and anything else gets read and
+// written
+BOOL cca_copy_file(char* file, unsigned int length, int fd) {
+	int input = open(file, O_RDONLY);
+	if (input < 0) {
+		printf("[ERROR] could not open file: %s\n", file);
+		return FALSE;
+	}
 
-			i += 1;
-		} else if (strcmp(tokens[i].value.string, "call") == 0) {
-			if (tokens[i + 1].type == 7) {
-				cca_bytecode_add_byte(&bytecode, 0x60);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 1].value.numeric);
-			} else {
-				error = 1;
-				puts("[ERROR] on 'call' instuction, illegal combination of operands");
-			}
-			i += 2;
-		} else if (strcmp(tokens[i].value.string, "ret") == 0) {
-			if (tokens[i + 1].type == 3 || tokens[i + 1].type == 6) {
-				cca_bytecode_add_byte(&bytecode, 0x61);
-			} else {
-				error = 1;
-				puts("[ERROR] on 'ret' instuction, illegal combination of operands");
-			}
-			i += 1;
-		} else if (strcmp(tokens[i].value.string, "cmp") == 0) {
-			if (tokens[i + 1].type == 4 && tokens[i + 2].type == 2 && tokens[i + 3].type == 4) {
-				cca_bytecode_add_byte(&bytecode, 0x30);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 3].value.string);
-				i += 4;
-			} else if (tokens[i + 1].type == 4 && tokens[i + 2].type == 2 && tokens[i + 3].type == 1) {
-				cca_bytecode_add_byte(&bytecode, 0x31);
-				cca_bytecode_add_reg(&bytecode, tokens[i + 1].value.string);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 3].value.numeric);
-				i += 4;
-			} else if (tokens[i + 1].type == 1 && (tokens[i + 2].type == 3 || tokens[i + 2].type == 6)) {
-				cca_bytecode_add_byte(&bytecode, 0x32);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 1].value.numeric);
-				i += 2;
-			} else {
-				puts("[ERROR] on 'cmp' instuction, illegal combination of operands");
-				error = 1;
-				i += 1;
+	unsigned int copied = 0;
+#ifdef SYS_copy_file_range
+	while (copied < length) {
+		long n = syscall(SYS_copy_file_range, input, NULL, fd, NULL, (size_t) (length - copied), 0);
+		if (n <= 0)
+			break;
+		copied += n;
+	}
+#endif
+	while (copied < length) {
+		ssize_t n = sendfile(fd, input, NULL, length - copied);
+		if (n <= 0)
+			break;
+		copied += n;
+	}
+	while (copied < length) {
+		char buffer[1 << 16];
+		ssize_t n = read(input, buffer, length - copied < sizeof(buffer) ? length - copied : sizeof(buffer));
+		if (n <= 0 || !cca_write_all(fd, buffer, n))
+			break;
+		copied += n;
+	}
+
+	close(input);
+	if (copied < length)
+		printf("[ERROR] could only copy %u of %u bytes of '%s'\n", copied, length, file);
+	return copied == length;
+}
+
+// writes the bytes to fd with the splices copied straight from their files
+BOOL cca_bytecode_write(cca_bytecode* bytecode, int fd) {
+	unsigned int position = 0;
+	for (unsigned int i = 0; i < bytecode->spliceCount; i++) {
+		cca_splice* splice = &bytecode->splices[i];
+		if (!cca_write_all(fd, bytecode->bytecode + position, splice->position - position) || !cca_copy_file(splice->file, splice->length, fd))
+			return FALSE;
+		position = splice->position;
+	}
+
+	return cca_write_all(fd, bytecode->bytecode + position, bytecode->bytecodeLength - position);
+}
+
+// writes the bytes into a file of their own
+BOOL cca_bytecode_store(cca_bytecode* bytecode, char* fileName, int mode) {
+	int fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, mode);
+	BOOL written = fd >= 0 && cca_bytecode_write(bytecode, fd);
+	if (fd >= 0 && close(fd) != 0)
+		written = FALSE;
+	if (!written)
+		printf("[ERROR] could not write '%s'\n", fileName);
+	return written;
+}
+
+// symbol table
+#define CCA_SYMBOL_MISSING 0xffffffff
+
+typedef struct cca_symbol_table {
+	char** names;
+	unsigned int* values;
+	unsigned int capacity;
+	unsigned int count;
+} cca_symbol_table;
+
+unsigned int cca_hash_uint(unsigned int hash, unsigned int n) {
+	for (int i = 0; i < 4; i++) {
+		hash ^= (n >> (i * 8)) & 0xff;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+unsigned int cca_hash_string(char* string) {
+	unsigned int hash = 2166136261u;
+
+	for (int i = 0; string[i] != '\0'; i++) {
+		hash ^= (unsigned char) string[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+cca_symbol_table cca_symbol_table_create(unsigned int capacity) {
+	cca_symbol_table table;
+	table.capacity = 16;
+	while (table.capacity < capacity * 2)
+		table.capacity *= 2;
+	table.count = 0;
+	table.names = calloc(table.capacity, sizeof(char*));
+	table.values = malloc(table.capacity * sizeof(unsigned int));
+	return table;
+}
+
+unsigned int cca_symbol_table_find(cca_symbol_table* table, char* name) {
+	unsigned int slot = cca_hash_string(name) & (table->capacity - 1);
+
+	while (table->names[slot] != NULL) {
+		if (strcmp(table->names[slot], name) == 0)
+			return table->values[slot];
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+
+	return CCA_SYMBOL_MISSING;
+}
+
+void cca_symbol_table_insert(cca_symbol_table* table, char* name, unsigned int value) {
+	// keep the load factor below one half
+	if ((table->count + 1) * 2 > table->capacity) {
+		cca_symbol_table grown = cca_symbol_table_create(table->capacity);
+		for (int i = 0; i < table->capacity; i++) {
+			if (table->names[i] != NULL)
+				cca_symbol_table_insert(&grown, table->names[i], table->values[i]);
+		}
+		free(table->names);
+		free(table->values);
+		*table = grown;
+	}
+
+	unsigned int slot = cca_hash_string(name) & (table->capacity - 1);
+	while (table->names[slot] != NULL) {
+		if (strcmp(table->names[slot], name) == 0) {
+			table->values[slot] = value;
+			return;
+		}
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+
+	table->names[slot] = name;
+	table->values[slot] = value;
+	++table->count;
+}
+
+void cca_symbol_table_free(cca_symbol_table* table) {
+	free(table->names);
+	free(table->values);
+}
+
+// included files, lexed once per process and shared by every module and worker that includes them. the tokens
+// are only ever copied out, the strings in them are shared
+typedef struct cca_include {
+	char* path;
+	cca_token* tokens;
+	unsigned int tokenCount;
+} cca_include;
+
+cca_include* cca_includes = NULL;
+unsigned int cca_include_count = 0;
+unsigned int cca_include_capacity = 0;
+cca_symbol_table cca_include_table;
+pthread_mutex_t cca_include_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// the tokens of the file at path, without the end token. returns FALSE when it can't be read
+BOOL cca_include_lookup(char* path, cca_token** tokens, unsigned int* tokenCount) {
+	// a file is lexed under the lock, whoever wants it as well waits instead of lexing it again
+	pthread_mutex_lock(&cca_include_lock);
+	if (cca_includes == NULL) {
+		cca_include_capacity = 16;
+		cca_includes = malloc(cca_include_capacity * sizeof(cca_include));
+		cca_include_table = cca_symbol_table_create(cca_include_capacity);
+	}
+
+	unsigned int index = cca_symbol_table_find(&cca_include_table, path);
+	if (index == CCA_SYMBOL_MISSING) {
+		cca_file_content content;
+		if (!cca_load_file(path, &content)) {
+			pthread_mutex_unlock(&cca_include_lock);
+			return FALSE;
+		}
+
+		// a file that doesn't lex isn't kept, whoever includes it next reports it again
+		BOOL lexError = FALSE;
+		cca_token* lexed = cca_assembler_lex(content, &lexError);
+		free(content.content);
+		if (lexError) {
+			printf("[ERROR] could not include '%s'\n", path);
+			free(lexed);
+			pthread_mutex_unlock(&cca_include_lock);
+			return FALSE;
+		}
+
+		index = cca_include_count++;
+		cca_include include = { strdup(path), lexed, 0 };
+		for (; include.tokens[include.tokenCount].type != CCA_TOK_END; include.tokenCount++)
+			include.tokens[include.tokenCount].file = index + 1;
+
+		if (cca_include_count >= cca_include_capacity) {
+			cca_include_capacity *= 2;
+			cca_includes = realloc(cca_includes, cca_include_capacity * sizeof(cca_include));
+		}
+		cca_includes[index] = include;
+		cca_symbol_table_insert(&cca_include_table, include.path, index);
+	}
+
+	*tokens = cca_includes[index].tokens;
+	*tokenCount = cca_includes[index].tokenCount;
+	pthread_mutex_unlock(&cca_include_lock);
+	return TRUE;
+}
+
+// the name of a file tokens can be from, sourceName for the one being assembled
+char* cca_source_file(unsigned int file, char* sourceName) {
+	if (file == 0)
+		return sourceName;
+
+	pthread_mutex_lock(&cca_include_lock);
+	char* path = file <= cca_include_count ? cca_includes[file - 1].path : "?";
+	pthread_mutex_unlock(&cca_include_lock);
+	return path;
+}
+
+// included tokens keep the lines of their file, a line of the main file can have the same number
+BOOL cca_token_same_line(cca_token* a, cca_token* b) {
+	return a->line == b->line && a->file == b->file;
+}
+
+typedef struct cca_token_list {
+	cca_token* tokens;
+	unsigned int count;
+	unsigned int capacity;
+	// the files that are in already, every file goes in once
+	cca_symbol_table guards;
+	// the real path of the file being assembled, NULL when it is read from stdin
+	char* sourcePath;
+	BOOL error;
+} cca_token_list;
+
+void cca_token_list_add(cca_token_list* list, cca_token token) {
+	++list->count;
+	if (list->count >= list->capacity) {
+		list->capacity *= 2;
+		list->tokens = realloc(list->tokens, list->capacity * sizeof(cca_token));
+	}
+	list->tokens[list->count - 1] = token;
+}
+
+// the real path of file, relative to the directory of the real path including when it isn't absolute. NULL when
+// it doesn't exist
+char* cca_include_resolve(char* file, char* including) {
+	char* slash = including != NULL ? strrchr(including, '/') : NULL;
+	if (file[0] == '/' || slash == NULL)
+		return realpath(file, NULL);
+
+	unsigned int directoryLength = slash - including + 1;
+	char* joined = malloc(directoryLength + strlen(file) + 1);
+	memcpy(joined, including, directoryLength);
+	strcpy(joined + directoryLength, file);
+	char* path = realpath(joined, NULL);
+	free(joined);
+	return path;
+}
+
+void cca_include_expand(cca_token_list* list, cca_token* tokens, unsigned int tokenCount) {
+	for (unsigned int i = 0; i < tokenCount; i++) {
+		if (tokens[i].type != CCA_TOK_IDENTIFIER || strcmp(tokens[i].value.string, "include") != 0) {
+			cca_token_list_add(list, tokens[i]);
+			continue;
+		}
+
+		if (i + 1 >= tokenCount || tokens[i + 1].type != CCA_TOK_STRING) {
+			printf("[ERROR] include wants a file at line %u\n", tokens[i].line);
+			list->error = TRUE;
+			continue;
+		}
+
+		char* including = tokens[i].file == 0 ? list->sourcePath : cca_source_file(tokens[i].file, NULL);
+		char* file = tokens[++i].value.string;
+		char* path = cca_include_resolve(file, including);
+		if (path == NULL) {
+			printf("[ERROR] could not include '%s' at line %u\n", file, tokens[i].line);
+			list->error = TRUE;
+			continue;
+		}
+		if (cca_symbol_table_find(&list->guards, path) != CCA_SYMBOL_MISSING) {
+			free(path);
+			continue;
+		}
+		cca_symbol_table_insert(&list->guards, path, 0);
+
+		cca_token* included;
+		unsigned int includedCount;
+		if (!cca_include_lookup(path, &included, &includedCount)) {
+			list->error = TRUE;
+			continue;
+		}
+		cca_include_expand(list, included, includedCount);
+	}
+}
+
+// replaces every include "file" with the tokens of the file. paths are relative to the file the include is in, and
+// to the working directory for source from stdin. returns 1 on errors
+char cca_assembler_include(cca_token** tokens, char* sourceName) {
+	unsigned int tokenCount = 0;
+	BOOL includes = FALSE;
+	for (; (*tokens)[tokenCount].type != CCA_TOK_END; tokenCount++) {
+		if ((*tokens)[tokenCount].type == CCA_TOK_IDENTIFIER && strcmp((*tokens)[tokenCount].value.string, "include") == 0)
+			includes = TRUE;
+	}
+	if (!includes)
+		return 0;
+
+	cca_token_list list = {0};
+	list.capacity = tokenCount * 2 + 1;
+	list.tokens = malloc(list.capacity * sizeof(cca_token));
+	list.guards = cca_symbol_table_create(16);
+	list.sourcePath = sourceName != NULL && strcmp(sourceName, "-") != 0 ? realpath(sourceName, NULL) : NULL;
+
+	cca_include_expand(&list, *tokens, tokenCount);
+	cca_token_list_add(&list, (*tokens)[tokenCount]);
+
+	for (unsigned int i = 0; i < list.guards.capacity; i++)
+		free(list.guards.names[i]);
+	cca_symbol_table_free(&list.guards);
+	free(list.sourcePath);
+	free(*tokens);
+	*tokens = list.tokens;
+	return list.error;
+}
+
+// macros are expanded on the tokens, so nothing is lexed twice. a macro is
+//
+//     macro name first, second
+//     ...
+//     endm
+//
+// and is used by its name at the start of a line with the arguments after it. labels in the body become
+// label__N with the number of the expansion, so a macro can be used more than once and the disassembly of it can be
+// assembled again. name equ expression is a constant,
+// it is evaluated right away and every name after it is replaced with the number
+#define CCA_MACRO_DEPTH 64
+
+typedef struct cca_macro {
+	char* name;
+	unsigned int line;
+	cca_token* parameters;
+	unsigned int parameterCount;
+	cca_token* body;
+	unsigned int bodyCount;
+	// the labels defined in the body
+	cca_symbol_table labels;
+} cca_macro;
+
+typedef struct cca_macro_table {
+	cca_macro* macros;
+	unsigned int count;
+	unsigned int capacity;
+	cca_symbol_table names;
+
+	// the symbol table can't hold every number, it holds where the number is
+	unsigned int* constants;
+	unsigned int constantCount;
+	unsigned int constantCapacity;
+	cca_symbol_table constantNames;
+
+	unsigned int expansions;
+} cca_macro_table;
+
+BOOL cca_token_is_identifier(cca_token* tok, char* name) {
+	return tok->type == CCA_TOK_IDENTIFIER && strcmp(tok->value.string, name) == 0;
+}
+
+// where the line of tokens[start] ends
+unsigned int cca_line_end(cca_token* tokens, unsigned int start, unsigned int tokenCount) {
+	unsigned int end = start;
+	while (end < tokenCount && cca_token_same_line(&tokens[end], &tokens[start]))
+		++end;
+	return end;
+}
+
+// reads macro name parameters ... endm at tokens[start], returns where it ends
+unsigned int cca_macro_define(cca_macro_table* table, cca_token_list* list, cca_token* tokens, unsigned int start, unsigned int tokenCount) {
+	cca_token* keyword = &tokens[start];
+	unsigned int i = start + 1;
+	if (i >= tokenCount || tokens[i].type != CCA_TOK_IDENTIFIER || !cca_token_same_line(&tokens[i], keyword)) {
+		printf("[ERROR] macro wants a name at line %u\n", keyword->line);
+		list->error = TRUE;
+		return cca_line_end(tokens, start, tokenCount);
+	}
+
+	cca_macro macro = {0};
+	macro.name = tokens[i].value.string;
+	macro.line = keyword->line;
+	macro.parameters = &tokens[++i];
+	while (i < tokenCount && cca_token_same_line(&tokens[i], keyword)) {
+		if (tokens[i].type != CCA_TOK_IDENTIFIER || (i + 1 < tokenCount && cca_token_same_line(&tokens[i + 1], keyword) && tokens[i + 1].type != CCA_TOK_DIVIDER)) {
+			printf("[ERROR] the parameters of %s have to be names split by commas at line %u\n", macro.name, keyword->line);
+			list->error = TRUE;
+			return cca_line_end(tokens, start, tokenCount);
+		}
+		++macro.parameterCount;
+		i += cca_token_same_line(&tokens[i + 1], keyword) ? 2 : 1;
+	}
+
+	macro.body = &tokens[i];
+	macro.labels = cca_symbol_table_create(4);
+	while (i < tokenCount && !cca_token_is_identifier(&tokens[i], "endm")) {
+		if (cca_token_is_identifier(&tokens[i], "macro")) {
+			printf("[ERROR] macros can't be defined inside %s at line %u\n", macro.name, tokens[i].line);
+			list->error = TRUE;
+		}
+		if (tokens[i].type == CCA_TOK_LABEL)
+			cca_symbol_table_insert(&macro.labels, tokens[i].value.string, 0);
+		++macro.bodyCount;
+		++i;
+	}
+	if (i >= tokenCount) {
+		printf("[ERROR] macro %s at line %u has no endm\n", macro.name, keyword->line);
+		list->error = TRUE;
+		cca_symbol_table_free(&macro.labels);
+		return i;
+	}
+
+	if (cca_symbol_table_find(&table->names, macro.name) != CCA_SYMBOL_MISSING) {
+		printf("[ERROR] macro %s at line %u is already defined\n", macro.name, keyword->line);
+		list->error = TRUE;
+		cca_symbol_table_free(&macro.labels);
+		return i + 1;
+	}
+
+	++table->count;
+	if (table->count >= table->capacity) {
+		table->capacity = table->capacity * 2 + 4;
+		table->macros = realloc(table->macros, table->capacity * sizeof(cca_macro));
+	}
+	table->macros[table->count - 1] = macro;
+	cca_symbol_table_insert(&table->names, macro.name, table->count - 1);
+	return i + 1;
+}
+
+// reads name equ expression at tokens[start], returns where the line ends
+unsigned int cca_macro_constant(cca_macro_table* table, cca_token_list* list, cca_token* tokens, unsigned int start, unsigned int tokenCount) {
+	char* name = tokens[start].value.string;
+	unsigned int end = cca_line_end(tokens, start, tokenCount);
+
+	// the constants before it are in already
+	cca_token* expression = malloc((end - start) * sizeof(cca_token));
+	unsigned int length = 0;
+	for (unsigned int i = start + 2; i < end; i++) {
+		expression[length] = tokens[i];
+		unsigned int index = tokens[i].type == CCA_TOK_IDENTIFIER ? cca_symbol_table_find(&table->constantNames, tokens[i].value.string) : CCA_SYMBOL_MISSING;
+		if (index != CCA_SYMBOL_MISSING) {
+			expression[length].type = CCA_TOK_NUMBER;
+			expression[length].value.numeric = table->constants[index];
+		}
+		++length;
+	}
+	expression[length] = (cca_token) { CCA_TOK_END };
+
+	cca_expression evaluation = { expression, 0, TRUE, FALSE };
+	cca_value value = cca_expression_evaluate(&evaluation);
+	if (!evaluation.error && evaluation.position != length) {
+		printf("[ERROR] %s equ has something after its value at line %u\n", name, tokens[start].line);
+		evaluation.error = TRUE;
+	}
+	free(expression);
+
+	if (cca_symbol_table_find(&table->constantNames, name) != CCA_SYMBOL_MISSING) {
+		printf("[ERROR] %s at line %u is already defined\n", name, tokens[start].line);
+		evaluation.error = TRUE;
+	}
+	if (evaluation.error) {
+		list->error = TRUE;
+		return end;
+	}
+
+	++table->constantCount;
+	if (table->constantCount >= table->constantCapacity) {
+		table->constantCapacity = table->constantCapacity * 2 + 4;
+		table->constants = realloc(table->constants, table->constantCapacity * sizeof(unsigned int));
+	}
+	table->constants[table->constantCount - 1] = value.number;
+	cca_symbol_table_insert(&table->constantNames, name, table->constantCount - 1);
+	return end;
+}
+
+void cca_macro_expand(cca_macro_table* table, cca_token_list* list, cca_token* tokens, unsigned int tokenCount, unsigned int depth);
+
+// puts the body of the macro used at tokens[start] in, returns where the line ends
+unsigned int cca_macro_use(cca_macro_table* table, cca_token_list* list, cca_macro* macro, cca_token* tokens, unsigned int start,
+	unsigned int tokenCount, unsigned int depth) {
+	unsigned int end = cca_line_end(tokens, start, tokenCount);
+	if (depth >= CCA_MACRO_DEPTH) {
+		printf("[ERROR] macro %s at line %u is used %u deep, does it use itself?\n", macro->name, tokens[start].line, depth);
+		list->error = TRUE;
+		return end;
+	}
+
+	// the arguments are split by the commas outside of parentheses
+	unsigned int* arguments = malloc((macro->parameterCount + 1) * sizeof(unsigned int) * 2);
+	unsigned int argumentCount = 0;
+	unsigned int nesting = 0;
+	unsigned int argumentStart = start + 1;
+	for (unsigned int i = start + 1; i <= end && start + 1 < end; i++) {
+		if (i < end && cca_token_is_operator(&tokens[i], "("))
+			++nesting;
+		else if (i < end && cca_token_is_operator(&tokens[i], ")") && nesting > 0)
+			--nesting;
+		else if (i == end || (tokens[i].type == CCA_TOK_DIVIDER && nesting == 0)) {
+			if (argumentCount < macro->parameterCount) {
+				arguments[argumentCount * 2] = argumentStart;
+				arguments[argumentCount * 2 + 1] = i;
 			}
-		} else if (strcmp(tokens[i].value.string, "jmp") == 0) {
-			if (tokens[i + 1].type == 7) {
-				cca_bytecode_add_byte(&bytecode, 0x20);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 1].value.numeric);
-				i += 2;
-			} else {
-				puts("[ERROR] on 'jmp' instuction, illegal combination of operands");
-				error = 1;
-				i += 1;
+			++argumentCount;
+			argumentStart = i + 1;
+		}
+	}
+	if (argumentCount != macro->parameterCount) {
+		printf("[ERROR] macro %s wants %u arguments, it got %u at line %u\n", macro->name, macro->parameterCount, argumentCount, tokens[start].line);
+		list->error = TRUE;
+		free(arguments);
+		return end;
+	}
+
+	unsigned int expansion = table->expansions++;
+	cca_token_list body = {0};
+	body.capacity = macro->bodyCount * 2 + 1;
+	body.tokens = malloc(body.capacity * sizeof(cca_token));
+	for (unsigned int i = 0; i < macro->bodyCount; i++) {
+		cca_token tok = macro->body[i];
+
+		unsigned int parameter = 0;
+		while (parameter < macro->parameterCount && !(tok.type == CCA_TOK_IDENTIFIER
+			&& strcmp(tok.value.string, macro->parameters[parameter * 2].value.string) == 0))
+			++parameter;
+		if (parameter < macro->parameterCount) {
+			// the arguments stay where the parameter is, so lines still split the body
+			for (unsigned int j = arguments[parameter * 2]; j < arguments[parameter * 2 + 1]; j++) {
+				cca_token argument = tokens[j];
+				argument.file = tok.file;
+				argument.line = tok.line;
+				argument.column = tok.column;
+				cca_token_list_add(&body, argument);
 			}
-		} else if (strcmp(tokens[i].value.string, "je") == 0) {
-			if (tokens[i + 1].type == 7) {
-				cca_bytecode_add_byte(&bytecode, 0x33);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 1].value.numeric);
-				i += 2;
-			} else {
-				puts("[ERROR] on 'je' instuction, illegal combination of operands");
-				error = 1;
-				i += 1;
+			continue;
+		}
+
+		if ((tok.type == CCA_TOK_LABEL || tok.type == CCA_TOK_IDENTIFIER)
+			&& cca_symbol_table_find(&macro->labels, tok.value.string) != CCA_SYMBOL_MISSING) {
+			char* name = malloc(strlen(tok.value.string) + 12);
+			sprintf(name, "%s__%u", tok.value.string, expansion);
+			tok.value.string = name;
+		}
+		cca_token_list_add(&body, tok);
+	}
+	free(arguments);
+
+	cca_macro_expand(table, list, body.tokens, body.count, depth + 1);
+	free(body.tokens);
+	return end;
+}
+
+void cca_macro_expand(cca_macro_table* table, cca_token_list* list, cca_token* tokens, unsigned int tokenCount, unsigned int depth) {
+	unsigned int i = 0;
+	while (i < tokenCount) {
+		cca_token* tok = &tokens[i];
+		BOOL lineStart = i == 0 || !cca_token_same_line(&tokens[i - 1], tok);
+
+		if (cca_token_is_identifier(tok, "macro")) {
+			i = cca_macro_define(table, list, tokens, i, tokenCount);
+			continue;
+		}
+		if (cca_token_is_identifier(tok, "endm")) {
+			printf("[ERROR] endm without a macro at line %u\n", tok->line);
+			list->error = TRUE;
+			++i;
+			continue;
+		}
+		if (tok->type == CCA_TOK_IDENTIFIER && lineStart && i + 1 < tokenCount && cca_token_is_identifier(&tokens[i + 1], "equ")) {
+			i = cca_macro_constant(table, list, tokens, i, tokenCount);
+			continue;
+		}
+
+		unsigned int index = tok->type == CCA_TOK_IDENTIFIER ? cca_symbol_table_find(&table->names, tok->value.string) : CCA_SYMBOL_MISSING;
+		if (index != CCA_SYMBOL_MISSING && lineStart) {
+			i = cca_macro_use(table, list, &table->macros[index], tokens, i, tokenCount, depth);
+			continue;
+		}
+
+		cca_token copy = *tok;
+		index = tok->type == CCA_TOK_IDENTIFIER ? cca_symbol_table_find(&table->constantNames, tok->value.string) : CCA_SYMBOL_MISSING;
+		if (index != CCA_SYMBOL_MISSING) {
+			copy.type = CCA_TOK_NUMBER;
+			copy.value.numeric = table->constants[index];
+		}
+		cca_token_list_add(list, copy);
+		++i;
+	}
+}
+
+// expands the macros and constants, returns 1 on errors
+char cca_assembler_macros(cca_token** tokens) {
+	unsigned int tokenCount = 0;
+	BOOL macros = FALSE;
+	for (; (*tokens)[tokenCount].type != CCA_TOK_END; tokenCount++) {
+		if (cca_token_is_identifier(&(*tokens)[tokenCount], "macro") || cca_token_is_identifier(&(*tokens)[tokenCount], "equ"))
+			macros = TRUE;
+	}
+	if (!macros)
+		return 0;
+
+	cca_macro_table table = {0};
+	table.names = cca_symbol_table_create(16);
+	table.constantNames = cca_symbol_table_create(16);
+	cca_token_list list = {0};
+	list.capacity = tokenCount * 2 + 1;
+	list.tokens = malloc(list.capacity * sizeof(cca_token));
+
+	cca_macro_expand(&table, &list, *tokens, tokenCount, 0);
+	cca_token_list_add(&list, (*tokens)[tokenCount]);
+
+	for (unsigned int i = 0; i < table.count; i++)
+		cca_symbol_table_free(&table.macros[i].labels);
+	free(table.macros);
+	free(table.constants);
+	cca_symbol_table_free(&table.names);
+	cca_symbol_table_free(&table.constantNames);
+	free(*tokens);
+	*tokens = list.tokens;
+	return list.error;
+}
+
+void cca_assembler_replace_defs(cca_token** tokens, cca_definition_list defs) {
+	// the first definition of a name is the one that counts
+	cca_symbol_table names = cca_symbol_table_create(defs.length);
+	for (int i = 0; i < defs.length; i++) {
+		if (cca_symbol_table_find(&names, defs.definitions[i].name) == CCA_SYMBOL_MISSING)
+			cca_symbol_table_insert(&names, defs.definitions[i].name, i);
+	}
+
+	// sizeof ( name ) collapses into its length, so the tokens are moved down behind it
+	unsigned int written = 0;
+	int j = 0;
+	for (; (*tokens)[j].type != CCA_TOK_END; j++) {
+		cca_token* tok = &(*tokens)[j];
+		if (tok->type != CCA_TOK_IDENTIFIER) {
+			(*tokens)[written++] = *tok;
+			continue;
+		}
+
+		if (strcmp(tok->value.string, "sizeof") == 0 && cca_token_is_operator(&tok[1], "(") && tok[2].type == CCA_TOK_IDENTIFIER
+			&& cca_token_is_operator(&tok[3], ")")) {
+			unsigned int index = cca_symbol_table_find(&names, tok[2].value.string);
+			if (index != CCA_SYMBOL_MISSING) {
+				cca_token length = *tok;
+				length.type = CCA_TOK_NUMBER;
+				length.value.numeric = defs.definitions[index].length;
+				(*tokens)[written++] = length;
+				j += 3;
+				continue;
 			}
-		} else if (strcmp(tokens[i].value.string, "jne") == 0) {
-			if (tokens[i + 1].type == 7) {
-				cca_bytecode_add_byte(&bytecode, 0x34);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 1].value.numeric);
-				i += 2;
-			} else {
-				puts("[ERROR] on 'jne' instuction, illegal combination of operands");
+		}
+
+		// the pointer is only known once the header is laid out
+		unsigned int index = cca_symbol_table_find(&names, tok->value.string);
+		if (index != CCA_SYMBOL_MISSING) {
+			tok->type = CCA_TOK_DEFINITION;
+			tok->value.numeric = index;
+		}
+		(*tokens)[written++] = *tok;
+	}
+	(*tokens)[written] = (*tokens)[j];
+
+	cca_symbol_table_free(&names);
+}
+
+// opcode definitions, every encodable instruction form and the operands it takes. operands are a byte for registers
+// and 4 bytes otherwise, unless the form gives its own sizes
+typedef struct cca_opcode_info {
+	char* mnemonic;
+	unsigned char operandCount;
+	char operands[CCA_MAX_OPERANDS];
+	unsigned char sizes[CCA_MAX_OPERANDS];
+} cca_opcode_info;
+
+cca_opcode_info cca_opcodes[256] = {
+	[CCA_OP_STP] = { "stp", 0 },
+	[CCA_OP_PSH_NUM] = { "psh", 1, { CCA_OPERAND_NUMBER } },
+	[CCA_OP_PSH_REG] = { "psh", 1, { CCA_OPERAND_REGISTER } },
+	[CCA_OP_POP_REG] = { "pop", 1, { CCA_OPERAND_REGISTER } },
+	[CCA_OP_POP_ADDR] = { "pop", 1, { CCA_OPERAND_ADDRESS } },
+	[CCA_OP_DUP] = { "dup", 0 },
+	[CCA_OP_MOV_REG_NUM] = { "mov", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_NUMBER } },
+	[CCA_OP_MOV_ADDR_NUM] = { "mov", 2, { CCA_OPERAND_ADDRESS, CCA_OPERAND_NUMBER } },
+	[CCA_OP_MOV_REG_ADDR] = { "mov", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_ADDRESS } },
+	[CCA_OP_MOV_ADDR_REG] = { "mov", 2, { CCA_OPERAND_ADDRESS, CCA_OPERAND_REGISTER } },
+	[CCA_OP_MOV_REG_REG] = { "mov", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_REGISTER } },
+	[CCA_OP_PSH_ADDR] = { "psh", 1, { CCA_OPERAND_ADDRESS } },
+	[CCA_OP_ADD_REG] = { "add", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_REGISTER } },
+	[CCA_OP_ADD] = { "add", 0 },
+	[CCA_OP_SUB_REG] = { "sub", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_REGISTER } },
+	[CCA_OP_SUB] = { "sub", 0 },
+	[CCA_OP_MUL_REG] = { "mul", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_REGISTER } },
+	[CCA_OP_MUL] = { "mul", 0 },
+	[CCA_OP_DIV_REG] = { "div", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_REGISTER } },
+	[CCA_OP_DIV] = { "div", 0 },
+	[CCA_OP_NOT_REG] = { "not", 1, { CCA_OPERAND_REGISTER } },
+	[CCA_OP_NOT] = { "not", 0 },
+	[CCA_OP_AND_REG] = { "and", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_REGISTER } },
+	[CCA_OP_AND] = { "and", 0 },
+	[CCA_OP_OR_REG] = { "or", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_REGISTER } },
+	[CCA_OP_OR] = { "or", 0 },
+	[CCA_OP_XOR_REG] = { "xor", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_REGISTER } },
+	[CCA_OP_XOR] = { "xor", 0 },
+	[CCA_OP_CMP_REG_REG] = { "cmp", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_REGISTER } },
+	[CCA_OP_CMP_REG_NUM] = { "cmp", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_NUMBER } },
+	[CCA_OP_CMP_NUM] = { "cmp", 1, { CCA_OPERAND_NUMBER } },
+	[CCA_OP_JE] = { "je", 1, { CCA_OPERAND_MARKER } },
+	[CCA_OP_JNE] = { "jne", 1, { CCA_OPERAND_MARKER } },
+	[CCA_OP_JG] = { "jg", 1, { CCA_OPERAND_MARKER } },
+	[CCA_OP_JS] = { "js", 1, { CCA_OPERAND_MARKER } },
+	[CCA_OP_JO] = { "jo", 1, { CCA_OPERAND_MARKER } },
+	[CCA_OP_JMP] = { "jmp", 1, { CCA_OPERAND_MARKER } },
+	[CCA_OP_FRS] = { "frs", 0 },
+	[CCA_OP_INC_REG] = { "inc", 1, { CCA_OPERAND_REGISTER } },
+	[CCA_OP_DEC_REG] = { "dec", 1, { CCA_OPERAND_REGISTER } },
+	[CCA_OP_INC] = { "inc", 0 },
+	[CCA_OP_DEC] = { "dec", 0 },
+	[CCA_OP_CALL] = { "call", 1, { CCA_OPERAND_MARKER } },
+	[CCA_OP_RET] = { "ret", 0 },
+	[CCA_OP_SYSCALL] = { "syscall", 0 },
+
+	[CCA_OP_PSH_NUM8] = { "psh", 1, { CCA_OPERAND_NUMBER }, { 1 } },
+	[CCA_OP_PSH_NUM16] = { "psh", 1, { CCA_OPERAND_NUMBER }, { 2 } },
+	[CCA_OP_MOV_REG_NUM8] = { "mov", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_NUMBER }, { 1, 1 } },
+	[CCA_OP_MOV_REG_NUM16] = { "mov", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_NUMBER }, { 1, 2 } },
+	[CCA_OP_CMP_REG_NUM8] = { "cmp", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_NUMBER }, { 1, 1 } },
+	[CCA_OP_CMP_REG_NUM16] = { "cmp", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_NUMBER }, { 1, 2 } },
+	[CCA_OP_CMP_NUM8] = { "cmp", 1, { CCA_OPERAND_NUMBER }, { 1 } },
+	[CCA_OP_CMP_NUM16] = { "cmp", 1, { CCA_OPERAND_NUMBER }, { 2 } },
+	[CCA_OP_PSH_ADDR16] = { "psh", 1, { CCA_OPERAND_ADDRESS }, { 2 } },
+	[CCA_OP_POP_ADDR16] = { "pop", 1, { CCA_OPERAND_ADDRESS }, { 2 } },
+	[CCA_OP_MOV_REG_ADDR16] = { "mov", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_ADDRESS }, { 1, 2 } },
+	[CCA_OP_MOV_ADDR16_REG] = { "mov", 2, { CCA_OPERAND_ADDRESS, CCA_OPERAND_REGISTER }, { 2, 1 } },
+	[CCA_OP_MOV_ADDR16_NUM8] = { "mov", 2, { CCA_OPERAND_ADDRESS, CCA_OPERAND_NUMBER }, { 2, 1 } },
+	[CCA_OP_MOV_ADDR16_NUM16] = { "mov", 2, { CCA_OPERAND_ADDRESS, CCA_OPERAND_NUMBER }, { 2, 2 } },
+	[CCA_OP_JE8] = { "je", 1, { CCA_OPERAND_RELATIVE }, { 1 } },
+	[CCA_OP_JNE8] = { "jne", 1, { CCA_OPERAND_RELATIVE }, { 1 } },
+	[CCA_OP_JG8] = { "jg", 1, { CCA_OPERAND_RELATIVE }, { 1 } },
+	[CCA_OP_JS8] = { "js", 1, { CCA_OPERAND_RELATIVE }, { 1 } },
+	[CCA_OP_JO8] = { "jo", 1, { CCA_OPERAND_RELATIVE }, { 1 } },
+	[CCA_OP_JMP8] = { "jmp", 1, { CCA_OPERAND_RELATIVE }, { 1 } },
+	[CCA_OP_CALL8] = { "call", 1, { CCA_OPERAND_RELATIVE }, { 1 } },
+	[CCA_OP_JE16] = { "je", 1, { CCA_OPERAND_RELATIVE }, { 2 } },
+	[CCA_OP_JNE16] = { "jne", 1, { CCA_OPERAND_RELATIVE }, { 2 } },
+	[CCA_OP_JG16] = { "jg", 1, { CCA_OPERAND_RELATIVE }, { 2 } },
+	[CCA_OP_JS16] = { "js", 1, { CCA_OPERAND_RELATIVE }, { 2 } },
+	[CCA_OP_JO16] = { "jo", 1, { CCA_OPERAND_RELATIVE }, { 2 } },
+	[CCA_OP_JMP16] = { "jmp", 1, { CCA_OPERAND_RELATIVE }, { 2 } },
+	[CCA_OP_CALL16] = { "call", 1, { CCA_OPERAND_RELATIVE }, { 2 } },
+
+	[CCA_OP_CMP_NUM_JE] = { "cmpje", 3, { CCA_OPERAND_REGISTER, CCA_OPERAND_NUMBER, CCA_OPERAND_MARKER } },
+	[CCA_OP_CMP_NUM_JNE] = { "cmpjne", 3, { CCA_OPERAND_REGISTER, CCA_OPERAND_NUMBER, CCA_OPERAND_MARKER } },
+	[CCA_OP_CMP_REG_JE] = { "cmpje", 3, { CCA_OPERAND_REGISTER, CCA_OPERAND_REGISTER, CCA_OPERAND_MARKER } },
+	[CCA_OP_CMP_REG_JNE] = { "cmpjne", 3, { CCA_OPERAND_REGISTER, CCA_OPERAND_REGISTER, CCA_OPERAND_MARKER } },
+	[CCA_OP_PSH_PSH_ADD] = { "pshadd", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_REGISTER } },
+	[CCA_OP_PSH_NUM_ADD] = { "pshadd", 2, { CCA_OPERAND_REGISTER, CCA_OPERAND_NUMBER } },
+	[CCA_OP_INC_CMP_JNE] = { "inccmpjne", 3, { CCA_OPERAND_REGISTER, CCA_OPERAND_REGISTER, CCA_OPERAND_MARKER } },
+	[CCA_OP_INC_CMP_NUM_JNE] = { "inccmpjne", 3, { CCA_OPERAND_REGISTER, CCA_OPERAND_NUMBER, CCA_OPERAND_MARKER } }
+};
+
+// the smaller forms an instruction can take in compact encoding, smallest first for each standard opcode
+typedef struct cca_compact_form {
+	unsigned char opcode;
+	unsigned char compact;
+} cca_compact_form;
+
+cca_compact_form cca_compact_forms[] = {
+	{ CCA_OP_PSH_NUM, CCA_OP_PSH_NUM8 }, { CCA_OP_PSH_NUM, CCA_OP_PSH_NUM16 },
+	{ CCA_OP_MOV_REG_NUM, CCA_OP_MOV_REG_NUM8 }, { CCA_OP_MOV_REG_NUM, CCA_OP_MOV_REG_NUM16 },
+	{ CCA_OP_CMP_REG_NUM, CCA_OP_CMP_REG_NUM8 }, { CCA_OP_CMP_REG_NUM, CCA_OP_CMP_REG_NUM16 },
+	{ CCA_OP_CMP_NUM, CCA_OP_CMP_NUM8 }, { CCA_OP_CMP_NUM, CCA_OP_CMP_NUM16 },
+	{ CCA_OP_PSH_ADDR, CCA_OP_PSH_ADDR16 },
+	{ CCA_OP_POP_ADDR, CCA_OP_POP_ADDR16 },
+	{ CCA_OP_MOV_REG_ADDR, CCA_OP_MOV_REG_ADDR16 },
+	{ CCA_OP_MOV_ADDR_REG, CCA_OP_MOV_ADDR16_REG },
+	{ CCA_OP_MOV_ADDR_NUM, CCA_OP_MOV_ADDR16_NUM8 }, { CCA_OP_MOV_ADDR_NUM, CCA_OP_MOV_ADDR16_NUM16 },
+	{ CCA_OP_JE, CCA_OP_JE8 }, { CCA_OP_JE, CCA_OP_JE16 },
+	{ CCA_OP_JNE, CCA_OP_JNE8 }, { CCA_OP_JNE, CCA_OP_JNE16 },
+	{ CCA_OP_JG, CCA_OP_JG8 }, { CCA_OP_JG, CCA_OP_JG16 },
+	{ CCA_OP_JS, CCA_OP_JS8 }, { CCA_OP_JS, CCA_OP_JS16 },
+	{ CCA_OP_JO, CCA_OP_JO8 }, { CCA_OP_JO, CCA_OP_JO16 },
+	{ CCA_OP_JMP, CCA_OP_JMP8 }, { CCA_OP_JMP, CCA_OP_JMP16 },
+	{ CCA_OP_CALL, CCA_OP_CALL8 }, { CCA_OP_CALL, CCA_OP_CALL16 }
+};
+unsigned int cca_compact_form_count = sizeof(cca_compact_forms) / sizeof(cca_compact_form);
+
+// the instruction sequences superinstructions stand for. each operand of the fused form comes from operand
+// (source % 2) of part (source / 2), the two operands in same have to be the same operand if they differ
+typedef struct cca_fusion {
+	char* name;
+	unsigned char opcode;
+	unsigned char length;
+	unsigned char parts[3];
+	unsigned char sources[CCA_MAX_OPERANDS];
+	unsigned char same[2];
+} cca_fusion;
+
+cca_fusion cca_fusions[] = {
+	{ "cmp-num-je", CCA_OP_CMP_NUM_JE, 2, { CCA_OP_CMP_REG_NUM, CCA_OP_JE }, { 0, 1, 2 } },
+	{ "cmp-num-jne", CCA_OP_CMP_NUM_JNE, 2, { CCA_OP_CMP_REG_NUM, CCA_OP_JNE }, { 0, 1, 2 } },
+	{ "cmp-reg-je", CCA_OP_CMP_REG_JE, 2, { CCA_OP_CMP_REG_REG, CCA_OP_JE }, { 0, 1, 2 } },
+	{ "cmp-reg-jne", CCA_OP_CMP_REG_JNE, 2, { CCA_OP_CMP_REG_REG, CCA_OP_JNE }, { 0, 1, 2 } },
+	{ "psh-psh-add", CCA_OP_PSH_PSH_ADD, 3, { CCA_OP_PSH_REG, CCA_OP_PSH_REG, CCA_OP_ADD }, { 0, 2 } },
+	{ "psh-num-add", CCA_OP_PSH_NUM_ADD, 3, { CCA_OP_PSH_REG, CCA_OP_PSH_NUM, CCA_OP_ADD }, { 0, 2 } },
+	{ "inc-cmp-jne", CCA_OP_INC_CMP_JNE, 3, { CCA_OP_INC_REG, CCA_OP_CMP_REG_REG, CCA_OP_JNE }, { 0, 3, 4 }, { 0, 2 } },
+	{ "inc-cmp-num-jne", CCA_OP_INC_CMP_NUM_JNE, 3, { CCA_OP_INC_REG, CCA_OP_CMP_REG_NUM, CCA_OP_JNE }, { 0, 3, 4 }, { 0, 2 } }
+};
+unsigned int cca_fusion_count = sizeof(cca_fusions) / sizeof(cca_fusion);
+
+cca_fusion* cca_fusion_of(unsigned char opcode) {
+	for (unsigned int f = 0; f < cca_fusion_count; f++) {
+		if (cca_fusions[f].opcode == opcode)
+			return &cca_fusions[f];
+	}
+
+	return NULL;
+}
+
+unsigned int cca_operand_size(cca_opcode_info* info, int operand) {
+	if (info->sizes[operand] != 0)
+		return info->sizes[operand];
+
+	return info->operands[operand] == CCA_OPERAND_REGISTER ? 1 : 4;
+}
+
+// variants and superinstructions are picked by the encoder, assembly only ever names the standard forms
+BOOL cca_opcode_is_variant(unsigned char opcode) {
+	return cca_opcodes[opcode].sizes[0] != 0 || cca_opcodes[opcode].sizes[1] != 0 || cca_fusion_of(opcode) != NULL;
+}
+
+BOOL cca_opcode_is_terminator(unsigned char opcode) {
+	return opcode == CCA_OP_STP || opcode == CCA_OP_RET || opcode == CCA_OP_JMP;
+}
+
+BOOL cca_opcode_is_conditional_jump(unsigned char opcode) {
+	cca_fusion* fusion = cca_fusion_of(opcode);
+	if (fusion != NULL)
+		return cca_opcode_is_conditional_jump(fusion->parts[fusion->length - 1]);
+
+	return opcode >= CCA_OP_JE && opcode <= CCA_OP_JO;
+}
+
+// the operand holding where a jump or call goes, -1 for everything else
+int cca_opcode_target(unsigned char opcode) {
+	cca_opcode_info* info = &cca_opcodes[opcode];
+	for (int i = 0; i < info->operandCount; i++) {
+		if (info->operands[i] == CCA_OPERAND_MARKER || info->operands[i] == CCA_OPERAND_RELATIVE)
+			return i;
+	}
+
+	return -1;
+}
+
+// instruction semantics
+//
+// values are 32 bit unsigned and wrap around. 'op reg1, reg2' stores reg1 op reg2 in reg1, the stack forms pop y,
+// then x, and push x op y. 'cmp x, y' compares x with y ('cmp num' pops x) and is the only instruction besides
+// 'frs', which clears them, that touches the flags
+#define CCA_FLAG_EQUAL 0x01
+#define CCA_FLAG_GREATER 0x02
+#define CCA_FLAG_SIGN 0x04
+#define CCA_FLAG_OVERFLOW 0x08
+
+unsigned int cca_compare_flags(unsigned int x, unsigned int y) {
+	unsigned int difference = x - y;
+	unsigned int flags = 0;
+
+	if (x == y)
+		flags |= CCA_FLAG_EQUAL;
+	if ((int) x > (int) y)
+		flags |= CCA_FLAG_GREATER;
+	if (difference >> 31)
+		flags |= CCA_FLAG_SIGN;
+	if (((x ^ y) & (x ^ difference)) >> 31)
+		flags |= CCA_FLAG_OVERFLOW;
+
+	return flags;
+}
+
+BOOL cca_branch_taken(unsigned char opcode, unsigned int flags) {
+	switch (opcode) {
+		case CCA_OP_JE: return (flags & CCA_FLAG_EQUAL) != 0;
+		case CCA_OP_JNE: return (flags & CCA_FLAG_EQUAL) == 0;
+		case CCA_OP_JG: return (flags & CCA_FLAG_GREATER) != 0;
+		case CCA_OP_JS: return (flags & CCA_FLAG_SIGN) != 0;
+		case CCA_OP_JO: return (flags & CCA_FLAG_OVERFLOW) != 0;
+		default: return TRUE;
+	}
+}
+
+// computes an arithmetic instruction in either its register or its stack form, fails on division by zero
+BOOL cca_evaluate(unsigned char opcode, unsigned int x, unsigned int y, unsigned int* result) {
+	switch (opcode) {
+		case CCA_OP_ADD_REG: case CCA_OP_ADD: *result = x + y; return TRUE;
+		case CCA_OP_SUB_REG: case CCA_OP_SUB: *result = x - y; return TRUE;
+		case CCA_OP_MUL_REG: case CCA_OP_MUL: *result = x * y; return TRUE;
+		case CCA_OP_DIV_REG: case CCA_OP_DIV: {
+			if (y == 0)
+				return FALSE;
+			*result = x / y;
+			return TRUE;
+		}
+		case CCA_OP_AND_REG: case CCA_OP_AND: *result = x & y; return TRUE;
+		case CCA_OP_OR_REG: case CCA_OP_OR: *result = x | y; return TRUE;
+		case CCA_OP_XOR_REG: case CCA_OP_XOR: *result = x ^ y; return TRUE;
+		case CCA_OP_NOT_REG: case CCA_OP_NOT: *result = ~x; return TRUE;
+		case CCA_OP_INC_REG: case CCA_OP_INC: *result = x + 1; return TRUE;
+		case CCA_OP_DEC_REG: case CCA_OP_DEC: *result = x - 1; return TRUE;
+		default: return FALSE;
+	}
+}
+
+// how many values an instruction takes off the stack and how many it puts back, return addresses of call and ret
+// are kept apart from the values
+void cca_stack_effect(unsigned char opcode, unsigned int* pops, unsigned int* pushes) {
+	*pops = 0;
+	*pushes = 0;
+
+	switch (opcode) {
+		case CCA_OP_PSH_NUM: case CCA_OP_PSH_REG: case CCA_OP_PSH_ADDR: *pushes = 1; break;
+		case CCA_OP_POP_REG: case CCA_OP_POP_ADDR: case CCA_OP_CMP_NUM: *pops = 1; break;
+		case CCA_OP_DUP: *pops = 1; *pushes = 2; break;
+		case CCA_OP_NOT: case CCA_OP_INC: case CCA_OP_DEC: *pops = 1; *pushes = 1; break;
+		case CCA_OP_ADD: case CCA_OP_SUB: case CCA_OP_MUL: case CCA_OP_DIV:
+		case CCA_OP_AND: case CCA_OP_OR: case CCA_OP_XOR: *pops = 2; *pushes = 1; break;
+	}
+
+	// superinstructions need what their parts need at the lowest point and leave what the parts leave
+	cca_fusion* fusion = cca_fusion_of(opcode);
+	if (fusion != NULL) {
+		int depth = 0;
+		int lowest = 0;
+		for (int i = 0; i < fusion->length; i++) {
+			unsigned int partPops, partPushes;
+			cca_stack_effect(fusion->parts[i], &partPops, &partPushes);
+			depth -= partPops;
+			if (depth < lowest)
+				lowest = depth;
+			depth += partPushes;
+		}
+
+		*pops = -lowest;
+		*pushes = depth - lowest;
+	}
+}
+
+// instructions, with marker operands kept symbolic until the code is laid out
+typedef struct cca_operand {
+	char type;
+	unsigned int value;
+	// added to the pointer of a definition once the header is laid out, or to the offset of a marker once the code
+	// is, in the units the code is addressed in
+	unsigned int offset;
+} cca_operand;
+
+typedef struct cca_instruction {
+	unsigned char opcode;
+	cca_operand operands[CCA_MAX_OPERANDS];
+	// the source position of the instruction, 0 for code the assembler made up
+	unsigned int file;
+	unsigned int line;
+	unsigned int column;
+	// the form the instruction is written in and where, decided by cca_program_layout
+	unsigned char encoding;
+	unsigned int offset;
+} cca_instruction;
+
+typedef struct cca_program {
+	cca_instruction* instructions;
+	unsigned int instructionCount;
+	unsigned int instructionCapacity;
+
+	cca_marker* markers;
+	unsigned int markerCount;
+	unsigned int markerCapacity;
+	cca_symbol_table markerTable;
+
+	char encoding;
+	unsigned int codeLength;
+} cca_program;
+
+cca_program cca_program_create() {
+	cca_program program = {0};
+	program.instructionCapacity = 100;
+	program.instructions = malloc(program.instructionCapacity * sizeof(cca_instruction));
+	program.markerCapacity = 100;
+	program.markers = malloc(program.markerCapacity * sizeof(cca_marker));
+	program.markerTable = cca_symbol_table_create(program.markerCapacity);
+	return program;
+}
+
+void cca_program_free(cca_program* program) {
+	free(program->instructions);
+	free(program->markers);
+	cca_symbol_table_free(&program->markerTable);
+}
+
+void cca_program_add_instruction(cca_program* program, cca_instruction instruction) {
+	++program->instructionCount;
+	if (program->instructionCount >= program->instructionCapacity) {
+		program->instructionCapacity *= 2;
+		program->instructions = realloc(program->instructions, program->instructionCapacity * sizeof(cca_instruction));
+	}
+	program->instructions[program->instructionCount - 1] = instruction;
+}
+
+unsigned int cca_program_marker(cca_program* program, char* name) {
+	unsigned int index = cca_symbol_table_find(&program->markerTable, name);
+	if (index != CCA_SYMBOL_MISSING)
+		return index;
+
+	cca_marker marker = {
+		.name = name,
+		.marks = 0,
+		.instruction = CCA_MARKER_UNDEFINED
+	};
+
+	++program->markerCount;
+	if (program->markerCount >= program->markerCapacity) {
+		program->markerCapacity *= 2;
+		program->markers = realloc(program->markers, program->markerCapacity * sizeof(cca_marker));
+	}
+	program->markers[program->markerCount - 1] = marker;
+	cca_symbol_table_insert(&program->markerTable, name, program->markerCount - 1);
+
+	return program->markerCount - 1;
+}
+
+// reads the operand at tokens[*position], a register or an expression, and moves past it. returns FALSE when there
+// is none
+BOOL cca_operand_parse(cca_program* program, cca_token* tokens, unsigned int* position, cca_operand* operand, char* error) {
+	cca_token* tok = &tokens[*position];
+	if (tok->type == CCA_TOK_REGISTER) {
+		operand->type = CCA_OPERAND_REGISTER;
+		operand->value = cca_register_index(tok->value.string);
+		++*position;
+		return TRUE;
+	}
+	if (!cca_expression_starts(tok))
+		return FALSE;
+
+	// & in front makes an address of everything after it
+	cca_expression expression = { tokens, *position, FALSE, FALSE };
+	BOOL address = tok->type == CCA_TOK_ADDRESS || cca_token_is_operator(tok, "&");
+	cca_value value;
+	if (tok->type == CCA_TOK_ADDRESS) {
+		++expression.position;
+		value = cca_expression_binary(&expression, cca_expression_number(tok->value.numeric), 1);
+	} else {
+		expression.position += address;
+		value = cca_expression_evaluate(&expression);
+	}
+	*position = expression.position;
+
+	if (address && value.type != CCA_OPERAND_NUMBER) {
+		printf("[ERROR] only numbers can be addresses at line %u\n", tok->line);
+		expression.error = TRUE;
+	}
+	if (expression.error)
+		*error = 1;
+
+	operand->offset = 0;
+	if (value.type == CCA_OPERAND_MARKER) {
+		operand->type = CCA_OPERAND_MARKER;
+		operand->value = cca_program_marker(program, value.marker);
+		operand->offset = value.number;
+	} else if (value.type == CCA_OPERAND_DEFINITION) {
+		operand->type = CCA_OPERAND_DEFINITION;
+		operand->value = value.definition;
+		operand->offset = value.number;
+	} else {
+		operand->type = address ? CCA_OPERAND_ADDRESS : CCA_OPERAND_NUMBER;
+		operand->value = value.number;
+	}
+	return TRUE;
+}
+
+BOOL cca_operand_accepts(char expected, char actual) {
+	// a marker reference is an address in code, an explicit address is accepted wherever a marker is
+	if (expected == CCA_OPERAND_ADDRESS || expected == CCA_OPERAND_MARKER)
+		return actual == CCA_OPERAND_ADDRESS || actual == CCA_OPERAND_MARKER;
+
+	// a definition is a pointer into the header
+	if (expected == CCA_OPERAND_NUMBER)
+		return actual == CCA_OPERAND_NUMBER || actual == CCA_OPERAND_DEFINITION;
+
+	return expected == actual;
+}
+
+int cca_opcode_lookup(char* mnemonic, unsigned int operandCount, cca_operand* operands) {
+	for (int opcode = 0; opcode < 256; opcode++) {
+		cca_opcode_info info = cca_opcodes[opcode];
+		if (info.mnemonic == NULL || cca_opcode_is_variant(opcode) || info.operandCount != operandCount || strcmp(info.mnemonic, mnemonic) != 0)
+			continue;
+
+		BOOL matches = TRUE;
+		for (int i = 0; i < operandCount; i++) {
+			if (!cca_operand_accepts(info.operands[i], operands[i].type))
+				matches = FALSE;
+		}
+
+		if (matches)
+			return opcode;
+	}
+
+	return -1;
+}
+
+char cca_assembler_parse_instructions(cca_token* tokens, cca_program* program) {
+	char error = 0;
+	unsigned int i = 0;
+
+	while (tokens[i].type != CCA_TOK_END) {
+		if (tokens[i].type == CCA_TOK_LABEL) {
+			unsigned int marker = cca_program_marker(program, tokens[i].value.string);
+			if (program->markers[marker].instruction != CCA_MARKER_UNDEFINED) {
+				printf("[ERROR] marker '%s' is defined more than once\n", tokens[i].value.string);
 				error = 1;
-				i += 1;
 			}
-		} else if (strcmp(tokens[i].value.string, "jg") == 0) {
-			if (tokens[i + 1].type == 7) {
-				cca_bytecode_add_byte(&bytecode, 0x35);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 1].value.numeric);
-				i += 2;
-			} else {
-				puts("[ERROR] on 'jg' instuction, illegal combination of operands");
-				error = 1;
-				i += 1;
+			program->markers[marker].instruction = program->instructionCount;
+			i += 1;
+			continue;
+		}
+
+		if (tokens[i].type != CCA_TOK_OPCODE) {
+			if (tokens[i].type == CCA_TOK_NUMBER || tokens[i].type == CCA_TOK_ADDRESS || tokens[i].type == CCA_TOK_DEFINITION)
+				printf("[ERROR] unexpected token: '%d' while generating bytecode\n", tokens[i].value.numeric);
+			else
+				printf("[ERROR] unexpected token: '%s' while generating bytecode\n", tokens[i].value.string);
+			i += 1;
+			error = 1;
+			continue;
+		}
+
+		// gather the operands
+		cca_instruction instruction = {0};
+		instruction.file = tokens[i].file;
+		instruction.line = tokens[i].line;
+		instruction.column = tokens[i].column;
+		unsigned int operandCount = 0;
+		unsigned int j = i + 1;
+
+		if (cca_operand_parse(program, tokens, &j, &instruction.operands[0], &error)) {
+			operandCount = 1;
+			if (tokens[j].type == CCA_TOK_DIVIDER) {
+				++j;
+				if (cca_operand_parse(program, tokens, &j, &instruction.operands[1], &error)) {
+					operandCount = 2;
+				} else {
+					operandCount = 3;
+				}
 			}
-		} else if (strcmp(tokens[i].value.string, "js") == 0) {
-			if (tokens[i + 1].type == 7) {
-				cca_bytecode_add_byte(&bytecode, 0x36);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 1].value.numeric);
-				i += 2;
-			} else {
-				puts("[ERROR] on 'js' instuction, illegal combination of operands");
-				error = 1;
-				i += 1;
+		}
+
+		int opcode = cca_opcode_lookup(tokens[i].value.string, operandCount, instruction.operands);
+		if (opcode < 0) {
+			printf("[ERROR] on '%s' instruction, illegal combination of operands\n", tokens[i].value.string);
+			error = 1;
+		} else {
+			instruction.opcode = opcode;
+			cca_program_add_instruction(program, instruction);
+		}
+
+		i = j;
+	}
+
+	for (int m = 0; m < program->markerCount; m++) {
+		if (program->markers[m].instruction == CCA_MARKER_UNDEFINED) {
+			printf("[ERROR] unknown identifier '%s'\n", program->markers[m].name);
+			error = 1;
+		}
+	}
+
+	return error;
+}
+
+// basic blocks, a block starts at a marker or after an instruction that can transfer control
+typedef struct cca_block {
+	unsigned int start;
+	unsigned int end;
+} cca_block;
+
+typedef struct cca_block_list {
+	cca_block* blocks;
+	unsigned int length;
+	unsigned int* blockOf;
+} cca_block_list;
+
+BOOL cca_opcode_ends_block(unsigned char opcode) {
+	return cca_opcode_is_terminator(opcode) || cca_opcode_is_conditional_jump(opcode) || opcode == CCA_OP_CALL;
+}
+
+cca_block_list cca_program_blocks(cca_program* program) {
+	unsigned int count = program->instructionCount;
+	BOOL* leaders = calloc(count + 1, sizeof(BOOL));
+	leaders[0] = TRUE;
+
+	for (int m = 0; m < program->markerCount; m++)
+		leaders[program->markers[m].instruction] = TRUE;
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (cca_opcode_ends_block(program->instructions[i].opcode))
+			leaders[i + 1] = TRUE;
+	}
+
+	cca_block_list list = {0};
+	list.blocks = malloc((count + 1) * sizeof(cca_block));
+	list.blockOf = malloc((count + 1) * sizeof(unsigned int));
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (leaders[i]) {
+			if (list.length > 0)
+				list.blocks[list.length - 1].end = i;
+			list.blocks[list.length].start = i;
+			++list.length;
+		}
+		list.blockOf[i] = list.length - 1;
+	}
+
+	if (list.length > 0)
+		list.blocks[list.length - 1].end = count;
+	list.blockOf[count] = list.length;
+
+	free(leaders);
+	return list;
+}
+
+void cca_block_list_free(cca_block_list* list) {
+	free(list->blocks);
+	free(list->blockOf);
+}
+
+unsigned int cca_wide_word_count(unsigned char opcode) {
+	cca_opcode_info info = cca_opcodes[opcode];
+	unsigned int immediates = 0;
+
+	for (int i = 0; i < info.operandCount; i++) {
+		if (info.operands[i] != CCA_OPERAND_REGISTER)
+			++immediates;
+	}
+
+	return immediates > 1 ? 2 : 1;
+}
+
+unsigned int cca_instruction_size(cca_instruction* instruction) {
+	cca_opcode_info info = cca_opcodes[instruction->encoding];
+	unsigned int size = 1;
+
+	for (int i = 0; i < info.operandCount; i++)
+		size += cca_operand_size(&info, i);
+
+	return size;
+}
+
+// the value an operand is encoded with, relative operands count from the end of the instruction
+unsigned int cca_operand_encoded_value(cca_program* program, cca_instruction* instruction, int operand) {
+	cca_opcode_info info = cca_opcodes[instruction->encoding];
+	unsigned int value = instruction->operands[operand].value;
+
+	if (instruction->operands[operand].type == CCA_OPERAND_MARKER)
+		value = program->markers[value].marks + instruction->operands[operand].offset;
+	if (info.operands[operand] == CCA_OPERAND_RELATIVE)
+		value -= instruction->offset + cca_instruction_size(instruction);
+
+	return value;
+}
+
+BOOL cca_instruction_fits(cca_program* program, cca_instruction* instruction) {
+	cca_opcode_info info = cca_opcodes[instruction->encoding];
+
+	for (int i = 0; i < info.operandCount; i++) {
+		unsigned int size = cca_operand_size(&info, i);
+		unsigned int value = cca_operand_encoded_value(program, instruction, i);
+
+		if (size >= 4 || info.operands[i] == CCA_OPERAND_REGISTER)
+			continue;
+		if (info.operands[i] == CCA_OPERAND_RELATIVE) {
+			int distance = (int) value;
+			if (distance < -(1 << (size * 8 - 1)) || distance >= (1 << (size * 8 - 1)))
+				return FALSE;
+		} else if (value >= (1u << (size * 8))) {
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+void cca_program_place(cca_program* program) {
+	unsigned int offset = 0;
+
+	for (int i = 0; i < program->instructionCount; i++) {
+		program->instructions[i].offset = offset;
+		if (program->encoding == CCA_ENCODING_WIDE)
+			offset += cca_wide_word_count(program->instructions[i].encoding);
+		else
+			offset += cca_instruction_size(&program->instructions[i]);
+	}
+
+	for (int i = 0; i < program->markerCount; i++) {
+		unsigned int instruction = program->markers[i].instruction;
+		program->markers[i].marks = instruction < program->instructionCount ? program->instructions[instruction].offset : offset;
+	}
+
+	program->codeLength = offset;
+}
+
+void cca_program_layout(cca_program* program, char encoding) {
+	program->encoding = encoding;
+	for (int i = 0; i < program->instructionCount; i++)
+		program->instructions[i].encoding = program->instructions[i].opcode;
+
+	if (encoding != CCA_ENCODING_COMPACT) {
+		cca_program_place(program);
+		return;
+	}
+
+	// start every instruction in its smallest form, then grow the ones that don't fit until the layout settles.
+	// instructions only ever grow, so this always ends
+	for (int i = 0; i < program->instructionCount; i++) {
+		for (int f = 0; f < cca_compact_form_count; f++) {
+			if (cca_compact_forms[f].opcode == program->instructions[i].opcode) {
+				program->instructions[i].encoding = cca_compact_forms[f].compact;
+				break;
 			}
-		} else if (strcmp(tokens[i].value.string, "jo") == 0) {
-			if (tokens[i + 1].type == 7) {
-				cca_bytecode_add_byte(&bytecode, 0x37);
-				cca_bytecode_add_uint(&bytecode, tokens[i + 1].value.numeric);
-				i += 2;
-			} else {
-				puts("[ERROR] on 'jo' instuction, illegal combination of operands");
-				error = 1;
-				i += 1;
+		}
+	}
+
+	BOOL changed = TRUE;
+	while (changed) {
+		changed = FALSE;
+		cca_program_place(program);
+
+		for (int i = 0; i < program->instructionCount; i++) {
+			cca_instruction* instruction = &program->instructions[i];
+			if (cca_instruction_fits(program, instruction))
+				continue;
+
+			unsigned int size = cca_instruction_size(instruction);
+			instruction->encoding = instruction->opcode;
+			for (int f = 0; f < cca_compact_form_count; f++) {
+				if (cca_compact_forms[f].opcode != instruction->opcode)
+					continue;
+
+				cca_instruction candidate = *instruction;
+				candidate.encoding = cca_compact_forms[f].compact;
+				if (cca_instruction_size(&candidate) > size && cca_instruction_fits(program, &candidate)) {
+					instruction->encoding = candidate.encoding;
+					break;
+				}
 			}
-		} else {
-			printf("[ERROR] unknown opcode '%s'\n", tokens[i].value.string);
-			exit(1);
+
+			changed = TRUE;
 		}
 	}
+}
 
-	
+void cca_program_encode_wide(cca_program* program, cca_bytecode* bytecode) {
+	for (int i = 0; i < program->instructionCount; i++) {
+		cca_instruction* instruction = &program->instructions[i];
+		cca_opcode_info info = cca_opcodes[instruction->encoding];
+		unsigned char registers[CCA_MAX_OPERANDS] = {0};
+		unsigned int immediates[CCA_MAX_OPERANDS] = {0};
+		unsigned int registerCount = 0;
+		unsigned int immediateCount = 0;
+
+		for (int j = 0; j < info.operandCount; j++) {
+			unsigned int value = cca_operand_encoded_value(program, instruction, j);
+			if (info.operands[j] == CCA_OPERAND_REGISTER)
+				registers[registerCount++] = value & 0xff;
+			else
+				immediates[immediateCount++] = value;
+		}
+
+		cca_bytecode_add_byte(bytecode, instruction->encoding);
+		cca_bytecode_add_byte(bytecode, registers[0]);
+		cca_bytecode_add_byte(bytecode, registers[1]);
+		cca_bytecode_add_byte(bytecode, registers[2]);
+		cca_bytecode_add_uint_le(bytecode, immediates[0]);
+
+		if (cca_wide_word_count(instruction->encoding) > 1) {
+			cca_bytecode_add_uint_le(bytecode, immediates[1]);
+			cca_bytecode_add_uint_le(bytecode, immediates[2]);
+		}
+	}
+}
+
+void cca_program_encode(cca_program* program, cca_bytecode* bytecode) {
+	if (program->encoding == CCA_ENCODING_WIDE) {
+		cca_program_encode_wide(program, bytecode);
+		return;
+	}
+
+	for (int i = 0; i < program->instructionCount; i++) {
+		cca_instruction* instruction = &program->instructions[i];
+		cca_opcode_info info = cca_opcodes[instruction->encoding];
+
+		cca_bytecode_add_byte(bytecode, instruction->encoding);
+		for (int j = 0; j < info.operandCount; j++) {
+			unsigned int value = cca_operand_encoded_value(program, instruction, j);
+
+			if (info.operands[j] == CCA_OPERAND_REGISTER) {
+				cca_bytecode_add_reg(bytecode, value);
+				continue;
+			}
+
+			switch (cca_operand_size(&info, j)) {
+				case 1: cca_bytecode_add_byte(bytecode, value & 0xff); break;
+				case 2: cca_bytecode_add_short(bytecode, value); break;
+				default: cca_bytecode_add_uint(bytecode, value); break;
+			}
+		}
+	}
+}
+
+// decoding, the other way around. operands come back as registers, numbers and addresses, branch targets as the
+// address they go to. returns how many code address units the instruction takes, 0 if it can't be decoded
+unsigned char cca_opcode_standard(unsigned char encoding) {
+	for (int f = 0; f < cca_compact_form_count; f++) {
+		if (cca_compact_forms[f].compact == encoding)
+			return cca_compact_forms[f].opcode;
+	}
+
+	return encoding;
+}
+
+unsigned int cca_read_be(unsigned char* bytes, unsigned int size) {
+	unsigned int value = 0;
+	for (unsigned int i = 0; i < size; i++)
+		value = (value << 8) | bytes[i];
+	return value;
+}
+
+unsigned int cca_read_le(unsigned char* bytes) {
+	return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((unsigned int) bytes[3] << 24);
+}
+
+unsigned int cca_decode_instruction(unsigned char* code, unsigned int length, char encoding, unsigned int offset, cca_instruction* instruction) {
+	unsigned int position = encoding == CCA_ENCODING_WIDE ? offset * CCA_WIDE_WORD : offset;
+	if (position >= length)
+		return 0;
+
+	cca_opcode_info info = cca_opcodes[code[position]];
+	if (info.mnemonic == NULL)
+		return 0;
+
+	instruction->encoding = code[position];
+	instruction->opcode = cca_opcode_standard(code[position]);
+	instruction->offset = offset;
+	for (int i = 0; i < CCA_MAX_OPERANDS; i++)
+		instruction->operands[i].type = CCA_OPERAND_NONE;
+
+	if (encoding == CCA_ENCODING_WIDE) {
+		unsigned int words = cca_wide_word_count(instruction->encoding);
+		if (position + words * CCA_WIDE_WORD > length)
+			return 0;
+
+		unsigned int registerCount = 0;
+		unsigned int immediateCount = 0;
+		for (int i = 0; i < info.operandCount; i++) {
+			instruction->operands[i].type = info.operands[i] == CCA_OPERAND_MARKER ? CCA_OPERAND_ADDRESS : info.operands[i];
+			if (info.operands[i] == CCA_OPERAND_REGISTER)
+				instruction->operands[i].value = code[position + 1 + registerCount++];
+			else
+				instruction->operands[i].value = cca_read_le(code + position + 4 + 4 * immediateCount++);
+		}
+
+		return words;
+	}
+
+	unsigned int size = cca_instruction_size(instruction);
+	if (position + size > length)
+		return 0;
+
+	unsigned char* operand = code + position + 1;
+	for (int i = 0; i < info.operandCount; i++) {
+		unsigned int operandSize = cca_operand_size(&info, i);
+		unsigned int value = cca_read_be(operand, operandSize);
+
+		instruction->operands[i].type = info.operands[i];
+		if (info.operands[i] == CCA_OPERAND_RELATIVE) {
+			// sign extend and count from the end of the instruction
+			if (operandSize < 4 && (value & (1u << (operandSize * 8 - 1))))
+				value |= ~0u << (operandSize * 8);
+			value += offset + size;
+		}
+		if (info.operands[i] == CCA_OPERAND_MARKER || info.operands[i] == CCA_OPERAND_RELATIVE)
+			instruction->operands[i].type = CCA_OPERAND_ADDRESS;
+
+		instruction->operands[i].value = value;
+		operand += operandSize;
+	}
+
+	return size;
+}
+
+// header generation
+//
+// without optimization the values of all defs are written in declaration order. optimized, defs nobody references
+// are dropped and every value that is equal to or a suffix of another value points into that one instead, found by
+// sorting the values by their reversed bytes, the way linkers merge string tails
+int cca_definition_compare_reversed(const void* a, const void* b) {
+	char* left = (*(cca_definition* const*) a)->value;
+	char* right = (*(cca_definition* const*) b)->value;
+	int leftLength = (*(cca_definition* const*) a)->length;
+	int rightLength = (*(cca_definition* const*) b)->length;
+
+	for (int i = 1; i <= leftLength && i <= rightLength; i++) {
+		unsigned char l = left[leftLength - i];
+		unsigned char r = right[rightLength - i];
+		if (l != r)
+			return l < r ? -1 : 1;
+	}
+
+	return leftLength - rightLength;
+}
+
+void cca_definition_write(cca_definition* def, cca_bytecode* bytecode) {
+	if (def->file != NULL) {
+		cca_bytecode_splice(bytecode, def->file, def->length);
+		return;
+	}
+
+	for (unsigned int j = 0; j < def->length; j++)
+		cca_bytecode_add_byte(bytecode, def->value[j]);
+}
+
+unsigned int cca_assembler_header(cca_definition_list* defs, cca_program* program, BOOL optimize, cca_bytecode* bytecode) {
+	unsigned int start = cca_bytecode_size(bytecode);
+
+	if (!optimize) {
+		for (int i = 0; i < defs->length; i++)
+			cca_definition_write(&defs->definitions[i], bytecode);
+
+		return cca_bytecode_size(bytecode) - start;
+	}
+
+	BOOL* referenced = calloc(defs->length + 1, sizeof(BOOL));
+	for (int i = 0; i < program->instructionCount; i++) {
+		for (int j = 0; j < 2; j++) {
+			if (program->instructions[i].operands[j].type == CCA_OPERAND_DEFINITION)
+				referenced[program->instructions[i].operands[j].value] = TRUE;
+		}
+	}
+
+	cca_definition** sorted = malloc((defs->length + 1) * sizeof(cca_definition*));
+	unsigned int sortedCount = 0;
+	for (int i = 0; i < defs->length; i++) {
+		if (referenced[i] && defs->definitions[i].file == NULL)
+			sorted[sortedCount++] = &defs->definitions[i];
+	}
+
+	qsort(sorted, sortedCount, sizeof(cca_definition*), cca_definition_compare_reversed);
+
+	// walking backwards a value is a suffix of the last value written whenever it can share a tail with anything
+	cca_definition* owner = NULL;
+	unsigned int ownerLength = 0;
+	for (int i = (int) sortedCount - 1; i >= 0; i--) {
+		cca_definition* def = sorted[i];
+		unsigned int length = def->length;
+
+		if (owner != NULL && length <= ownerLength && memcmp(owner->value + ownerLength - length, def->value, length) == 0) {
+			def->pointer = owner->pointer + ownerLength - length;
+			continue;
+		}
+
+		def->pointer = cca_bytecode_size(bytecode) - start;
+		cca_definition_write(def, bytecode);
+
+		owner = def;
+		ownerLength = length;
+	}
+
+	// included files go behind everything else, the small values keep the short addresses
+	for (int i = 0; i < defs->length; i++) {
+		if (referenced[i] && defs->definitions[i].file != NULL) {
+			defs->definitions[i].pointer = cca_bytecode_size(bytecode) - start;
+			cca_definition_write(&defs->definitions[i], bytecode);
+		}
+	}
+
+	free(referenced);
+	free(sorted);
+	return cca_bytecode_size(bytecode) - start;
+}
+
+void cca_program_resolve_definitions(cca_program* program, cca_definition_list* defs) {
+	for (int i = 0; i < program->instructionCount; i++) {
+		for (int j = 0; j < 2; j++) {
+			cca_operand* operand = &program->instructions[i].operands[j];
+			if (operand->type == CCA_OPERAND_DEFINITION) {
+				operand->type = CCA_OPERAND_NUMBER;
+				operand->value = defs->definitions[operand->value].pointer + operand->offset;
+				operand->offset = 0;
+			}
+		}
+	}
+}
+
+#include "trace.h"
+#include "stats.h"
+
+typedef struct cca_options {
+	char encoding;
+	BOOL foldIdenticalCode;
+	BOOL foldConstants;
+	BOOL optimizeData;
+	unsigned int spillBase;
+	BOOL flat;
+	BOOL blockIndex;
+	BOOL native;
+	unsigned int fusions;
+	BOOL dumpTokens;
+	BOOL debugInfo;
+	char* sourceName;
+	// test.ccb, or test for native output, when it's NULL. - is stdout
+	char* outputName;
+	cca_stats* stats;
+	// what the code is made of, NULL when nobody asked
+	struct cca_report* report;
+} cca_options;
+
+#include "regalloc.h"
+#include "optimizer.h"
+#include "container.h"
+#include "verifier.h"
+#include "native.h"
+#include "report.h"
+
+// generates the output into bytecode and the line table of flat output into map when there is one, returns 1 on errors
+char cca_assembler_bytegeneration(cca_token* tokens, cca_definition_list defs, cca_options* options, cca_bytecode* bytecode, cca_bytecode* map) {
+	cca_bytecode data = cca_bytecode_create(100);
+	cca_bytecode code = cca_bytecode_create(100);
+	cca_bytecode symbols = cca_bytecode_create(100);
+	cca_bytecode blocks = cca_bytecode_create(100);
+	cca_bytecode lines = cca_bytecode_create(100);
+	char* sourceName = options->sourceName != NULL ? options->sourceName : "";
+
+	cca_stats* stats = options->stats;
+	cca_program program = cca_program_create();
+	cca_stats_begin(stats, "parse");
+	char error = cca_assembler_parse_instructions(tokens, &program);
+	cca_stats_end(stats, program.instructionCount, "instructions", 0);
 
 	if (!error) {
-		fwrite(bytecode.bytecode, 1, bytecode.bytecodeLength, fp);
+		// generate bytes of the header
+		cca_stats_begin(stats, "header");
+		unsigned int headerLength = cca_assembler_header(&defs, &program, options->optimizeData, &data);
+		cca_program_resolve_definitions(&program, &defs);
+		cca_stats_end(stats, defs.length, "defs", headerLength);
+
+		cca_stats_begin(stats, "regalloc");
+		cca_allocate_registers(&program, options->spillBase != 0 ? options->spillBase : cca_default_spill_base(&program, headerLength));
+		cca_stats_end(stats, program.instructionCount, "instructions", 0);
+
+		cca_stats_begin(stats, "optimize");
+		if (options->foldConstants)
+			cca_optimize_fold_constants(&program);
+		if (options->foldIdenticalCode)
+			cca_optimize_fold_identical_code(&program);
+		if (options->fusions != 0 && !options->native)
+			cca_optimize_fuse(&program, options->fusions);
+		cca_stats_end(stats, program.instructionCount, "instructions", 0);
+
+		cca_stats_begin(stats, "layout");
+		cca_program_layout(&program, options->native ? CCA_ENCODING_STANDARD : options->encoding);
+		cca_stats_end(stats, program.markerCount, "markers", 0);
+
+		cca_stats_begin(stats, "encode");
+		cca_program_encode(&program, &code);
+		cca_stats_end(stats, program.instructionCount, "instructions", code.bytecodeLength);
+
+		if (options->report != NULL) {
+			options->report->module = options->sourceName;
+			cca_report_program(options->report, &program, headerLength);
+		}
+
+		cca_stats_begin(stats, "output");
+
+		if (options->native) {
+			unsigned int maxStackDepth;
+			if (!cca_verify((unsigned char*) code.bytecode, code.bytecodeLength, CCA_ENCODING_STANDARD, &maxStackDepth))
+				puts("[WARNING] native code doesn't check the stack, it is only safe for verified programs");
+			// the executable is written in one piece
+			if (!cca_bytecode_materialize(&data) || !cca_native_emit(&program, &data, bytecode))
+				error = 1;
+		} else if (options->flat) {
+			// header, marker and code with nothing around them. the records of wide code are loaded a word at a time,
+			// so the header is padded with zeros until the code after the marker starts on a word
+			cca_bytecode_append(bytecode, &data);
+			while (options->encoding == CCA_ENCODING_WIDE && (cca_bytecode_size(bytecode) + 4) % CCA_WIDE_WORD != 0)
+				cca_bytecode_add_byte(bytecode, 0);
+			cca_bytecode_add_uint(bytecode, CCB_FLAT_MARKER);
+			cca_bytecode_add_bytes(bytecode, code.bytecode, code.bytecodeLength);
+
+			// there is nowhere to put the line table but a file of its own
+			if (options->debugInfo && map != NULL) {
+				cca_bytecode_add_uint_le(map, CCB_MAP_MAGIC);
+				cca_bytecode_add_uint_le(map, CCB_MAP_VERSION);
+				cca_container_lines(&program, sourceName, map);
+			}
+		} else {
+			cca_container container = {0};
+			container.encoding = options->encoding;
+			if (cca_verify((unsigned char*) code.bytecode, code.bytecodeLength, options->encoding, &container.maxStackDepth))
+				container.flags |= CCB_FLAG_VERIFIED;
+
+			cca_container_symbols(&program, &symbols);
+			cca_container_add(&container, CCB_SECTION_DATA, CCB_PAGE_ALIGNMENT, &data);
+			cca_container_add(&container, CCB_SECTION_CODE, CCB_PAGE_ALIGNMENT, &code);
+			cca_container_add(&container, CCB_SECTION_SYMBOLS, CCB_CACHE_LINE_ALIGNMENT, &symbols);
+
+			if (options->blockIndex) {
+				cca_container_blocks(&program, &blocks);
+				cca_container_add(&container, CCB_SECTION_BLOCKS, CCB_CACHE_LINE_ALIGNMENT, &blocks);
+			}
+			if (options->debugInfo) {
+				cca_container_lines(&program, sourceName, &lines);
+				cca_container_add(&container, CCB_SECTION_DEBUG, CCB_CACHE_LINE_ALIGNMENT, &lines);
+			}
+
+			cca_container_write(&container, bytecode);
+		}
+
+		cca_stats_end(stats, 0, NULL, cca_bytecode_size(bytecode));
+		if (options->report != NULL)
+			options->report->outputSize = cca_bytecode_size(bytecode);
 	}
 
-	fclose(fp);
+	cca_program_free(&program);
+	cca_bytecode_free(&data);
+	free(code.bytecode);
+	free(symbols.bytecode);
+	free(blocks.bytecode);
+	free(lines.bytecode);
 	return error;
 }
 
-char cca_assemble(char* fileName) {
-	// optain the assembly code
-	cca_file_content content = ccvm_program_load(fileName);
-	
+unsigned int cca_token_count(cca_token* tokens) {
+	unsigned int count = 0;
+	while (tokens[count].type != CCA_TOK_END)
+		++count;
+	return count;
+}
+
+// assembles source that is already in memory, returns 1 on success. map can be NULL
+char cca_assemble_source(cca_file_content content, cca_options* options, cca_bytecode* output, cca_bytecode* map) {
+	cca_stats* stats = options->stats;
+	if (stats != NULL)
+		stats->sourceSize = content.fileSize;
+
 	// lex the assembly code into tokens
-	cca_token* tokens = cca_assembler_lex(content);
+	cca_stats_begin(stats, "lex");
+	BOOL lexError = FALSE;
+	cca_token* tokens = cca_assembler_lex(content, &lexError);
+	cca_stats_end(stats, stats != NULL ? cca_token_count(tokens) : 0, "tokens", 0);
+	if (lexError) {
+		free(tokens);
+		return 0;
+	}
+
+	// put the included files in
+	cca_stats_begin(stats, "include");
+	char includeError = cca_assembler_include(&tokens, options->sourceName);
+	cca_stats_end(stats, stats != NULL ? cca_token_count(tokens) : 0, "tokens", 0);
+
+	// expand the macros and constants
+	cca_stats_begin(stats, "macros");
+	includeError |= cca_assembler_macros(&tokens);
+	cca_stats_end(stats, stats != NULL ? cca_token_count(tokens) : 0, "tokens", 0);
 
 	// parse the defines and get rid of them in the tokens
+	cca_stats_begin(stats, "define_parser");
 	cca_definition_list defs = cca_assembler_define_parser(&tokens);
-
-	
+	cca_stats_end(stats, defs.length, "defs", 0);
 
 	// replace all the unknown identifiers with their corresponding define pointer
+	cca_stats_begin(stats, "replace_defs");
 	cca_assembler_replace_defs(&tokens, defs);
+	cca_stats_end(stats, stats != NULL ? cca_token_count(tokens) : 0, "tokens", 0);
 
-	int i = 0;
-	while (tokens[i++].type != 6) {
-		cca_token_print(tokens[i]);
+	if (options->dumpTokens) {
+		for (int i = 0; ; i++) {
+			cca_token_print(tokens[i]);
+			if (tokens[i].type == CCA_TOK_END)
+				break;
+		}
 	}
 
 	// generate bytecode
-	if (cca_assembler_bytegeneration(tokens, defs)) {
-		free(tokens);
+	char error = includeError || defs.error || cca_assembler_bytegeneration(tokens, defs, options, output, map);
+
+	free(tokens);
+	free(defs.definitions);
+	return !error;
+}
+
+// the name with its extension replaced, or added when there is none
+char* cca_output_name(char* name, char* extension) {
+	char* slash = strrchr(name, '/');
+	char* dot = strrchr(name, '.');
+	unsigned int length = dot != NULL && (slash == NULL || dot > slash) ? dot - name : strlen(name);
+
+	char* result = malloc(length + strlen(extension) + 1);
+	memcpy(result, name, length);
+	strcpy(result + length, extension);
+	return result;
+}
+
+// where output named - goes. main moves stdout there and the messages to stderr when it is piped
+int cca_standard_output = STDOUT_FILENO;
+
+char cca_assemble(char* fileName, cca_options* options) {
+	// optain the assembly code
+	cca_stats_begin(options->stats, "load");
+	cca_file_content content = ccvm_program_load(fileName);
+	cca_stats_end(options->stats, 0, NULL, content.fileSize);
+
+	cca_bytecode bytecode = cca_bytecode_create(100);
+	cca_bytecode map = cca_bytecode_create(100);
+
+	if (!cca_assemble_source(content, options, &bytecode, &map)) {
+		cca_bytecode_free(&bytecode);
+		free(map.bytecode);
 		free(content.content);
 		return 0;
 	}
 
-	free(tokens);
+	// included files are copied into the output by the kernel
+	cca_stats_begin(options->stats, "write");
+	char* outputName = options->outputName != NULL ? options->outputName : options->native ? "test" : "test.ccb";
+	BOOL piped = strcmp(outputName, "-") == 0;
+	BOOL written;
+	if (piped) {
+		written = cca_bytecode_write(&bytecode, cca_standard_output);
+		if (!written)
+			printf("[ERROR] could not write '%s'\n", outputName);
+	} else {
+		written = cca_bytecode_store(&bytecode, outputName, 0644);
+		if (options->native)
+			chmod(outputName, 0755);
+	}
+
+	if (map.bytecodeLength != 0 && piped) {
+		puts("[WARNING] the line table of flat output has nowhere to go next to a pipe, leave out --flat to keep it");
+	} else if (map.bytecodeLength != 0) {
+		char* mapName = cca_output_name(outputName, ".ccmap");
+		written = cca_bytecode_store(&map, mapName, 0644) && written;
+		free(mapName);
+	}
+	cca_stats_end(options->stats, 0, NULL, cca_bytecode_size(&bytecode) + map.bytecodeLength);
+
+	free(map.bytecode);
+	cca_bytecode_free(&bytecode);
 	free(content.content);
-	return 1;
+	return written;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,179 @@
+#ifndef ccvm_assembler_batch
+#define ccvm_assembler_batch
+
+// assembles several files at once, every source into <name>.ccb next to it
+//
+// workers take the next file off a shared counter until none are left, so a long file only holds up the worker
+// it landed on. the thread that started them does the i/o meanwhile, it keeps a few sources per worker read ahead
+// and writes outputs as they are handed over, and drains the trace
+#include <pthread.h>
+#include "assembler.h"
+#include "io.h"
+
+// sources read ahead for every worker
+#define CCA_BATCH_PREFETCH 4
+
+typedef struct cca_batch_file {
+	char* source;
+	char* output;
+	BOOL ok;
+	cca_stats stats;
+	cca_report report;
+
+	cca_io_request input;
+	cca_io_request outputs[2];
+	unsigned int outputCount;
+	cca_bytecode bytecode;
+	cca_bytecode map;
+	char* mapName;
+} cca_batch_file;
+
+typedef struct cca_batch {
+	cca_batch_file* files;
+	unsigned int fileCount;
+	_Atomic unsigned int next;
+	_Atomic unsigned int finished;
+
+	cca_options* options;
+	cca_trace* trace;
+	BOOL perfCounters;
+
+	// io_uring when it is there, threads otherwise
+	BOOL uring;
+	cca_io io;
+	unsigned int prefetch;
+} cca_batch;
+
+typedef struct cca_batch_worker {
+	pthread_t thread;
+	cca_batch* batch;
+	unsigned int index;
+} cca_batch_worker;
+
+void* cca_batch_work(void* argument) {
+	cca_batch_worker* worker = argument;
+	cca_batch* batch = worker->batch;
+
+	if (batch->trace != NULL) {
+		char name[32];
+		snprintf(name, sizeof(name), "worker %u", worker->index + 1);
+		cca_trace_thread(batch->trace, name);
+	}
+
+	while (TRUE) {
+		unsigned int index = atomic_fetch_add(&batch->next, 1);
+		if (index >= batch->fileCount)
+			break;
+
+		// the source a window ahead is read meanwhile, so the workers find theirs waiting
+		if (index + batch->prefetch < batch->fileCount)
+			cca_io_load(&batch->io, &batch->files[index + batch->prefetch].input, batch->files[index + batch->prefetch].source);
+
+		cca_batch_file* file = &batch->files[index];
+		cca_io_wait(&batch->io, &file->input);
+		if (!file->input.ok) {
+			atomic_fetch_add(&batch->finished, 1);
+			continue;
+		}
+
+		// every file gets its own options, stats and report, the rest is shared and only read
+		cca_options options = *batch->options;
+		options.sourceName = file->source;
+		options.outputName = file->output;
+		if (options.stats != NULL) {
+			options.stats = &file->stats;
+			if (batch->perfCounters)
+				cca_stats_perf_open(&file->stats);
+		}
+		if (options.report != NULL)
+			options.report = &file->report;
+
+		cca_trace_begin(file->source, file->source);
+		file->bytecode = cca_bytecode_create(100);
+		file->map = cca_bytecode_create(100);
+		file->ok = cca_assemble_source(file->input.content, &options, &file->bytecode, &file->map);
+		free(file->input.content.content);
+
+		// the bytes belong to the i/o from here on
+		if (file->ok) {
+			cca_io_store(&batch->io, &file->outputs[file->outputCount++], file->output, &file->bytecode, options.native ? 0755 : 0644);
+			if (file->map.bytecodeLength != 0) {
+				file->mapName = cca_output_name(file->output, ".ccmap");
+				cca_io_store(&batch->io, &file->outputs[file->outputCount++], file->mapName, &file->map, 0644);
+			} else {
+				free(file->map.bytecode);
+			}
+		} else {
+			cca_bytecode_free(&file->bytecode);
+			free(file->map.bytecode);
+		}
+		cca_trace_end();
+
+		cca_stats_perf_close(&file->stats);
+		atomic_fetch_add(&batch->finished, 1);
+	}
+
+	return NULL;
+}
+
+// returns how many files assembled
+unsigned int cca_assemble_batch(cca_batch* batch, unsigned int jobs) {
+	if (jobs > batch->fileCount)
+		jobs = batch->fileCount;
+	if (jobs == 0)
+		jobs = 1;
+
+	// this thread polls the i/o, so the loads and writes of io_uring show up on it
+	if (batch->trace != NULL)
+		cca_trace_thread(batch->trace, "io");
+	batch->uring = cca_io_open(&batch->io, batch->uring, batch->trace);
+	batch->prefetch = jobs * CCA_BATCH_PREFETCH;
+	for (unsigned int i = 0; i < batch->prefetch && i < batch->fileCount; i++)
+		cca_io_load(&batch->io, &batch->files[i].input, batch->files[i].source);
+
+	cca_batch_worker* workers = calloc(jobs, sizeof(cca_batch_worker));
+	for (unsigned int i = 0; i < jobs; i++) {
+		workers[i].batch = batch;
+		workers[i].index = i;
+		if (pthread_create(&workers[i].thread, NULL, cca_batch_work, &workers[i]) != 0) {
+			// the ones that started pick up the files
+			puts("[WARNING] could not start all workers");
+			jobs = i;
+			break;
+		}
+	}
+
+	if (jobs == 0) {
+		// nobody polls the ring meanwhile, so the i/o goes without it
+		cca_io_close(&batch->io);
+		batch->uring = cca_io_open(&batch->io, FALSE, batch->trace);
+		cca_batch_work(&(cca_batch_worker) { 0, batch, 0 });
+	}
+
+	while (atomic_load(&batch->finished) < batch->fileCount) {
+		cca_io_poll(&batch->io);
+		if (batch->trace != NULL)
+			cca_trace_drain(batch->trace);
+	}
+
+	for (unsigned int i = 0; i < jobs; i++)
+		pthread_join(workers[i].thread, NULL);
+	free(workers);
+	cca_io_close(&batch->io);
+
+	// the spans point at the names of the files, which don't outlive the batch
+	if (batch->trace != NULL)
+		cca_trace_drain(batch->trace);
+
+	unsigned int assembled = 0;
+	for (unsigned int i = 0; i < batch->fileCount; i++) {
+		cca_batch_file* file = &batch->files[i];
+		for (unsigned int j = 0; j < file->outputCount; j++)
+			file->ok = file->ok && file->outputs[j].ok;
+		free(file->mapName);
+		assembled += file->ok;
+	}
+	return assembled;
+}
+
+#endif
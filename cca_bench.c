@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include "assembler.h"
+
+// assembles generated sources of growing size and reports how fast every phase runs as json. the generator is
+// deterministic, the same seed and settings give the same source. a phase whose time grows much faster than the
+// source between the two largest sizes gets a warning, that's how quadratic passes show up
+#define CCA_BENCH_PHASES 5
+#define CCA_BENCH_MAX_SIZES 16
+
+typedef struct cca_bench_config {
+	unsigned long long instructions;
+	unsigned int labelEvery;
+	unsigned int defs;
+	unsigned int stringSize;
+	unsigned int commentPercent;
+	unsigned long long seed;
+} cca_bench_config;
+
+typedef struct cca_bench_result {
+	unsigned long long instructions;
+	unsigned int sourceSize;
+	unsigned int outputSize;
+	double seconds[CCA_BENCH_PHASES];
+} cca_bench_result;
+
+char* cca_bench_phase_names[CCA_BENCH_PHASES] = { "lex", "define_parser", "replace_defs", "bytegeneration", "total" };
+
+unsigned long long cca_bench_random(unsigned long long* state) {
+	// xorshift64*
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dull;
+}
+
+void cca_bench_append(cca_bytecode* source, char* format, ...) {
+	char line[256];
+	va_list arguments;
+	va_start(arguments, format);
+	int length = vsnprintf(line, sizeof(line), format, arguments);
+	va_end(arguments);
+	cca_bytecode_add_bytes(source, line, length);
+}
+
+void cca_bench_comment(cca_bytecode* source, unsigned long long* state) {
+	char* words[] = { "load", "the", "counter", "and", "check", "it", "again", "before", "jumping", "back" };
+	cca_bytecode_add_bytes(source, " ;", 2);
+	for (unsigned int i = 0, count = 2 + cca_bench_random(state) % 6; i < count; i++)
+		cca_bench_append(source, " %s", words[cca_bench_random(state) % 10]);
+}
+
+// every line an instruction, one of the common shapes, with labels, comments and indentation mixed in
+cca_file_content cca_bench_generate(cca_bench_config* config) {
+	cca_bytecode source = cca_bytecode_create(1 << 16);
+	unsigned long long state = config->seed * 0x9e3779b97f4a7c15ull + 1;
+	char* registers = "abcd";
+	char* indents[] = { "", "\t", "    ", "\t\t" };
+
+	for (unsigned int i = 0; i < config->defs; i++) {
+		cca_bench_append(&source, "def str%u \"", i);
+		for (unsigned int j = 0; j < config->stringSize; j++)
+			cca_bytecode_add_byte(&source, 'a' + cca_bench_random(&state) % 26);
+		cca_bytecode_add_bytes(&source, "\"\n", 2);
+	}
+
+	unsigned long long labelCount = config->labelEvery != 0 ? config->instructions / config->labelEvery + 1 : 0;
+	unsigned long long label = 0;
+	cca_bytecode_add_bytes(&source, ":main\n", 6);
+
+	for (unsigned long long count = 0; count < config->instructions;) {
+		if (config->labelEvery != 0 && count / config->labelEvery >= label)
+			cca_bench_append(&source, ":l%llu\n", label++);
+		if (cca_bench_random(&state) % 100 < config->commentPercent / 2) {
+			cca_bytecode_add_byte(&source, ';');
+			cca_bench_comment(&source, &state);
+			cca_bytecode_add_byte(&source, '\n');
+		}
+
+		char* indent = indents[cca_bench_random(&state) % 4];
+		char r = registers[cca_bench_random(&state) % 4];
+		char s = registers[cca_bench_random(&state) % 4];
+		unsigned int n = cca_bench_random(&state) % 100000;
+		unsigned int kind = cca_bench_random(&state) % 12;
+
+		if (kind >= 7 && kind <= 9 && labelCount == 0)
+			kind = 0;
+		if (kind == 10 && config->defs == 0)
+			kind = 1;
+
+		switch (kind) {
+			case 0: cca_bench_append(&source, "%smov %c, %u", indent, r, n); break;
+			case 1: cca_bench_append(&source, "%smov %c, %c", indent, r, s); break;
+			case 2: cca_bench_append(&source, "%sinc %c", indent, r); break;
+			case 3: cca_bench_append(&source, "%sdec %c", indent, r); break;
+			case 4: cca_bench_append(&source, "%scmp %c, %u", indent, r, n); break;
+			case 5: cca_bench_append(&source, "%scmp %c, %c", indent, r, s); break;
+			case 6:
+				// pushes stay balanced
+				cca_bench_append(&source, "%spsh %c\n%spsh %u\n%sadd\n%spop %c", indent, r, indent, n, indent, indent, s);
+				count += 3;
+				break;
+			case 7: cca_bench_append(&source, "%sjne l%llu", indent, cca_bench_random(&state) % labelCount); break;
+			case 8: cca_bench_append(&source, "%sje l%llu", indent, cca_bench_random(&state) % labelCount); break;
+			case 9: cca_bench_append(&source, "%sjmp l%llu", indent, cca_bench_random(&state) % labelCount); break;
+			case 10: cca_bench_append(&source, "%smov %c, str%u", indent, r, (unsigned int) (cca_bench_random(&state) % config->defs)); break;
+			default: cca_bench_append(&source, "%sfrs", indent); break;
+		}
+
+		if (cca_bench_random(&state) % 100 < config->commentPercent / 2)
+			cca_bench_comment(&source, &state);
+		cca_bytecode_add_byte(&source, '\n');
+		++count;
+	}
+
+	// labels jumped to but not reached yet
+	while (label < labelCount)
+		cca_bench_append(&source, ":l%llu\n", label++);
+	cca_bytecode_add_bytes(&source, "stp\n", 4);
+
+	// the lexer wants the source to end in a nul
+	cca_bytecode_add_byte(&source, '\0');
+	cca_file_content content = { source.bytecodeLength - 1, source.bytecode };
+	return content;
+}
+
+double cca_bench_now() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// the phases of cca_assemble_source, timed one by one
+void cca_bench_assemble(cca_file_content source, cca_options* options, double* seconds, unsigned int* outputSize) {
+	double start = cca_bench_now();
+	BOOL lexError = FALSE;
+	cca_token* tokens = cca_assembler_lex(source, &lexError);
+	cca_token* lexed = tokens;
+	double lexedAt = cca_bench_now();
+	cca_definition_list defs = cca_assembler_define_parser(&tokens);
+	double parsedAt = cca_bench_now();
+	cca_assembler_replace_defs(&tokens, defs);
+	double replacedAt = cca_bench_now();
+	cca_bytecode output = cca_bytecode_create(100);
+	if (lexError || defs.error || cca_assembler_bytegeneration(tokens, defs, options, &output, NULL))
+		fputs("[WARNING] the generated source doesn't assemble\n", stderr);
+	double end = cca_bench_now();
+
+	seconds[0] = lexedAt - start;
+	seconds[1] = parsedAt - lexedAt;
+	seconds[2] = replacedAt - parsedAt;
+	seconds[3] = end - replacedAt;
+	seconds[4] = end - start;
+	*outputSize = cca_bytecode_size(&output);
+
+	// the define parser copies the tokens, the strings are only in the ones the lexer made
+	for (unsigned int i = 0; lexed[i].type != CCA_TOK_END; i++) {
+		char type = lexed[i].type;
+		if (type == CCA_TOK_IDENTIFIER || type == CCA_TOK_OPCODE || type == CCA_TOK_REGISTER || type == CCA_TOK_LABEL || type == CCA_TOK_STRING)
+			free(lexed[i].value.string);
+	}
+	free(lexed);
+	free(tokens);
+	free(defs.definitions);
+	cca_bytecode_free(&output);
+}
+
+void cca_bench_json_phase(FILE* output, cca_bench_result* result, cca_bench_result* previous, int phase) {
+	double seconds = result->seconds[phase];
+	fprintf(output, "        \"%s\": { \"seconds\": %.6f, \"mb_per_second\": %.2f, \"instructions_per_second\": %.0f",
+		cca_bench_phase_names[phase], seconds, seconds > 0 ? result->sourceSize / 1e6 / seconds : 0.0,
+		seconds > 0 ? result->instructions / seconds : 0.0);
+
+	// how the time grows against the instruction count since the last size, about 1 for a linear pass
+	if (previous != NULL && previous->seconds[phase] > 0 && seconds > 0) {
+		double exponent = log(seconds / previous->seconds[phase]) / log((double) result->instructions / previous->instructions);
+		fprintf(output, ", \"growth_exponent\": %.2f", exponent);
+	}
+	fprintf(output, " }%s\n", phase + 1 < CCA_BENCH_PHASES ? "," : "");
+}
+
+int main(int argc, char* argv[]) {
+	cca_bench_config config = {
+		.labelEvery = 8,
+		.defs = 100,
+		.stringSize = 16,
+		.commentPercent = 20,
+		.seed = 1
+	};
+	unsigned long long sizes[CCA_BENCH_MAX_SIZES] = { 1000, 10000, 100000, 1000000 };
+	unsigned int sizeCount = 4;
+	unsigned int repeat = 3;
+	BOOL emit = FALSE;
+	char* outputName = NULL;
+	cca_options options = {0};
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--instructions=", 15) == 0) {
+			// a size or a list of them, 1000,10000,...
+			char* list = argv[i] + 15;
+			for (sizeCount = 0; sizeCount < CCA_BENCH_MAX_SIZES && *list != '\0'; list += *list == ',') {
+				sizes[sizeCount++] = strtoull(list, &list, 10);
+				if (*list != ',' && *list != '\0') {
+					printf("[ERROR] bad instruction count '%s'\n", argv[i] + 15);
+					return 1;
+				}
+			}
+		} else if (strncmp(argv[i], "--label-every=", 14) == 0) {
+			config.labelEvery = strtoul(argv[i] + 14, NULL, 10);
+		} else if (strncmp(argv[i], "--defs=", 7) == 0) {
+			config.defs = strtoul(argv[i] + 7, NULL, 10);
+		} else if (strncmp(argv[i], "--string-size=", 14) == 0) {
+			config.stringSize = strtoul(argv[i] + 14, NULL, 10);
+		} else if (strncmp(argv[i], "--comments=", 11) == 0) {
+			config.commentPercent = strtoul(argv[i] + 11, NULL, 10);
+		} else if (strncmp(argv[i], "--seed=", 7) == 0) {
+			config.seed = strtoull(argv[i] + 7, NULL, 10);
+		} else if (strncmp(argv[i], "--repeat=", 9) == 0) {
+			repeat = strtoul(argv[i] + 9, NULL, 10);
+		} else if (strcmp(argv[i], "--emit") == 0) {
+			// only write the source of the first size
+			emit = TRUE;
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			outputName = argv[++i];
+		} else if (strcmp(argv[i], "-O") == 0) {
+			options.foldIdenticalCode = TRUE;
+			options.foldConstants = TRUE;
+			options.optimizeData = TRUE;
+		} else if (strcmp(argv[i], "--encoding=compact") == 0) {
+			options.encoding = CCA_ENCODING_COMPACT;
+		} else if (strcmp(argv[i], "--encoding=wide") == 0) {
+			options.encoding = CCA_ENCODING_WIDE;
+		} else if (strcmp(argv[i], "--encoding=standard") == 0) {
+			options.encoding = CCA_ENCODING_STANDARD;
+		} else {
+			puts("usage: cca-bench [--instructions=N,...] [--label-every=N] [--defs=N] [--string-size=N] [--comments=PERCENT]");
+			puts("                 [--seed=N] [--repeat=N] [-O] [--encoding=standard|compact|wide] [--emit] [-o file]");
+			return 1;
+		}
+	}
+
+	if (sizeCount == 0 || repeat == 0) {
+		puts("[ERROR] nothing to run");
+		return 1;
+	}
+
+	FILE* output = outputName != NULL ? fopen(outputName, "w") : stdout;
+	if (output == NULL) {
+		printf("[ERROR] can't write '%s'\n", outputName);
+		return 1;
+	}
+
+	if (emit) {
+		config.instructions = sizes[0];
+		cca_file_content source = cca_bench_generate(&config);
+		fwrite(source.content, 1, source.fileSize, output);
+		free(source.content);
+		if (output != stdout)
+			fclose(output);
+		return 0;
+	}
+
+	cca_bench_result results[CCA_BENCH_MAX_SIZES];
+	for (unsigned int i = 0; i < sizeCount; i++) {
+		config.instructions = sizes[i];
+		cca_file_content source = cca_bench_generate(&config);
+		cca_bench_result* result = &results[i];
+		result->instructions = sizes[i];
+		result->sourceSize = source.fileSize;
+
+		// the best of every phase, the others only add noise
+		for (unsigned int run = 0; run < repeat; run++) {
+			double seconds[CCA_BENCH_PHASES];
+			cca_bench_assemble(source, &options, seconds, &result->outputSize);
+			for (int phase = 0; phase < CCA_BENCH_PHASES; phase++) {
+				if (run == 0 || seconds[phase] < result->seconds[phase])
+					result->seconds[phase] = seconds[phase];
+			}
+		}
+
+		free(source.content);
+	}
+
+	fprintf(output, "{\n  \"benchmark\": \"cca-bench\",\n");
+	fprintf(output, "  \"config\": { \"seed\": %llu, \"label_every\": %u, \"defs\": %u, \"string_size\": %u, \"comment_percent\": %u, ",
+		config.seed, config.labelEvery, config.defs, config.stringSize, config.commentPercent);
+	fprintf(output, "\"encoding\": %d, \"optimized\": %s, \"repeat\": %u },\n", options.encoding, options.foldConstants ? "true" : "false", repeat);
+	fprintf(output, "  \"runs\": [\n");
+
+	for (unsigned int i = 0; i < sizeCount; i++) {
+		cca_bench_result* result = &results[i];
+		fprintf(output, "    {\n      \"instructions\": %llu,\n      \"source_bytes\": %u,\n      \"output_bytes\": %u,\n      \"phases\": {\n",
+			result->instructions, result->sourceSize, result->outputSize);
+		for (int phase = 0; phase < CCA_BENCH_PHASES; phase++)
+			cca_bench_json_phase(output, result, i > 0 && results[i - 1].instructions < result->instructions ? &results[i - 1] : NULL, phase);
+		fprintf(output, "      }\n    }%s\n", i + 1 < sizeCount ? "," : "");
+	}
+	fprintf(output, "  ]\n}\n");
+
+	// warnings go to stderr, stdout stays json
+	if (sizeCount >= 2) {
+		cca_bench_result* last = &results[sizeCount - 1];
+		cca_bench_result* before = &results[sizeCount - 2];
+		for (int phase = 0; phase < CCA_BENCH_PHASES; phase++) {
+			if (before->instructions >= last->instructions || before->seconds[phase] <= 0 || last->seconds[phase] < 0.01)
+				continue;
+
+			double exponent = log(last->seconds[phase] / before->seconds[phase]) / log((double) last->instructions / before->instructions);
+			if (exponent > 1.5)
+				fprintf(stderr, "[WARNING] %s grows like n^%.2f\n", cca_bench_phase_names[phase], exponent);
+		}
+	}
+
+	if (output != stdout)
+		fclose(output);
+	return 0;
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assembler.h"
+
+// turns code offsets into a label and source line, from the debug section of a container or a .ccmap. the
+// addresses come from the arguments, or one per line from stdin
+void ccb_addr2line(ccb_lines* lines, char* text) {
+	char* end;
+	unsigned long address = strtoul(text, &end, 0);
+	if (end == text) {
+		printf("%s ??\n", text);
+		return;
+	}
+
+	ccb_location location;
+	if (!ccb_lines_lookup(lines, address, &location)) {
+		printf("%lu ??\n", address);
+	} else if (location.label != NULL) {
+		printf("%lu %s+%lu %s:%u:%u\n", address, location.label, address - location.labelAddress, location.file,
+			location.line, location.column);
+	} else {
+		printf("%lu ? %s:%u:%u\n", address, location.file, location.line, location.column);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		puts("usage: ccb-addr2line file.ccb|file.ccmap [addresses...]");
+		return 1;
+	}
+
+	int fd = open(argv[1], O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) < 0 || info.st_size == 0) {
+		printf("[ERROR] can't read '%s'\n", argv[1]);
+		return 1;
+	}
+
+	unsigned char* bytes = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (bytes == MAP_FAILED) {
+		printf("[ERROR] can't map '%s'\n", argv[1]);
+		return 1;
+	}
+
+	ccb_lines lines;
+	ccb_image image;
+	if (!ccb_map_open(bytes, info.st_size, &lines)) {
+		if (!ccb_image_open(bytes, info.st_size, &image)) {
+			ccb_image_complain(argv[1], &image);
+			return 1;
+		}
+		if (image.debug == NULL || !ccb_lines_open(image.debug, image.debugSize, &lines)) {
+			printf("[ERROR] '%s' has no line table, assemble it with -g\n", argv[1]);
+			return 1;
+		}
+	}
+
+	// lots of lookups are written in one go
+	static char output[1 << 16];
+	setvbuf(stdout, output, _IOFBF, sizeof(output));
+
+	if (argc > 2) {
+		for (int i = 2; i < argc; i++)
+			ccb_addr2line(&lines, argv[i]);
+	} else {
+		char text[256];
+		while (fgets(text, sizeof(text), stdin) != NULL) {
+			text[strcspn(text, "\r\n")] = '\0';
+			ccb_addr2line(&lines, text);
+		}
+	}
+
+	fflush(stdout);
+	munmap(bytes, info.st_size);
+	return 0;
+}
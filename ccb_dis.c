@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assembler.h"
+#include "disassembler.h"
+
+double ccb_dis_seconds(struct timespec* start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+BOOL ccb_dis_ends_with(char* string, char* suffix) {
+	unsigned int length = strlen(string);
+	unsigned int suffixLength = strlen(suffix);
+	return length >= suffixLength && strcmp(string + length - suffixLength, suffix) == 0;
+}
+
+// where two byte ranges first differ, or -1
+long ccb_dis_difference(unsigned char* a, unsigned int aSize, unsigned char* b, unsigned int bSize) {
+	unsigned int size = aSize < bSize ? aSize : bSize;
+	for (unsigned int i = 0; i < size; i++) {
+		if (a[i] != b[i])
+			return i;
+	}
+
+	return aSize != bSize ? (long) size : -1;
+}
+
+// assembles a source, or takes an image as it is, disassembles it and assembles the disassembly again. the
+// data and code have to come out the same
+BOOL ccb_dis_roundtrip(char* fileName, cca_options* options, char flatEncoding, unsigned long long* disassembled, double* seconds) {
+	cca_file_content content = ccvm_program_load(fileName);
+	cca_bytecode original = cca_bytecode_create(100);
+
+	if (ccb_dis_ends_with(fileName, ".ccb")) {
+		cca_bytecode_add_bytes(&original, content.content, content.fileSize);
+	} else if (!cca_assemble_source(content, options, &original, NULL) || !cca_bytecode_materialize(&original)) {
+		printf("[ERROR] %s: doesn't assemble\n", fileName);
+		cca_bytecode_free(&original);
+		free(content.content);
+		return FALSE;
+	}
+
+	ccb_image image;
+	if (!ccb_image_open((unsigned char*) original.bytecode, original.bytecodeLength, &image)) {
+		ccb_image_complain(fileName, &image);
+		cca_bytecode_free(&original);
+		free(content.content);
+		return FALSE;
+	}
+	if (image.flat)
+		image.encoding = flatEncoding;
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ccb_writer writer = ccb_writer_create(NULL);
+	ccb_disassembly disassembly = ccb_disassemble(&image, &writer);
+	*seconds += ccb_dis_seconds(&start);
+	*disassembled += image.dataSize + image.codeSize;
+
+	BOOL ok = disassembly.complete;
+	if (!ok)
+		printf("[ERROR] %s: the image can't be written as source completely\n", fileName);
+
+	cca_options again = {0};
+	again.encoding = image.encoding;
+	again.fusions = disassembly.fusions;
+
+	// the lexer wants the source to end in a nul
+	ccb_write(&writer, "", 1);
+	cca_file_content source = { writer.length - 1, writer.buffer };
+	cca_bytecode reassembled = cca_bytecode_create(100);
+	ccb_image result;
+
+	if (ok && !cca_assemble_source(source, &again, &reassembled, NULL)) {
+		printf("[ERROR] %s: the disassembly doesn't assemble\n", fileName);
+		ok = FALSE;
+	} else if (ok && !ccb_image_open((unsigned char*) reassembled.bytecode, reassembled.bytecodeLength, &result)) {
+		printf("[ERROR] %s: the disassembly doesn't assemble to an image\n", fileName);
+		ok = FALSE;
+	}
+
+	if (ok) {
+		long data = ccb_dis_difference(image.data, image.dataSize, result.data, result.dataSize);
+		long code = ccb_dis_difference(image.code, image.codeSize, result.code, result.codeSize);
+
+		if (data >= 0) {
+			printf("[ERROR] %s: data differs at %ld\n", fileName, data);
+			ok = FALSE;
+		}
+		if (code >= 0) {
+			printf("[ERROR] %s: code differs at byte %ld\n", fileName, code);
+			ok = FALSE;
+		}
+		if (!image.flat && (image.flags != result.flags || image.maxStackDepth != result.maxStackDepth)) {
+			printf("[ERROR] %s: verification differs\n", fileName);
+			ok = FALSE;
+		}
+	}
+
+	if (ok)
+		printf("%s: %u instructions round trip\n", fileName, disassembly.instructionCount);
+
+	cca_bytecode_free(&reassembled);
+	free(writer.buffer);
+	cca_bytecode_free(&original);
+	free(content.content);
+	return ok;
+}
+
+int main(int argc, char* argv[]) {
+	cca_options options = {0};
+	char encoding = CCA_ENCODING_STANDARD;
+	char* outputName = NULL;
+	BOOL roundtrip = FALSE;
+	unsigned int fileCount = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--roundtrip") == 0) {
+			roundtrip = TRUE;
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			outputName = argv[++i];
+		} else if (strcmp(argv[i], "-O") == 0) {
+			// how sources are assembled for the round trip
+			options.foldIdenticalCode = TRUE;
+			options.foldConstants = TRUE;
+			options.optimizeData = TRUE;
+		} else if (strcmp(argv[i], "--icf") == 0) {
+			options.foldIdenticalCode = TRUE;
+		} else if (strcmp(argv[i], "--fold-constants") == 0) {
+			options.foldConstants = TRUE;
+		} else if (strcmp(argv[i], "--optimize-data") == 0) {
+			options.optimizeData = TRUE;
+		} else if (strncmp(argv[i], "--fuse=", 7) == 0) {
+			if (!cca_fusion_parse(argv[i] + 7, &options.fusions))
+				return 1;
+		} else if (strcmp(argv[i], "--encoding=compact") == 0) {
+			// for sources and flat images, which don't say how they were encoded
+			encoding = CCA_ENCODING_COMPACT;
+		} else if (strcmp(argv[i], "--encoding=wide") == 0) {
+			encoding = CCA_ENCODING_WIDE;
+		} else if (strcmp(argv[i], "--encoding=standard") == 0) {
+			encoding = CCA_ENCODING_STANDARD;
+		} else {
+			argv[++fileCount] = argv[i];
+		}
+	}
+	options.encoding = encoding;
+
+	if (fileCount == 0) {
+		puts("usage: ccb-dis [-o file.asm] [--encoding=standard|compact|wide] file.ccb");
+		puts("       ccb-dis --roundtrip [-O] [--icf] [--fold-constants] [--optimize-data] [--fuse=...] [--encoding=...] files...");
+		return 1;
+	}
+
+	if (roundtrip) {
+		unsigned long long disassembled = 0;
+		double seconds = 0;
+		unsigned int failed = 0;
+
+		for (unsigned int i = 1; i <= fileCount; i++) {
+			if (!ccb_dis_roundtrip(argv[i], &options, encoding, &disassembled, &seconds))
+				++failed;
+		}
+
+		printf("%u of %u files round trip, disassembled %.2f MB at %.1f MB/s\n", fileCount - failed, fileCount,
+			disassembled / 1e6, seconds > 0 ? disassembled / 1e6 / seconds : 0.0);
+		return failed != 0;
+	}
+
+	int fd = open(argv[1], O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) < 0 || info.st_size == 0) {
+		printf("[ERROR] can't read '%s'\n", argv[1]);
+		return 1;
+	}
+
+	unsigned char* bytes = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (bytes == MAP_FAILED) {
+		printf("[ERROR] can't map '%s'\n", argv[1]);
+		return 1;
+	}
+	madvise(bytes, info.st_size, MADV_SEQUENTIAL);
+
+	ccb_image image;
+	if (!ccb_image_open(bytes, info.st_size, &image)) {
+		ccb_image_complain(argv[1], &image);
+		return 1;
+	}
+	if (image.flat)
+		image.encoding = encoding;
+
+	FILE* output = outputName != NULL ? fopen(outputName, "wb") : stdout;
+	if (output == NULL) {
+		printf("[ERROR] can't write '%s'\n", outputName);
+		return 1;
+	}
+
+	ccb_writer writer = ccb_writer_create(output);
+	ccb_disassembly disassembly = ccb_disassemble(&image, &writer);
+	ccb_writer_free(&writer);
+
+	if (output != stdout)
+		fclose(output);
+	munmap(bytes, info.st_size);
+	return disassembly.complete ? 0 : 1;
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assembler.h"
+
+// ranks the instruction sequences in a set of images by how often they appear, to find candidates for fusion.
+// sequences never cross into another block, nothing can jump into the middle of them
+#define CCB_PAIRS_DESCRIPTION 128
+
+typedef struct ccb_sequence {
+	char* description;
+	unsigned long long count;
+} ccb_sequence;
+
+typedef struct ccb_sequence_list {
+	cca_symbol_table table;
+	ccb_sequence* sequences;
+	unsigned int length;
+	unsigned int capacity;
+	unsigned long long total;
+} ccb_sequence_list;
+
+void ccb_describe(cca_instruction* instruction, char* description) {
+	cca_opcode_info* info = &cca_opcodes[instruction->opcode];
+	int length = sprintf(description, "%s", info->mnemonic != NULL ? info->mnemonic : "?");
+
+	for (int i = 0; i < info->operandCount; i++) {
+		char* kind;
+		switch (info->operands[i]) {
+			case CCA_OPERAND_REGISTER: kind = "reg"; break;
+			case CCA_OPERAND_NUMBER: kind = "num"; break;
+			case CCA_OPERAND_ADDRESS: kind = "addr"; break;
+			default: kind = "label"; break;
+		}
+
+		length += sprintf(description + length, "%s%s", i == 0 ? " " : ", ", kind);
+	}
+}
+
+void ccb_sequence_count(ccb_sequence_list* list, char* description) {
+	unsigned int index = cca_symbol_table_find(&list->table, description);
+
+	if (index == CCA_SYMBOL_MISSING) {
+		if (list->length >= list->capacity) {
+			list->capacity *= 2;
+			list->sequences = realloc(list->sequences, list->capacity * sizeof(ccb_sequence));
+		}
+
+		index = list->length++;
+		list->sequences[index].description = strdup(description);
+		list->sequences[index].count = 0;
+		cca_symbol_table_insert(&list->table, list->sequences[index].description, index);
+	}
+
+	++list->sequences[index].count;
+	++list->total;
+}
+
+int ccb_sequence_compare(const void* a, const void* b) {
+	ccb_sequence* x = (ccb_sequence*) a;
+	ccb_sequence* y = (ccb_sequence*) b;
+
+	if (x->count != y->count)
+		return x->count > y->count ? -1 : 1;
+	return strcmp(x->description, y->description);
+}
+
+BOOL ccb_pairs_file(char* fileName, char encoding, unsigned int sequenceLength, ccb_sequence_list* list) {
+	cca_file_content content = ccvm_program_load(fileName);
+	ccb_image image;
+
+	if (!ccb_image_open((unsigned char*) content.content, content.fileSize, &image)) {
+		ccb_image_complain(fileName, &image);
+		free(content.content);
+		return FALSE;
+	}
+	if (image.flat)
+		image.encoding = encoding;
+
+	// a sequence restarts at every symbol and after every instruction that ends a block
+	unsigned int units = image.encoding == CCA_ENCODING_WIDE ? image.codeSize / CCA_WIDE_WORD : image.codeSize;
+	BOOL* leaders = calloc(units + 1, sizeof(BOOL));
+
+	if (image.symbols != NULL && image.symbolsSize >= 4) {
+		unsigned int symbolCount = cca_read_le(image.symbols);
+		for (unsigned int i = 0; i < symbolCount && 4 + (i + 1) * sizeof(ccb_symbol) <= image.symbolsSize; i++) {
+			unsigned int offset = cca_read_le(image.symbols + 4 + i * sizeof(ccb_symbol));
+			if (offset <= units)
+				leaders[offset] = TRUE;
+		}
+	}
+
+	char descriptions[3][CCB_PAIRS_DESCRIPTION];
+	unsigned int windowLength = 0;
+
+	for (unsigned int offset = 0; offset < units;) {
+		if (leaders[offset])
+			windowLength = 0;
+
+		cca_instruction instruction;
+		unsigned int size = cca_decode_instruction(image.code, image.codeSize, image.encoding, offset, &instruction);
+		if (size == 0) {
+			printf("[WARNING] '%s' can't decode the instruction at %u, skipping the rest\n", fileName, offset);
+			break;
+		}
+
+		// slide the window along
+		if (windowLength == sequenceLength) {
+			memmove(descriptions[0], descriptions[1], (sequenceLength - 1) * CCB_PAIRS_DESCRIPTION);
+			--windowLength;
+		}
+		ccb_describe(&instruction, descriptions[windowLength]);
+		++windowLength;
+
+		if (windowLength == sequenceLength) {
+			char description[3 * CCB_PAIRS_DESCRIPTION + 8] = "";
+			for (unsigned int i = 0; i < sequenceLength; i++) {
+				if (i > 0)
+					strcat(description, " ; ");
+				strcat(description, descriptions[i]);
+			}
+			ccb_sequence_count(list, description);
+		}
+
+		if (cca_opcode_ends_block(instruction.opcode))
+			windowLength = 0;
+		offset += size;
+	}
+
+	free(leaders);
+	free(content.content);
+	return TRUE;
+}
+
+int main(int argc, char* argv[]) {
+	char encoding = CCA_ENCODING_STANDARD;
+	unsigned int sequenceLength = 2;
+	unsigned int top = 20;
+	unsigned int fileCount = 0;
+
+	ccb_sequence_list list = {0};
+	list.table = cca_symbol_table_create(64);
+	list.capacity = 64;
+	list.sequences = malloc(list.capacity * sizeof(ccb_sequence));
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--length=2") == 0) {
+			sequenceLength = 2;
+		} else if (strcmp(argv[i], "--length=3") == 0) {
+			sequenceLength = 3;
+		} else if (strncmp(argv[i], "--top=", 6) == 0) {
+			top = atoi(argv[i] + 6);
+		} else if (strcmp(argv[i], "--encoding=compact") == 0) {
+			// flat images don't say how they were encoded
+			encoding = CCA_ENCODING_COMPACT;
+		} else if (strcmp(argv[i], "--encoding=wide") == 0) {
+			encoding = CCA_ENCODING_WIDE;
+		} else if (strcmp(argv[i], "--encoding=standard") == 0) {
+			encoding = CCA_ENCODING_STANDARD;
+		}
+	}
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--", 2) == 0)
+			continue;
+
+		if (!ccb_pairs_file(argv[i], encoding, sequenceLength, &list))
+			return 1;
+		++fileCount;
+	}
+
+	if (fileCount == 0) {
+		puts("usage: ccb-pairs [--length=2|3] [--top=N] [--encoding=standard|compact|wide] files.ccb...");
+		return 1;
+	}
+
+	qsort(list.sequences, list.length, sizeof(ccb_sequence), ccb_sequence_compare);
+
+	printf("%llu sequences of %u instructions in %u files, %u distinct\n", list.total, sequenceLength, fileCount, list.length);
+	for (unsigned int i = 0; i < list.length && i < top; i++) {
+		printf("%10llu %6.2f%%  %s\n", list.sequences[i].count, 100.0 * list.sequences[i].count / list.total,
+			list.sequences[i].description);
+	}
+
+	for (unsigned int i = 0; i < list.length; i++)
+		free(list.sequences[i].description);
+	free(list.sequences);
+	cca_symbol_table_free(&list.table);
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assembler.h"
+#include "interpreter.h"
+
+int main(int argc, char* argv[]) {
+	char* fileName = NULL;
+	char encoding = CCA_ENCODING_STANDARD;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--encoding=compact") == 0) {
+			// flat images don't say how they were encoded
+			encoding = CCA_ENCODING_COMPACT;
+		} else if (strcmp(argv[i], "--encoding=wide") == 0) {
+			encoding = CCA_ENCODING_WIDE;
+		} else if (strcmp(argv[i], "--encoding=standard") == 0) {
+			encoding = CCA_ENCODING_STANDARD;
+		} else {
+			fileName = argv[i];
+		}
+	}
+
+	if (fileName == NULL) {
+		puts("usage: ccvm-run [--encoding=standard|compact|wide] file.ccb");
+		return 1;
+	}
+
+	int fd = open(fileName, O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) < 0 || info.st_size == 0) {
+		printf("[ERROR] can't read '%s'\n", fileName);
+		return 1;
+	}
+
+	unsigned char* bytes = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (bytes == MAP_FAILED) {
+		printf("[ERROR] can't map '%s'\n", fileName);
+		return 1;
+	}
+
+	ccb_image image;
+	ccvm_machine machine;
+	if (!ccb_image_open(bytes, info.st_size, &image)) {
+		ccb_image_complain(fileName, &image);
+		return 1;
+	}
+	if (image.flat)
+		image.encoding = encoding;
+
+	if (!ccvm_load(&machine, &image)) {
+		puts("failed to load due to errors");
+		return 1;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	BOOL ok = ccvm_run(&machine);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double nanoseconds = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	printf("executed %llu instructions in %.3f ms, %.2f ns/instruction%s\n", machine.executed, nanoseconds / 1e6,
+		machine.executed != 0 ? nanoseconds / machine.executed : 0.0, machine.trusted ? " (verified)" : "");
+
+	// where it went wrong, when the image has a line table
+	ccb_lines lines;
+	ccb_location location;
+	if (!ok && image.debug != NULL && ccb_lines_open(image.debug, image.debugSize, &lines)
+		&& ccb_lines_lookup(&lines, machine.errorOffset, &location)) {
+		printf("[ERROR] at %s+%u, line %u column %u of %s\n", location.label != NULL ? location.label : "?",
+			machine.errorOffset - location.labelAddress, location.line, location.column, location.file);
+	}
+
+	unsigned int exitCode = machine.exitCode;
+	ccvm_free(&machine);
+	munmap(bytes, info.st_size);
+	return ok ? exitCode : 1;
+}
@@ -0,0 +1,574 @@
+#ifndef ccvm_assembler_container
+#define ccvm_assembler_container
+
+// .ccb container format
+//
+// a fixed 64 byte header, a table of sections right after it and the sections themselves. data and code start on
+// their own page so a vm can map the file and run the code where it is, the other sections are aligned to cache
+// lines. header and section table are little endian, the code keeps the encoding it was assembled with.
+//
+// the flat format is the header data, the marker 0x1d1d1d1d and the code, without anything else
+//
+// version 2 put the file of every line in the line table, version 3 marks the opcode table with jmp at 0x38 instead
+// of the 0x20 it shared with 'and reg, reg'. readers take their own version only and tell an older image apart from
+// a broken one, so it gets assembled again instead of run with the wrong code
+#define CCB_MAGIC 0x1d424343
+#define CCB_VERSION 3
+#define CCB_FLAT_MARKER 0x1d1d1d1d
+
+#define CCB_SECTION_DATA 1
+#define CCB_SECTION_CODE 2
+#define CCB_SECTION_SYMBOLS 3
+#define CCB_SECTION_DEBUG 4
+#define CCB_SECTION_BLOCKS 5
+
+#define CCB_FLAG_VERIFIED 0x01
+
+#define CCB_PAGE_ALIGNMENT 4096
+#define CCB_CACHE_LINE_ALIGNMENT 64
+
+typedef struct ccb_header {
+	unsigned int magic;
+	unsigned short version;
+	unsigned char encoding;
+	unsigned char flags;
+	unsigned int entry;
+	unsigned int sectionCount;
+	unsigned int sectionTable;
+	unsigned int maxStackDepth;
+	unsigned char reserved[40];
+} ccb_header;
+
+typedef struct ccb_section {
+	unsigned int type;
+	unsigned int alignment;
+	unsigned int offset;
+	unsigned int size;
+} ccb_section;
+
+// the symbols section is a count, that many entries sorted by offset and the names they point at
+typedef struct ccb_symbol {
+	unsigned int offset;
+	unsigned int name;
+} ccb_symbol;
+
+// the blocks section is a block count and a target count, the blocks sorted by offset with how many instructions
+// they have and then the sorted offsets jumps and calls can go to
+typedef struct ccb_block {
+	unsigned int offset;
+	unsigned int instructionCount;
+} ccb_block;
+
+// the debug section is a line table. a header with the number of entries, groups and labels, where the stream
+// starts, how long it is and how many source files there are, then the groups, the labels sorted by address,
+// where the names of the files are, the stream and the names. every group of CCB_LINES_GROUP entries holds its
+// first entry in full and where the others start in the stream, which has the address delta, line delta, column
+// and file of each as leb128. an address belongs to the last entry and label at or before it. written on its own
+// with CCB_MAP_MAGIC in front it's a .ccmap
+#define CCB_LINES_GROUP 16
+#define CCB_MAP_MAGIC 0x1d4d4343
+#define CCB_MAP_VERSION 2
+
+typedef struct ccb_line_group {
+	unsigned int address;
+	unsigned int line;
+	unsigned int column;
+	unsigned int file;
+	unsigned int stream;
+} ccb_line_group;
+
+typedef struct ccb_lines {
+	unsigned char* section;
+	unsigned int size;
+	unsigned int entryCount;
+	unsigned int groupCount;
+	unsigned int labelCount;
+	unsigned char* groups;
+	unsigned char* labels;
+	unsigned char* stream;
+	unsigned int streamSize;
+	unsigned char* files;
+	unsigned int fileCount;
+} ccb_lines;
+
+typedef struct ccb_location {
+	char* label;
+	unsigned int labelAddress;
+	char* file;
+	unsigned int line;
+	unsigned int column;
+} ccb_location;
+
+// names have to end inside the section
+char* ccb_lines_name(ccb_lines* lines, unsigned int offset) {
+	if (offset >= lines->size || memchr(lines->section + offset, '\0', lines->size - offset) == NULL)
+		return NULL;
+	return (char*) lines->section + offset;
+}
+
+BOOL ccb_lines_open(unsigned char* section, unsigned int size, ccb_lines* lines) {
+	memset(lines, 0, sizeof(ccb_lines));
+	if (size < 24)
+		return FALSE;
+
+	lines->section = section;
+	lines->size = size;
+	lines->entryCount = cca_read_le(section);
+	lines->groupCount = cca_read_le(section + 4);
+	lines->labelCount = cca_read_le(section + 8);
+	unsigned int stream = cca_read_le(section + 12);
+	lines->streamSize = cca_read_le(section + 16);
+	lines->fileCount = cca_read_le(section + 20);
+
+	unsigned long long tables = 24 + (unsigned long long) lines->groupCount * sizeof(ccb_line_group)
+		+ (unsigned long long) lines->labelCount * sizeof(ccb_symbol) + (unsigned long long) lines->fileCount * 4;
+	if (tables > size || stream > size || lines->streamSize > size - stream)
+		return FALSE;
+	if (lines->groupCount != (lines->entryCount + CCB_LINES_GROUP - 1) / CCB_LINES_GROUP)
+		return FALSE;
+
+	lines->groups = section + 24;
+	lines->labels = lines->groups + lines->groupCount * sizeof(ccb_line_group);
+	lines->files = lines->labels + lines->labelCount * sizeof(ccb_symbol);
+	lines->stream = section + stream;
+	return TRUE;
+}
+
+// the name of a file of the table, ? when there is none
+char* ccb_lines_file(ccb_lines* lines, unsigned int file) {
+	char* name = file < lines->fileCount ? ccb_lines_name(lines, cca_read_le(lines->files + file * 4)) : NULL;
+	return name != NULL ? name : "?";
+}
+
+// a .ccmap written next to a flat image
+BOOL ccb_map_open(unsigned char* bytes, unsigned int size, ccb_lines* lines) {
+	if (size < 8 || cca_read_le(bytes) != CCB_MAP_MAGIC || cca_read_le(bytes + 4) != CCB_MAP_VERSION)
+		return FALSE;
+	return ccb_lines_open(bytes + 8, size - 8, lines);
+}
+
+unsigned int ccb_read_uleb(unsigned char** bytes, unsigned char* end) {
+	unsigned int value = 0;
+	for (int shift = 0; *bytes < end && shift < 35; shift += 7) {
+		unsigned char byte = *(*bytes)++;
+		value |= (unsigned int) (byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			break;
+	}
+	return value;
+}
+
+int ccb_read_sleb(unsigned char** bytes, unsigned char* end) {
+	unsigned int value = 0;
+	int shift = 0;
+	unsigned char byte = 0;
+	while (*bytes < end && shift < 35) {
+		byte = *(*bytes)++;
+		value |= (unsigned int) (byte & 0x7f) << shift;
+		shift += 7;
+		if (!(byte & 0x80))
+			break;
+	}
+	if (shift < 32 && (byte & 0x40))
+		value |= ~0u << shift;
+	return (int) value;
+}
+
+// finds the line and label of an address, FALSE if it's before everything in the table
+BOOL ccb_lines_lookup(ccb_lines* lines, unsigned int address, ccb_location* location) {
+	memset(location, 0, sizeof(ccb_location));
+	if (lines->groupCount == 0 || cca_read_le(lines->groups) > address)
+		return FALSE;
+
+	// the last group starting at or before the address
+	unsigned int low = 0;
+	unsigned int high = lines->groupCount;
+	while (high - low > 1) {
+		unsigned int middle = low + (high - low) / 2;
+		if (cca_read_le(lines->groups + middle * sizeof(ccb_line_group)) <= address)
+			low = middle;
+		else
+			high = middle;
+	}
+
+	unsigned char* group = lines->groups + low * sizeof(ccb_line_group);
+	location->line = cca_read_le(group + 4);
+	location->column = cca_read_le(group + 8);
+	unsigned int file = cca_read_le(group + 12);
+
+	unsigned int entryAddress = cca_read_le(group);
+	unsigned int remaining = lines->entryCount - low * CCB_LINES_GROUP;
+	unsigned int stream = cca_read_le(group + 16);
+	unsigned char* end = lines->stream + lines->streamSize;
+	unsigned char* bytes = stream <= lines->streamSize ? lines->stream + stream : end;
+
+	for (unsigned int i = 1; i < remaining && i < CCB_LINES_GROUP && bytes < end; i++) {
+		unsigned int next = entryAddress + ccb_read_uleb(&bytes, end);
+		if (next > address)
+			break;
+
+		entryAddress = next;
+		location->line += ccb_read_sleb(&bytes, end);
+		location->column = ccb_read_uleb(&bytes, end);
+		file = ccb_read_uleb(&bytes, end);
+	}
+	location->file = ccb_lines_file(lines, file);
+
+	// the last label at or before the address
+	low = 0;
+	high = lines->labelCount;
+	while (low < high) {
+		unsigned int middle = low + (high - low) / 2;
+		if (cca_read_le(lines->labels + middle * sizeof(ccb_symbol)) <= address)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	if (low > 0) {
+		unsigned char* label = lines->labels + (low - 1) * sizeof(ccb_symbol);
+		location->labelAddress = cca_read_le(label);
+		location->label = ccb_lines_name(lines, cca_read_le(label + 4));
+	}
+
+	return TRUE;
+}
+
+// an image opened from either format, pointing into the bytes it was opened from
+typedef struct ccb_image {
+	BOOL flat;
+	// of a container, also when it didn't open
+	unsigned short version;
+	unsigned char encoding;
+	unsigned char flags;
+	unsigned int entry;
+	unsigned int maxStackDepth;
+
+	unsigned char* data;
+	unsigned int dataSize;
+	unsigned char* code;
+	unsigned int codeSize;
+	unsigned char* symbols;
+	unsigned int symbolsSize;
+	unsigned char* debug;
+	unsigned int debugSize;
+	unsigned char* blocks;
+	unsigned int blocksSize;
+} ccb_image;
+
+BOOL ccb_image_open(unsigned char* bytes, unsigned int size, ccb_image* image) {
+	memset(image, 0, sizeof(ccb_image));
+
+	if (size >= sizeof(ccb_header) && cca_read_le(bytes) == CCB_MAGIC) {
+		unsigned int sectionCount = cca_read_le(bytes + 12);
+		unsigned int sectionTable = cca_read_le(bytes + 16);
+
+		image->version = bytes[4] | (bytes[5] << 8);
+		if (image->version != CCB_VERSION || sectionTable + sectionCount * sizeof(ccb_section) > size)
+			return FALSE;
+
+		image->encoding = bytes[6];
+		image->flags = bytes[7];
+		image->entry = cca_read_le(bytes + 8);
+		image->maxStackDepth = cca_read_le(bytes + 20);
+
+		for (unsigned int i = 0; i < sectionCount; i++) {
+			unsigned char* section = bytes + sectionTable + i * sizeof(ccb_section);
+			unsigned int offset = cca_read_le(section + 8);
+			unsigned int length = cca_read_le(section + 12);
+
+			if (offset > size || length > size - offset)
+				return FALSE;
+
+			switch (cca_read_le(section)) {
+				case CCB_SECTION_DATA: image->data = bytes + offset; image->dataSize = length; break;
+				case CCB_SECTION_CODE: image->code = bytes + offset; image->codeSize = length; break;
+				case CCB_SECTION_SYMBOLS: image->symbols = bytes + offset; image->symbolsSize = length; break;
+				case CCB_SECTION_DEBUG: image->debug = bytes + offset; image->debugSize = length; break;
+				case CCB_SECTION_BLOCKS: image->blocks = bytes + offset; image->blocksSize = length; break;
+			}
+		}
+
+		return image->code != NULL;
+	}
+
+	// flat images have to be scanned for the marker
+	for (unsigned int i = 0; i + 4 <= size; i++) {
+		if (bytes[i] == 0x1d && bytes[i + 1] == 0x1d && bytes[i + 2] == 0x1d && bytes[i + 3] == 0x1d) {
+			image->flat = TRUE;
+			image->data = bytes;
+			image->dataSize = i;
+			image->code = bytes + i + 4;
+			image->codeSize = size - i - 4;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+// why an image didn't open
+void ccb_image_complain(char* fileName, ccb_image* image) {
+	if (image->version != 0 && image->version != CCB_VERSION)
+		printf("[ERROR] '%s' is version %u of the format and this reads version %u, assemble it again\n", fileName, image->version, CCB_VERSION);
+	else
+		printf("[ERROR] '%s' is not a ccb image\n", fileName);
+}
+
+// writing containers, sections are added in the order they should appear in the file
+#define CCA_CONTAINER_MAX_SECTIONS 8
+
+typedef struct cca_container {
+	ccb_section sections[CCA_CONTAINER_MAX_SECTIONS];
+	cca_bytecode* contents[CCA_CONTAINER_MAX_SECTIONS];
+	unsigned int sectionCount;
+
+	unsigned char encoding;
+	unsigned char flags;
+	unsigned int entry;
+	unsigned int maxStackDepth;
+} cca_container;
+
+void cca_container_add(cca_container* container, unsigned int type, unsigned int alignment, cca_bytecode* contents) {
+	ccb_section section = {
+		.type = type,
+		.alignment = alignment,
+		.offset = 0,
+		.size = cca_bytecode_size(contents)
+	};
+
+	container->sections[container->sectionCount] = section;
+	container->contents[container->sectionCount] = contents;
+	++container->sectionCount;
+}
+
+void cca_bytecode_add_bytes(cca_bytecode* bytecode, char* bytes, unsigned int length) {
+	for (unsigned int i = 0; i < length; i++)
+		cca_bytecode_add_byte(bytecode, bytes[i]);
+}
+
+void cca_bytecode_align(cca_bytecode* bytecode, unsigned int alignment) {
+	for (unsigned int size = cca_bytecode_size(bytecode); size % alignment != 0; size++)
+		cca_bytecode_add_byte(bytecode, 0);
+}
+
+void cca_container_write(cca_container* container, cca_bytecode* bytecode) {
+	unsigned int offset = sizeof(ccb_header) + container->sectionCount * sizeof(ccb_section);
+	for (unsigned int i = 0; i < container->sectionCount; i++) {
+		offset = (offset + container->sections[i].alignment - 1) / container->sections[i].alignment * container->sections[i].alignment;
+		container->sections[i].offset = offset;
+		offset += container->sections[i].size;
+	}
+
+	cca_bytecode_add_uint_le(bytecode, CCB_MAGIC);
+	cca_bytecode_add_byte(bytecode, CCB_VERSION & 0xff);
+	cca_bytecode_add_byte(bytecode, CCB_VERSION >> 8);
+	cca_bytecode_add_byte(bytecode, container->encoding);
+	cca_bytecode_add_byte(bytecode, container->flags);
+	cca_bytecode_add_uint_le(bytecode, container->entry);
+	cca_bytecode_add_uint_le(bytecode, container->sectionCount);
+	cca_bytecode_add_uint_le(bytecode, sizeof(ccb_header));
+	cca_bytecode_add_uint_le(bytecode, container->maxStackDepth);
+	while (bytecode->bytecodeLength < sizeof(ccb_header))
+		cca_bytecode_add_byte(bytecode, 0);
+
+	for (unsigned int i = 0; i < container->sectionCount; i++) {
+		cca_bytecode_add_uint_le(bytecode, container->sections[i].type);
+		cca_bytecode_add_uint_le(bytecode, container->sections[i].alignment);
+		cca_bytecode_add_uint_le(bytecode, container->sections[i].offset);
+		cca_bytecode_add_uint_le(bytecode, container->sections[i].size);
+	}
+
+	for (unsigned int i = 0; i < container->sectionCount; i++) {
+		cca_bytecode_align(bytecode, container->sections[i].alignment);
+		cca_bytecode_append(bytecode, container->contents[i]);
+	}
+}
+
+int cca_marker_compare_offset(const void* a, const void* b) {
+	cca_marker* x = (cca_marker*) a;
+	cca_marker* y = (cca_marker*) b;
+
+	if (x->marks != y->marks)
+		return x->marks < y->marks ? -1 : 1;
+	return strcmp(x->name, y->name);
+}
+
+// symbols section of a laid out program
+void cca_container_symbols(cca_program* program, cca_bytecode* bytecode) {
+	cca_marker* markers = malloc((program->markerCount + 1) * sizeof(cca_marker));
+	memcpy(markers, program->markers, program->markerCount * sizeof(cca_marker));
+	qsort(markers, program->markerCount, sizeof(cca_marker), cca_marker_compare_offset);
+
+	unsigned int name = 4 + program->markerCount * sizeof(ccb_symbol);
+	cca_bytecode_add_uint_le(bytecode, program->markerCount);
+	for (unsigned int i = 0; i < program->markerCount; i++) {
+		cca_bytecode_add_uint_le(bytecode, markers[i].marks);
+		cca_bytecode_add_uint_le(bytecode, name);
+		name += strlen(markers[i].name) + 1;
+	}
+
+	for (unsigned int i = 0; i < program->markerCount; i++)
+		cca_bytecode_add_bytes(bytecode, markers[i].name, strlen(markers[i].name) + 1);
+
+	free(markers);
+}
+
+void cca_bytecode_add_uleb(cca_bytecode* bytecode, unsigned int n) {
+	do {
+		unsigned char byte = n & 0x7f;
+		n >>= 7;
+		cca_bytecode_add_byte(bytecode, n != 0 ? byte | 0x80 : byte);
+	} while (n != 0);
+}
+
+void cca_bytecode_add_sleb(cca_bytecode* bytecode, int n) {
+	while (TRUE) {
+		unsigned char byte = n & 0x7f;
+		n >>= 7;
+		if ((n == 0 && !(byte & 0x40)) || (n == -1 && (byte & 0x40))) {
+			cca_bytecode_add_byte(bytecode, byte);
+			return;
+		}
+		cca_bytecode_add_byte(bytecode, byte | 0x80);
+	}
+}
+
+// line table of a laid out program
+void cca_container_lines(cca_program* program, char* sourceName, cca_bytecode* bytecode) {
+	// an entry wherever the source position changes, spill code and the like fall under the one before
+	unsigned int* entries = malloc((program->instructionCount + 1) * sizeof(unsigned int));
+	unsigned int entryCount = 0;
+	for (unsigned int i = 0; i < program->instructionCount; i++) {
+		cca_instruction* instruction = &program->instructions[i];
+		cca_instruction* previous = entryCount > 0 ? &program->instructions[entries[entryCount - 1]] : NULL;
+		if (previous == NULL || previous->file != instruction->file || previous->line != instruction->line
+			|| previous->column != instruction->column)
+			entries[entryCount++] = i;
+	}
+
+	// the files that have code in the table, numbered in the order they show up
+	unsigned int* files = malloc((entryCount + 1) * sizeof(unsigned int));
+	unsigned int* entryFiles = malloc((entryCount + 1) * sizeof(unsigned int));
+	unsigned int fileCount = 0;
+	for (unsigned int i = 0; i < entryCount; i++) {
+		unsigned int file = program->instructions[entries[i]].file;
+		unsigned int index = 0;
+		while (index < fileCount && files[index] != file)
+			++index;
+		if (index == fileCount)
+			files[fileCount++] = file;
+		entryFiles[i] = index;
+	}
+
+	cca_marker* markers = malloc((program->markerCount + 1) * sizeof(cca_marker));
+	memcpy(markers, program->markers, program->markerCount * sizeof(cca_marker));
+	qsort(markers, program->markerCount, sizeof(cca_marker), cca_marker_compare_offset);
+
+	cca_bytecode stream = cca_bytecode_create(100);
+	unsigned int groupCount = (entryCount + CCB_LINES_GROUP - 1) / CCB_LINES_GROUP;
+	unsigned int* groupStreams = malloc((groupCount + 1) * sizeof(unsigned int));
+	for (unsigned int i = 0; i < entryCount; i++) {
+		cca_instruction* instruction = &program->instructions[entries[i]];
+		if (i % CCB_LINES_GROUP == 0) {
+			groupStreams[i / CCB_LINES_GROUP] = stream.bytecodeLength;
+			continue;
+		}
+
+		cca_instruction* previous = &program->instructions[entries[i - 1]];
+		cca_bytecode_add_uleb(&stream, instruction->offset - previous->offset);
+		cca_bytecode_add_sleb(&stream, (int) (instruction->line - previous->line));
+		cca_bytecode_add_uleb(&stream, instruction->column);
+		cca_bytecode_add_uleb(&stream, entryFiles[i]);
+	}
+
+	unsigned int streamOffset = 24 + groupCount * sizeof(ccb_line_group) + program->markerCount * sizeof(ccb_symbol) + fileCount * 4;
+	unsigned int name = streamOffset + stream.bytecodeLength;
+
+	cca_bytecode_add_uint_le(bytecode, entryCount);
+	cca_bytecode_add_uint_le(bytecode, groupCount);
+	cca_bytecode_add_uint_le(bytecode, program->markerCount);
+	cca_bytecode_add_uint_le(bytecode, streamOffset);
+	cca_bytecode_add_uint_le(bytecode, stream.bytecodeLength);
+	cca_bytecode_add_uint_le(bytecode, fileCount);
+
+	for (unsigned int g = 0; g < groupCount; g++) {
+		cca_instruction* first = &program->instructions[entries[g * CCB_LINES_GROUP]];
+		cca_bytecode_add_uint_le(bytecode, first->offset);
+		cca_bytecode_add_uint_le(bytecode, first->line);
+		cca_bytecode_add_uint_le(bytecode, first->column);
+		cca_bytecode_add_uint_le(bytecode, entryFiles[g * CCB_LINES_GROUP]);
+		cca_bytecode_add_uint_le(bytecode, groupStreams[g]);
+	}
+
+	for (unsigned int i = 0; i < program->markerCount; i++) {
+		cca_bytecode_add_uint_le(bytecode, markers[i].marks);
+		cca_bytecode_add_uint_le(bytecode, name);
+		name += strlen(markers[i].name) + 1;
+	}
+	for (unsigned int i = 0; i < fileCount; i++) {
+		cca_bytecode_add_uint_le(bytecode, name);
+		name += strlen(cca_source_file(files[i], sourceName)) + 1;
+	}
+
+	cca_bytecode_add_bytes(bytecode, stream.bytecode, stream.bytecodeLength);
+	for (unsigned int i = 0; i < program->markerCount; i++)
+		cca_bytecode_add_bytes(bytecode, markers[i].name, strlen(markers[i].name) + 1);
+	for (unsigned int i = 0; i < fileCount; i++) {
+		char* file = cca_source_file(files[i], sourceName);
+		cca_bytecode_add_bytes(bytecode, file, strlen(file) + 1);
+	}
+
+	free(entries);
+	free(files);
+	free(entryFiles);
+	free(markers);
+	free(stream.bytecode);
+	free(groupStreams);
+}
+
+int cca_uint_compare(const void* a, const void* b) {
+	unsigned int x = *(unsigned int*) a;
+	unsigned int y = *(unsigned int*) b;
+	return x < y ? -1 : x > y;
+}
+
+// blocks section of a laid out program
+void cca_container_blocks(cca_program* program, cca_bytecode* bytecode) {
+	cca_block_list list = cca_program_blocks(program);
+
+	unsigned int* targets = malloc((program->instructionCount + 1) * sizeof(unsigned int));
+	unsigned int targetCount = 0;
+	for (unsigned int i = 0; i < program->instructionCount; i++) {
+		int targetOperand = cca_opcode_target(program->instructions[i].opcode);
+		if (targetOperand < 0)
+			continue;
+
+		cca_operand* target = &program->instructions[i].operands[targetOperand];
+		if (target->type == CCA_OPERAND_MARKER)
+			targets[targetCount++] = program->markers[target->value].marks + target->offset;
+		else if (target->type == CCA_OPERAND_ADDRESS)
+			targets[targetCount++] = target->value;
+	}
+
+	qsort(targets, targetCount, sizeof(unsigned int), cca_uint_compare);
+
+	unsigned int uniqueCount = 0;
+	for (unsigned int i = 0; i < targetCount; i++) {
+		if (uniqueCount == 0 || targets[uniqueCount - 1] != targets[i])
+			targets[uniqueCount++] = targets[i];
+	}
+
+	cca_bytecode_add_uint_le(bytecode, list.length);
+	cca_bytecode_add_uint_le(bytecode, uniqueCount);
+	for (unsigned int i = 0; i < list.length; i++) {
+		cca_bytecode_add_uint_le(bytecode, program->instructions[list.blocks[i].start].offset);
+		cca_bytecode_add_uint_le(bytecode, list.blocks[i].end - list.blocks[i].start);
+	}
+	for (unsigned int i = 0; i < uniqueCount; i++)
+		cca_bytecode_add_uint_le(bytecode, targets[i]);
+
+	free(targets);
+	cca_block_list_free(&list);
+}
+
+#endif
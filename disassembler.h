@@ -0,0 +1,506 @@
+#ifndef ccvm_assembler_disassembler
+#define ccvm_assembler_disassembler
+
+// disassembler
+//
+// turns an image back into source the assembler takes. labels come back from the symbols section, branches to
+// places without a symbol get a label named after their offset. superinstructions are written as the sequence
+// they stand for, assembling that with the same fusions gives them back. data is written as defs that nothing
+// references, which an unoptimized assembly puts back in the same place
+#define CCB_DIS_FLUSH (1 << 20)
+#define CCB_DIS_DATA_NAME "__data"
+#define CCB_DIS_DATA_BYTES 32
+#define CCB_DIS_LABEL_NAME "L_"
+
+// output that goes to a file in large blocks, or stays in memory when there is no file
+typedef struct ccb_writer {
+	char* buffer;
+	unsigned int length;
+	unsigned int capacity;
+	FILE* file;
+} ccb_writer;
+
+ccb_writer ccb_writer_create(FILE* file) {
+	ccb_writer writer = {0};
+	writer.capacity = CCB_DIS_FLUSH;
+	writer.buffer = malloc(writer.capacity);
+	writer.file = file;
+	return writer;
+}
+
+void ccb_writer_flush(ccb_writer* writer) {
+	if (writer->file != NULL && writer->length > 0) {
+		fwrite(writer->buffer, 1, writer->length, writer->file);
+		writer->length = 0;
+	}
+}
+
+// room for length more bytes at the end of the buffer
+char* ccb_writer_reserve(ccb_writer* writer, unsigned int length) {
+	if (writer->length + length > writer->capacity) {
+		ccb_writer_flush(writer);
+		while (writer->length + length > writer->capacity) {
+			writer->capacity *= 2;
+			writer->buffer = realloc(writer->buffer, writer->capacity);
+		}
+	}
+
+	return writer->buffer + writer->length;
+}
+
+void ccb_write(ccb_writer* writer, char* bytes, unsigned int length) {
+	memcpy(ccb_writer_reserve(writer, length), bytes, length);
+	writer->length += length;
+}
+
+void ccb_write_string(ccb_writer* writer, char* string) {
+	ccb_write(writer, string, strlen(string));
+}
+
+char* ccb_format_uint(char* output, unsigned int n) {
+	char digits[10];
+	int length = 0;
+
+	do {
+		digits[9 - length++] = '0' + n % 10;
+		n /= 10;
+	} while (n != 0);
+
+	memcpy(output, digits + 10 - length, length);
+	return output + length;
+}
+
+void ccb_write_uint(ccb_writer* writer, unsigned int n) {
+	char* start = ccb_writer_reserve(writer, 10);
+	writer->length += ccb_format_uint(start, n) - start;
+}
+
+void ccb_writer_free(ccb_writer* writer) {
+	ccb_writer_flush(writer);
+	free(writer->buffer);
+}
+
+// everything about an opcode byte the disassembler needs, built once from the opcode definitions so decoding
+// is a single lookup
+typedef struct ccb_dis_form {
+	BOOL valid;
+	unsigned char opcode;
+	unsigned char operandCount;
+	unsigned char operands[CCA_MAX_OPERANDS];
+	unsigned char sizes[CCA_MAX_OPERANDS];
+	signed char target;
+	unsigned char size;
+	unsigned char words;
+
+	char* mnemonic;
+	unsigned int mnemonicLength;
+	cca_fusion* fusion;
+} ccb_dis_form;
+
+ccb_dis_form ccb_dis_forms[256];
+
+void ccb_dis_build_forms() {
+	for (int encoding = 0; encoding < 256; encoding++) {
+		ccb_dis_form* form = &ccb_dis_forms[encoding];
+		cca_opcode_info* info = &cca_opcodes[encoding];
+		if (info->mnemonic == NULL)
+			continue;
+
+		unsigned char opcode = cca_opcode_standard(encoding);
+		form->valid = TRUE;
+		form->opcode = opcode;
+		form->operandCount = info->operandCount;
+		form->target = cca_opcode_target(encoding);
+		form->size = 1;
+		form->words = cca_wide_word_count(encoding);
+		form->mnemonic = cca_opcodes[opcode].mnemonic;
+		form->mnemonicLength = strlen(form->mnemonic);
+		form->fusion = cca_fusion_of(opcode);
+
+		for (int i = 0; i < info->operandCount; i++) {
+			form->operands[i] = info->operands[i];
+			form->sizes[i] = cca_operand_size(info, i);
+			form->size += form->sizes[i];
+		}
+	}
+}
+
+// like cca_decode_instruction, registers have to exist as well. returns the size in code units, 0 if the
+// instruction can't be written
+unsigned int ccb_dis_decode(ccb_image* image, unsigned int offset, cca_instruction* instruction) {
+	BOOL wide = image->encoding == CCA_ENCODING_WIDE;
+	unsigned int position = wide ? offset * CCA_WIDE_WORD : offset;
+	if (position >= image->codeSize)
+		return 0;
+
+	ccb_dis_form* form = &ccb_dis_forms[image->code[position]];
+	unsigned int size = wide ? form->words * CCA_WIDE_WORD : form->size;
+	if (!form->valid || size > image->codeSize - position)
+		return 0;
+
+	unsigned char* bytes = image->code + position + 1;
+	unsigned char* immediate = image->code + position + 4;
+	instruction->opcode = form->opcode;
+	instruction->encoding = image->code[position];
+	instruction->offset = offset;
+
+	for (int i = 0; i < form->operandCount; i++) {
+		cca_operand* operand = &instruction->operands[i];
+		operand->type = form->operands[i];
+
+		if (operand->type == CCA_OPERAND_REGISTER) {
+			operand->value = *bytes++;
+			if (operand->value >= CCA_REGISTER_COUNT)
+				return 0;
+			continue;
+		}
+
+		if (wide) {
+			operand->value = cca_read_le(immediate);
+			immediate += 4;
+		} else {
+			switch (form->sizes[i]) {
+				case 1: operand->value = bytes[0]; break;
+				case 2: operand->value = (bytes[0] << 8) | bytes[1]; break;
+				default: operand->value = ((unsigned int) bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3]; break;
+			}
+			bytes += form->sizes[i];
+		}
+
+		if (operand->type == CCA_OPERAND_RELATIVE) {
+			// sign extend and count from the end of the instruction
+			if (form->sizes[i] < 4 && (operand->value & (1u << (form->sizes[i] * 8 - 1))))
+				operand->value |= ~0u << (form->sizes[i] * 8);
+			operand->value += offset + size;
+		}
+		if (operand->type == CCA_OPERAND_MARKER || operand->type == CCA_OPERAND_RELATIVE)
+			operand->type = CCA_OPERAND_ADDRESS;
+	}
+
+	return wide ? form->words : size;
+}
+
+typedef struct ccb_disassembly {
+	unsigned int instructionCount;
+	// the fusions found, to assemble the output the way the image was assembled
+	unsigned int fusions;
+	// cleared when something in the image can't be written as source
+	BOOL complete;
+} ccb_disassembly;
+
+typedef struct ccb_dis_labels {
+	unsigned int* symbolOffsets;
+	char** symbolNames;
+	unsigned int* symbolNameLengths;
+	unsigned int symbolCount;
+	unsigned int longestName;
+	// the first symbol at each offset by hash of the offset, as the offset and the symbol plus one
+	unsigned int* symbolSlots;
+	unsigned int slotMask;
+
+	// branch targets without a symbol and whether an instruction starts at an offset, one bit each
+	unsigned int* targets;
+	unsigned int targetCount;
+	unsigned char* starts;
+	unsigned int units;
+} ccb_dis_labels;
+
+// the first symbol at an offset, or -1
+int ccb_dis_symbol_at(ccb_dis_labels* labels, unsigned int offset) {
+	if (labels->symbolCount == 0)
+		return -1;
+
+	unsigned int slot = (offset * 2654435761u >> 7) & labels->slotMask;
+	while (labels->symbolSlots[slot * 2 + 1] != 0) {
+		if (labels->symbolSlots[slot * 2] == offset)
+			return labels->symbolSlots[slot * 2 + 1] - 1;
+		slot = (slot + 1) & labels->slotMask;
+	}
+
+	return -1;
+}
+
+BOOL ccb_dis_starts_at(ccb_dis_labels* labels, unsigned int offset) {
+	return offset < labels->units && (labels->starts[offset / 8] & (1 << (offset % 8)));
+}
+
+void ccb_dis_symbols(ccb_image* image, ccb_dis_labels* labels) {
+	if (image->symbols == NULL || image->symbolsSize < 4)
+		return;
+
+	unsigned int count = cca_read_le(image->symbols);
+	if (count > (image->symbolsSize - 4) / sizeof(ccb_symbol))
+		count = (image->symbolsSize - 4) / sizeof(ccb_symbol);
+
+	labels->symbolOffsets = malloc((count + 1) * sizeof(unsigned int));
+	labels->symbolNames = malloc((count + 1) * sizeof(char*));
+	labels->symbolNameLengths = malloc((count + 1) * sizeof(unsigned int));
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned char* symbol = image->symbols + 4 + i * sizeof(ccb_symbol);
+		unsigned int name = cca_read_le(symbol + 4);
+		if (name >= image->symbolsSize || memchr(image->symbols + name, '\0', image->symbolsSize - name) == NULL)
+			continue;
+
+		// the section is sorted by offset already
+		unsigned int length = strlen((char*) image->symbols + name);
+		labels->symbolOffsets[labels->symbolCount] = cca_read_le(symbol);
+		labels->symbolNames[labels->symbolCount] = (char*) image->symbols + name;
+		labels->symbolNameLengths[labels->symbolCount++] = length;
+		if (length > labels->longestName)
+			labels->longestName = length;
+	}
+
+	unsigned int capacity = 16;
+	while (capacity < labels->symbolCount * 2)
+		capacity *= 2;
+	labels->symbolSlots = calloc(capacity * 2, sizeof(unsigned int));
+	labels->slotMask = capacity - 1;
+
+	for (unsigned int i = 0; i < labels->symbolCount; i++) {
+		if (ccb_dis_symbol_at(labels, labels->symbolOffsets[i]) >= 0)
+			continue;
+
+		unsigned int slot = (labels->symbolOffsets[i] * 2654435761u >> 7) & labels->slotMask;
+		while (labels->symbolSlots[slot * 2 + 1] != 0)
+			slot = (slot + 1) & labels->slotMask;
+		labels->symbolSlots[slot * 2] = labels->symbolOffsets[i];
+		labels->symbolSlots[slot * 2 + 1] = i + 1;
+	}
+}
+
+// first pass, where instructions start and which branch targets need a label made up
+void ccb_dis_targets(ccb_image* image, ccb_dis_labels* labels) {
+	unsigned int capacity = 100;
+	labels->targets = malloc(capacity * sizeof(unsigned int));
+	labels->starts = calloc(labels->units / 8 + 1, 1);
+
+	for (unsigned int offset = 0; offset < labels->units;) {
+		cca_instruction instruction;
+		unsigned int size = ccb_dis_decode(image, offset, &instruction);
+		if (size == 0) {
+			++offset;
+			continue;
+		}
+
+		labels->starts[offset / 8] |= 1 << (offset % 8);
+		offset += size;
+
+		int target = ccb_dis_forms[instruction.encoding].target;
+		if (target < 0 || ccb_dis_symbol_at(labels, instruction.operands[target].value) >= 0)
+			continue;
+
+		if (labels->targetCount >= capacity) {
+			capacity *= 2;
+			labels->targets = realloc(labels->targets, capacity * sizeof(unsigned int));
+		}
+		labels->targets[labels->targetCount++] = instruction.operands[target].value;
+	}
+
+	qsort(labels->targets, labels->targetCount, sizeof(unsigned int), cca_uint_compare);
+
+	// only targets that are instructions can have a label
+	unsigned int kept = 0;
+	for (unsigned int i = 0; i < labels->targetCount; i++) {
+		unsigned int target = labels->targets[i];
+		if (ccb_dis_starts_at(labels, target) && (kept == 0 || labels->targets[kept - 1] != target))
+			labels->targets[kept++] = target;
+	}
+	labels->targetCount = kept;
+}
+
+char* ccb_dis_operand(char* output, ccb_dis_labels* labels, cca_operand* operand, BOOL target) {
+	switch (operand->type) {
+		case CCA_OPERAND_REGISTER:
+			*output++ = 'a' + operand->value;
+			return output;
+		case CCA_OPERAND_NUMBER:
+			return ccb_format_uint(output, operand->value);
+	}
+
+	if (target) {
+		int symbol = ccb_dis_symbol_at(labels, operand->value);
+		if (symbol >= 0) {
+			memcpy(output, labels->symbolNames[symbol], labels->symbolNameLengths[symbol]);
+			return output + labels->symbolNameLengths[symbol];
+		}
+		if (ccb_dis_starts_at(labels, operand->value)) {
+			memcpy(output, CCB_DIS_LABEL_NAME, strlen(CCB_DIS_LABEL_NAME));
+			return ccb_format_uint(output + strlen(CCB_DIS_LABEL_NAME), operand->value);
+		}
+	}
+
+	// an explicit address assembles to the same bytes as long as nothing moves
+	*output++ = '&';
+	return ccb_format_uint(output, operand->value);
+}
+
+// one line, opcode is the standard form so the parts of superinstructions go through here as well
+void ccb_dis_instruction(ccb_writer* writer, ccb_dis_labels* labels, unsigned char opcode, cca_operand* operands) {
+	ccb_dis_form* form = &ccb_dis_forms[opcode];
+	char* start = ccb_writer_reserve(writer, 4 + form->mnemonicLength + CCA_MAX_OPERANDS * (labels->longestName + 16));
+	char* output = start;
+
+	*output++ = '\t';
+	memcpy(output, form->mnemonic, form->mnemonicLength);
+	output += form->mnemonicLength;
+
+	for (int i = 0; i < form->operandCount; i++) {
+		if (i == 0) {
+			*output++ = ' ';
+		} else {
+			*output++ = ',';
+			*output++ = ' ';
+		}
+		output = ccb_dis_operand(output, labels, &operands[i], i == form->target);
+	}
+
+	*output++ = '\n';
+	writer->length += output - start;
+}
+
+// operands of part of the sequence a superinstruction stands for
+void ccb_dis_fusion_part(cca_fusion* fusion, cca_instruction* fused, unsigned int part, cca_operand* operands) {
+	for (int i = 0; i < cca_opcodes[fusion->parts[part]].operandCount; i++) {
+		unsigned int source = part * 2 + i;
+		if (fusion->same[0] != fusion->same[1] && source == fusion->same[1])
+			source = fusion->same[0];
+
+		for (int o = 0; o < cca_opcodes[fusion->opcode].operandCount; o++) {
+			if (fusion->sources[o] == source)
+				operands[i] = fused->operands[o];
+		}
+	}
+}
+
+// data as defs, split wherever a quote can't be found that the bytes don't contain. nul bytes go in a db
+void ccb_dis_data(ccb_writer* writer, ccb_image* image) {
+	char* quotes = "\"'`";
+	unsigned int index = 0;
+
+	for (unsigned int start = 0; start < image->dataSize;) {
+		BOOL seen[3] = { FALSE, FALSE, FALSE };
+		unsigned int end = start;
+
+		while (end < image->dataSize && image->data[end] != '\0') {
+			char* quote = strchr(quotes, image->data[end]);
+			if (quote != NULL) {
+				seen[quote - quotes] = TRUE;
+				if (seen[0] && seen[1] && seen[2])
+					break;
+			}
+			++end;
+		}
+
+		ccb_write_string(writer, "def " CCB_DIS_DATA_NAME);
+		ccb_write_uint(writer, index++);
+
+		// strings can't hold nuls, they go in a db
+		if (end == start) {
+			while (end < image->dataSize && end - start < CCB_DIS_DATA_BYTES && image->data[end] == '\0')
+				++end;
+
+			ccb_write_string(writer, " db 0");
+			for (unsigned int i = start + 1; i < end; i++)
+				ccb_write_string(writer, ", 0");
+			ccb_write(writer, "\n", 1);
+			start = end;
+			continue;
+		}
+
+		char quote = quotes[!seen[0] ? 0 : !seen[1] ? 1 : 2];
+		ccb_write(writer, " ", 1);
+		ccb_write(writer, &quote, 1);
+		ccb_write(writer, (char*) image->data + start, end - start);
+		ccb_write(writer, &quote, 1);
+		ccb_write(writer, "\n", 1);
+		start = end;
+	}
+}
+
+ccb_disassembly ccb_disassemble(ccb_image* image, ccb_writer* writer) {
+	ccb_disassembly disassembly = {0};
+	disassembly.complete = TRUE;
+
+	if (!ccb_dis_forms[CCA_OP_STP].valid)
+		ccb_dis_build_forms();
+
+	ccb_dis_labels labels = {0};
+	labels.units = image->encoding == CCA_ENCODING_WIDE ? image->codeSize / CCA_WIDE_WORD : image->codeSize;
+	ccb_dis_symbols(image, &labels);
+	ccb_dis_targets(image, &labels);
+
+	char* encodings[] = { "standard", "compact", "wide" };
+	ccb_write_string(writer, "; ");
+	ccb_write_string(writer, image->encoding <= CCA_ENCODING_WIDE ? encodings[(int) image->encoding] : "unknown");
+	ccb_write_string(writer, " encoding, ");
+	ccb_write_uint(writer, image->dataSize);
+	ccb_write_string(writer, " bytes of data, ");
+	ccb_write_uint(writer, image->codeSize);
+	ccb_write_string(writer, image->flags & CCB_FLAG_VERIFIED ? " bytes of verified code\n" : " bytes of code\n");
+
+	ccb_dis_data(writer, image);
+
+	unsigned int symbol = 0;
+	unsigned int target = 0;
+	for (unsigned int offset = 0; offset <= labels.units;) {
+		while (symbol < labels.symbolCount && labels.symbolOffsets[symbol] <= offset) {
+			if (labels.symbolOffsets[symbol] != offset)
+				disassembly.complete = FALSE;
+
+			ccb_write(writer, ":", 1);
+			ccb_write(writer, labels.symbolNames[symbol], labels.symbolNameLengths[symbol]);
+			ccb_write(writer, "\n", 1);
+			++symbol;
+		}
+		while (target < labels.targetCount && labels.targets[target] < offset)
+			++target;
+		if (target < labels.targetCount && labels.targets[target] == offset) {
+			ccb_write_string(writer, ":" CCB_DIS_LABEL_NAME);
+			ccb_write_uint(writer, offset);
+			ccb_write(writer, "\n", 1);
+		}
+
+		if (offset == labels.units)
+			break;
+
+		cca_instruction instruction;
+		unsigned int size = ccb_dis_decode(image, offset, &instruction);
+		if (size == 0) {
+			unsigned int position = image->encoding == CCA_ENCODING_WIDE ? offset * CCA_WIDE_WORD : offset;
+			ccb_write_string(writer, "\t; can't decode opcode ");
+			ccb_write_uint(writer, image->code[position]);
+			ccb_write_string(writer, " at ");
+			ccb_write_uint(writer, offset);
+			ccb_write(writer, "\n", 1);
+
+			disassembly.complete = FALSE;
+			++offset;
+			continue;
+		}
+
+		cca_fusion* fusion = ccb_dis_forms[instruction.encoding].fusion;
+		if (fusion != NULL) {
+			disassembly.fusions |= 1u << (fusion - cca_fusions);
+			for (unsigned int part = 0; part < fusion->length; part++) {
+				cca_operand operands[CCA_MAX_OPERANDS];
+				ccb_dis_fusion_part(fusion, &instruction, part, operands);
+				ccb_dis_instruction(writer, &labels, fusion->parts[part], operands);
+			}
+		} else {
+			ccb_dis_instruction(writer, &labels, instruction.opcode, instruction.operands);
+		}
+
+		++disassembly.instructionCount;
+		offset += size;
+	}
+
+	free(labels.symbolOffsets);
+	free(labels.symbolNames);
+	free(labels.symbolNameLengths);
+	free(labels.symbolSlots);
+	free(labels.targets);
+	free(labels.starts);
+	return disassembly;
+}
+
+#endif
@@ -0,0 +1,388 @@
+#ifndef ccvm_interpreter
+#define ccvm_interpreter
+
+// reference interpreter, used by ccvm-run
+//
+// the code is decoded once into threads, one per instruction, holding the address of its handler and its operands
+// with branch targets turned into thread indices, and then run with direct threaded dispatch. the data section is
+// loaded at address 0 and memory words are big endian like the code. memory operands are checked while loading,
+// the stack only while running code the assembler couldn't verify
+#define CCVM_MEMORY_SIZE (1 << 20)
+#define CCVM_STACK_SIZE (1 << 16)
+#define CCVM_CALL_STACK_SIZE (1 << 16)
+
+// syscall stubs, the number goes in a and the result comes back in a
+#define CCVM_SYSCALL_EXIT 0
+#define CCVM_SYSCALL_PRINT 1
+#define CCVM_SYSCALL_PRINT_NUMBER 2
+
+typedef struct ccvm_thread {
+	void* handler;
+	unsigned char opcode;
+	unsigned int operands[CCA_MAX_OPERANDS];
+} ccvm_thread;
+
+typedef struct ccvm_machine {
+	ccvm_thread* threads;
+	unsigned int threadCount;
+
+	unsigned int registers[CCA_REGISTER_COUNT];
+	unsigned int flags;
+	unsigned char* memory;
+	unsigned int* stack;
+	unsigned int stackSize;
+	ccvm_thread** calls;
+
+	BOOL trusted;
+	unsigned long long executed;
+	unsigned int exitCode;
+
+	// code offset of every thread, and of the one that failed
+	unsigned int* offsets;
+	unsigned int errorOffset;
+} ccvm_machine;
+
+BOOL ccvm_check_address(unsigned int address, unsigned int offset) {
+	if (address > CCVM_MEMORY_SIZE - 4) {
+		printf("[ERROR] address %u at %u is outside of memory\n", address, offset);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOL ccvm_load(ccvm_machine* machine, ccb_image* image) {
+	memset(machine, 0, sizeof(ccvm_machine));
+
+	unsigned int units = image->encoding == CCA_ENCODING_WIDE ? image->codeSize / CCA_WIDE_WORD : image->codeSize;
+	unsigned int* indexAt = malloc((units + 1) * sizeof(unsigned int));
+	cca_instruction* instructions = malloc((units + 1) * sizeof(cca_instruction));
+	unsigned int count = 0;
+	BOOL error = FALSE;
+
+	for (unsigned int i = 0; i <= units; i++)
+		indexAt[i] = CCA_MARKER_UNDEFINED;
+
+	for (unsigned int offset = 0; offset < units;) {
+		unsigned int size = cca_decode_instruction(image->code, image->codeSize, image->encoding, offset, &instructions[count]);
+		if (size == 0) {
+			printf("[ERROR] can't decode the instruction at %u\n", offset);
+			error = TRUE;
+			break;
+		}
+
+		indexAt[offset] = count++;
+		offset += size;
+	}
+
+	// running off the end of the code, or jumping right behind it, stops the machine
+	indexAt[units] = count;
+	machine->threadCount = count + 1;
+	machine->threads = calloc(machine->threadCount, sizeof(ccvm_thread));
+	machine->threads[count].opcode = CCA_OP_STP;
+	machine->offsets = malloc(machine->threadCount * sizeof(unsigned int));
+	machine->offsets[count] = units;
+
+	for (unsigned int i = 0; i < count && !error; i++) {
+		cca_instruction* instruction = &instructions[i];
+		ccvm_thread* thread = &machine->threads[i];
+		thread->opcode = instruction->opcode;
+		machine->offsets[i] = instruction->offset;
+
+		for (int j = 0; j < CCA_MAX_OPERANDS; j++) {
+			cca_operand* operand = &instruction->operands[j];
+			thread->operands[j] = operand->value;
+
+			if (operand->type == CCA_OPERAND_REGISTER && operand->value >= CCA_REGISTER_COUNT) {
+				printf("[ERROR] register %u at %u doesn't exist\n", operand->value, instruction->offset);
+				error = TRUE;
+			} else if (operand->type == CCA_OPERAND_ADDRESS && cca_opcode_target(instruction->opcode) == j) {
+				if (operand->value > units || indexAt[operand->value] == CCA_MARKER_UNDEFINED) {
+					printf("[ERROR] the branch at %u to %u doesn't land on an instruction\n", instruction->offset, operand->value);
+					error = TRUE;
+				}
+				thread->operands[j] = indexAt[operand->value];
+			} else if (operand->type == CCA_OPERAND_ADDRESS && !ccvm_check_address(operand->value, instruction->offset)) {
+				error = TRUE;
+			}
+		}
+	}
+
+	free(instructions);
+	free(indexAt);
+
+	if (image->dataSize > CCVM_MEMORY_SIZE) {
+		puts("[ERROR] the data section doesn't fit in memory");
+		error = TRUE;
+	}
+
+	machine->memory = calloc(CCVM_MEMORY_SIZE, 1);
+	if (!error)
+		memcpy(machine->memory, image->data, image->dataSize);
+
+	machine->trusted = (image->flags & CCB_FLAG_VERIFIED) != 0;
+	machine->stackSize = machine->trusted ? image->maxStackDepth + 1 : CCVM_STACK_SIZE;
+	machine->stack = malloc(machine->stackSize * sizeof(unsigned int));
+	machine->calls = malloc(CCVM_CALL_STACK_SIZE * sizeof(ccvm_thread*));
+
+	return !error;
+}
+
+void ccvm_free(ccvm_machine* machine) {
+	free(machine->threads);
+	free(machine->memory);
+	free(machine->stack);
+	free(machine->calls);
+	free(machine->offsets);
+}
+
+unsigned int ccvm_read(ccvm_machine* machine, unsigned int address) {
+	unsigned char* bytes = machine->memory + address;
+	return ((unsigned int) bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+void ccvm_write(ccvm_machine* machine, unsigned int address, unsigned int value) {
+	unsigned char* bytes = machine->memory + address;
+	bytes[0] = value >> 24;
+	bytes[1] = value >> 16;
+	bytes[2] = value >> 8;
+	bytes[3] = value;
+}
+
+// runs the local syscall stubs, returns FALSE once the program asked to exit
+BOOL ccvm_syscall(ccvm_machine* machine) {
+	unsigned int* registers = machine->registers;
+
+	switch (registers[0]) {
+		case CCVM_SYSCALL_EXIT:
+			machine->exitCode = registers[1];
+			return FALSE;
+		case CCVM_SYSCALL_PRINT: {
+			unsigned int address = registers[1];
+			while (address < CCVM_MEMORY_SIZE && machine->memory[address] != 0)
+				putchar(machine->memory[address++]);
+			registers[0] = 0;
+			break;
+		}
+		case CCVM_SYSCALL_PRINT_NUMBER:
+			printf("%u\n", registers[1]);
+			registers[0] = 0;
+			break;
+		default:
+			registers[0] = 0xffffffff;
+			break;
+	}
+
+	return TRUE;
+}
+
+// the stack checks fall away for verified code
+#define CCVM_NEED(n) if (!trusted && sp < (n)) goto underflow
+#define CCVM_ROOM() if (!trusted && sp >= machine->stackSize) goto overflow
+#define CCVM_DISPATCH() do { ++executed; thread = ip++; goto *thread->handler; } while (0)
+#define CCVM_BINARY_REG(op) r[thread->operands[0]] = r[thread->operands[0]] op r[thread->operands[1]]; CCVM_DISPATCH()
+#define CCVM_BINARY(op) CCVM_NEED(2); --sp; stack[sp - 1] = stack[sp - 1] op stack[sp]; CCVM_DISPATCH()
+#define CCVM_BRANCH(taken, target) if (taken) ip = threads + thread->operands[target]; CCVM_DISPATCH()
+
+// returns FALSE if the program went wrong while running
+BOOL ccvm_run(ccvm_machine* machine) {
+	static void* handlers[256];
+	if (handlers[CCA_OP_STP] == NULL) {
+		for (int i = 0; i < 256; i++)
+			handlers[i] = &&op_invalid;
+
+		handlers[CCA_OP_STP] = &&op_stp;
+		handlers[CCA_OP_PSH_NUM] = &&op_psh_num;
+		handlers[CCA_OP_PSH_REG] = &&op_psh_reg;
+		handlers[CCA_OP_PSH_ADDR] = &&op_psh_addr;
+		handlers[CCA_OP_POP_REG] = &&op_pop_reg;
+		handlers[CCA_OP_POP_ADDR] = &&op_pop_addr;
+		handlers[CCA_OP_DUP] = &&op_dup;
+		handlers[CCA_OP_MOV_REG_NUM] = &&op_mov_reg_num;
+		handlers[CCA_OP_MOV_ADDR_NUM] = &&op_mov_addr_num;
+		handlers[CCA_OP_MOV_REG_ADDR] = &&op_mov_reg_addr;
+		handlers[CCA_OP_MOV_ADDR_REG] = &&op_mov_addr_reg;
+		handlers[CCA_OP_MOV_REG_REG] = &&op_mov_reg_reg;
+		handlers[CCA_OP_ADD_REG] = &&op_add_reg;
+		handlers[CCA_OP_ADD] = &&op_add;
+		handlers[CCA_OP_SUB_REG] = &&op_sub_reg;
+		handlers[CCA_OP_SUB] = &&op_sub;
+		handlers[CCA_OP_MUL_REG] = &&op_mul_reg;
+		handlers[CCA_OP_MUL] = &&op_mul;
+		handlers[CCA_OP_DIV_REG] = &&op_div_reg;
+		handlers[CCA_OP_DIV] = &&op_div;
+		handlers[CCA_OP_NOT_REG] = &&op_not_reg;
+		handlers[CCA_OP_NOT] = &&op_not;
+		handlers[CCA_OP_AND_REG] = &&op_and_reg;
+		handlers[CCA_OP_AND] = &&op_and;
+		handlers[CCA_OP_OR_REG] = &&op_or_reg;
+		handlers[CCA_OP_OR] = &&op_or;
+		handlers[CCA_OP_XOR_REG] = &&op_xor_reg;
+		handlers[CCA_OP_XOR] = &&op_xor;
+		handlers[CCA_OP_CMP_REG_REG] = &&op_cmp_reg_reg;
+		handlers[CCA_OP_CMP_REG_NUM] = &&op_cmp_reg_num;
+		handlers[CCA_OP_CMP_NUM] = &&op_cmp_num;
+		handlers[CCA_OP_JE] = &&op_je;
+		handlers[CCA_OP_JNE] = &&op_jne;
+		handlers[CCA_OP_JG] = &&op_jg;
+		handlers[CCA_OP_JS] = &&op_js;
+		handlers[CCA_OP_JO] = &&op_jo;
+		handlers[CCA_OP_JMP] = &&op_jmp;
+		handlers[CCA_OP_FRS] = &&op_frs;
+		handlers[CCA_OP_INC_REG] = &&op_inc_reg;
+		handlers[CCA_OP_DEC_REG] = &&op_dec_reg;
+		handlers[CCA_OP_INC] = &&op_inc;
+		handlers[CCA_OP_DEC] = &&op_dec;
+		handlers[CCA_OP_CALL] = &&op_call;
+		handlers[CCA_OP_RET] = &&op_ret;
+		handlers[CCA_OP_SYSCALL] = &&op_syscall;
+		handlers[CCA_OP_CMP_NUM_JE] = &&op_cmp_num_je;
+		handlers[CCA_OP_CMP_NUM_JNE] = &&op_cmp_num_jne;
+		handlers[CCA_OP_CMP_REG_JE] = &&op_cmp_reg_je;
+		handlers[CCA_OP_CMP_REG_JNE] = &&op_cmp_reg_jne;
+		handlers[CCA_OP_PSH_PSH_ADD] = &&op_psh_psh_add;
+		handlers[CCA_OP_PSH_NUM_ADD] = &&op_psh_num_add;
+		handlers[CCA_OP_INC_CMP_JNE] = &&op_inc_cmp_jne;
+		handlers[CCA_OP_INC_CMP_NUM_JNE] = &&op_inc_cmp_num_jne;
+	}
+
+	ccvm_thread* threads = machine->threads;
+	for (unsigned int i = 0; i < machine->threadCount; i++)
+		threads[i].handler = handlers[threads[i].opcode];
+
+	unsigned int* r = machine->registers;
+	unsigned int* stack = machine->stack;
+	unsigned int sp = 0;
+	unsigned int calls = 0;
+	unsigned long long executed = 0;
+	BOOL trusted = machine->trusted;
+	BOOL error = FALSE;
+	ccvm_thread* ip = threads;
+	ccvm_thread* thread;
+
+	CCVM_DISPATCH();
+
+	op_psh_num: CCVM_ROOM(); stack[sp++] = thread->operands[0]; CCVM_DISPATCH();
+	op_psh_reg: CCVM_ROOM(); stack[sp++] = r[thread->operands[0]]; CCVM_DISPATCH();
+	op_psh_addr: CCVM_ROOM(); stack[sp++] = ccvm_read(machine, thread->operands[0]); CCVM_DISPATCH();
+	op_pop_reg: CCVM_NEED(1); r[thread->operands[0]] = stack[--sp]; CCVM_DISPATCH();
+	op_pop_addr: CCVM_NEED(1); ccvm_write(machine, thread->operands[0], stack[--sp]); CCVM_DISPATCH();
+	op_dup: CCVM_NEED(1); CCVM_ROOM(); stack[sp] = stack[sp - 1]; ++sp; CCVM_DISPATCH();
+
+	op_mov_reg_num: r[thread->operands[0]] = thread->operands[1]; CCVM_DISPATCH();
+	op_mov_addr_num: ccvm_write(machine, thread->operands[0], thread->operands[1]); CCVM_DISPATCH();
+	op_mov_reg_addr: r[thread->operands[0]] = ccvm_read(machine, thread->operands[1]); CCVM_DISPATCH();
+	op_mov_addr_reg: ccvm_write(machine, thread->operands[0], r[thread->operands[1]]); CCVM_DISPATCH();
+	op_mov_reg_reg: r[thread->operands[0]] = r[thread->operands[1]]; CCVM_DISPATCH();
+
+	op_add_reg: CCVM_BINARY_REG(+);
+	op_sub_reg: CCVM_BINARY_REG(-);
+	op_mul_reg: CCVM_BINARY_REG(*);
+	op_and_reg: CCVM_BINARY_REG(&);
+	op_or_reg: CCVM_BINARY_REG(|);
+	op_xor_reg: CCVM_BINARY_REG(^);
+	op_div_reg:
+		if (r[thread->operands[1]] == 0)
+			goto division;
+		CCVM_BINARY_REG(/);
+	op_not_reg: r[thread->operands[0]] = ~r[thread->operands[0]]; CCVM_DISPATCH();
+	op_inc_reg: ++r[thread->operands[0]]; CCVM_DISPATCH();
+	op_dec_reg: --r[thread->operands[0]]; CCVM_DISPATCH();
+
+	op_add: CCVM_BINARY(+);
+	op_sub: CCVM_BINARY(-);
+	op_mul: CCVM_BINARY(*);
+	op_and: CCVM_BINARY(&);
+	op_or: CCVM_BINARY(|);
+	op_xor: CCVM_BINARY(^);
+	op_div:
+		CCVM_NEED(2);
+		if (stack[sp - 1] == 0)
+			goto division;
+		CCVM_BINARY(/);
+	op_not: CCVM_NEED(1); stack[sp - 1] = ~stack[sp - 1]; CCVM_DISPATCH();
+	op_inc: CCVM_NEED(1); ++stack[sp - 1]; CCVM_DISPATCH();
+	op_dec: CCVM_NEED(1); --stack[sp - 1]; CCVM_DISPATCH();
+
+	op_cmp_reg_reg: machine->flags = cca_compare_flags(r[thread->operands[0]], r[thread->operands[1]]); CCVM_DISPATCH();
+	op_cmp_reg_num: machine->flags = cca_compare_flags(r[thread->operands[0]], thread->operands[1]); CCVM_DISPATCH();
+	op_cmp_num: CCVM_NEED(1); machine->flags = cca_compare_flags(stack[--sp], thread->operands[0]); CCVM_DISPATCH();
+	op_frs: machine->flags = 0; CCVM_DISPATCH();
+
+	op_je: CCVM_BRANCH(machine->flags & CCA_FLAG_EQUAL, 0);
+	op_jne: CCVM_BRANCH(!(machine->flags & CCA_FLAG_EQUAL), 0);
+	op_jg: CCVM_BRANCH(machine->flags & CCA_FLAG_GREATER, 0);
+	op_js: CCVM_BRANCH(machine->flags & CCA_FLAG_SIGN, 0);
+	op_jo: CCVM_BRANCH(machine->flags & CCA_FLAG_OVERFLOW, 0);
+	op_jmp: ip = threads + thread->operands[0]; CCVM_DISPATCH();
+
+	op_call:
+		if (calls == CCVM_CALL_STACK_SIZE) {
+			puts("[ERROR] calls nest too deep");
+			error = TRUE;
+			goto done;
+		}
+		machine->calls[calls++] = ip;
+		ip = threads + thread->operands[0];
+		CCVM_DISPATCH();
+	op_ret:
+		if (calls == 0) {
+			puts("[ERROR] ret without a call");
+			error = TRUE;
+			goto done;
+		}
+		ip = machine->calls[--calls];
+		CCVM_DISPATCH();
+
+	op_cmp_num_je:
+		machine->flags = cca_compare_flags(r[thread->operands[0]], thread->operands[1]);
+		CCVM_BRANCH(machine->flags & CCA_FLAG_EQUAL, 2);
+	op_cmp_num_jne:
+		machine->flags = cca_compare_flags(r[thread->operands[0]], thread->operands[1]);
+		CCVM_BRANCH(!(machine->flags & CCA_FLAG_EQUAL), 2);
+	op_cmp_reg_je:
+		machine->flags = cca_compare_flags(r[thread->operands[0]], r[thread->operands[1]]);
+		CCVM_BRANCH(machine->flags & CCA_FLAG_EQUAL, 2);
+	op_cmp_reg_jne:
+		machine->flags = cca_compare_flags(r[thread->operands[0]], r[thread->operands[1]]);
+		CCVM_BRANCH(!(machine->flags & CCA_FLAG_EQUAL), 2);
+	op_psh_psh_add: CCVM_ROOM(); stack[sp++] = r[thread->operands[0]] + r[thread->operands[1]]; CCVM_DISPATCH();
+	op_psh_num_add: CCVM_ROOM(); stack[sp++] = r[thread->operands[0]] + thread->operands[1]; CCVM_DISPATCH();
+	op_inc_cmp_jne:
+		machine->flags = cca_compare_flags(++r[thread->operands[0]], r[thread->operands[1]]);
+		CCVM_BRANCH(!(machine->flags & CCA_FLAG_EQUAL), 2);
+	op_inc_cmp_num_jne:
+		machine->flags = cca_compare_flags(++r[thread->operands[0]], thread->operands[1]);
+		CCVM_BRANCH(!(machine->flags & CCA_FLAG_EQUAL), 2);
+
+	op_syscall:
+		if (ccvm_syscall(machine))
+			CCVM_DISPATCH();
+		goto done;
+
+	op_invalid:
+		printf("[ERROR] opcode 0x%02x can't be run\n", thread->opcode);
+		error = TRUE;
+		goto done;
+	underflow:
+		puts("[ERROR] the stack ran dry");
+		error = TRUE;
+		goto done;
+	overflow:
+		puts("[ERROR] the stack overflowed");
+		error = TRUE;
+		goto done;
+	division:
+		puts("[ERROR] division by zero");
+		error = TRUE;
+		goto done;
+
+	op_stp:
+	done:
+	machine->executed = executed;
+	if (error)
+		machine->errorOffset = machine->offsets[thread - threads];
+	return !error;
+}
+
+#endif
@@ -0,0 +1,486 @@
+#ifndef ccvm_assembler_io
+#define ccvm_assembler_io
+
+// file i/o for batches, so the workers assemble while sources are read ahead and outputs are written behind them
+//
+// requests are queued from any thread. with io_uring the thread that polls opens, stats, reads, writes and closes
+// them all through one ring and only waits when none of them can move. where io_uring or one of the operations
+// isn't there, in older kernels and sandboxes that filter it, a few threads do the same with plain blocking calls
+//
+// outputs with included files are written with cca_bytecode_write either way, copy_file_range already keeps
+// those in the kernel
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+
+#define CCA_IO_LOAD 0
+#define CCA_IO_STORE 1
+
+#define CCA_IO_ENTRIES 256
+// requests in the ring at once, each takes at most two entries
+#define CCA_IO_DEPTH 64
+#define CCA_IO_THREADS 4
+#define CCA_IO_WAIT_NANOSECONDS 2000000
+
+// what a completion belongs to, in the low bits of its user data
+#define CCA_IO_TAG_STEP 0
+#define CCA_IO_TAG_STATX 1
+#define CCA_IO_TAG_CLOSE 2
+#define CCA_IO_TAG_WAKE 3
+
+typedef struct cca_io_request {
+	char type;
+	char* name;
+	// permissions of a stored file
+	int mode;
+	// what a load read and what a store writes, the bytes of a store are freed once they are written
+	cca_file_content content;
+	cca_bytecode* bytecode;
+	BOOL ok;
+	_Atomic BOOL done;
+	// when the thread that does it took it up, for its span in the trace
+	double started;
+
+	// how far the ring got with it
+	int fd;
+	unsigned int pending;
+	unsigned int size;
+	unsigned int position;
+	struct statx info;
+	struct cca_io_request* next;
+} cca_io_request;
+
+typedef struct cca_io {
+	BOOL uring;
+	pthread_mutex_t lock;
+	pthread_cond_t queued;
+	pthread_cond_t finished;
+	cca_io_request* queue;
+	cca_io_request* queueTail;
+	_Atomic unsigned int outstanding;
+	BOOL closing;
+	// every thread doing i/o records a load or write span per file in it, NULL without --trace
+	cca_trace* trace;
+
+	// thread pool
+	pthread_t threads[CCA_IO_THREADS];
+	unsigned int threadCount;
+
+	// io_uring, the rings are shared with the kernel
+	int ring;
+	int wake;
+	unsigned long long wakeCount;
+	unsigned int active;
+	unsigned int toSubmit;
+	void* sqMemory;
+	size_t sqMemorySize;
+	void* cqMemory;
+	size_t cqMemorySize;
+	struct io_uring_sqe* sqes;
+	size_t sqesSize;
+	_Atomic unsigned int* sqHead;
+	_Atomic unsigned int* sqTail;
+	unsigned int* sqArray;
+	unsigned int sqMask;
+	unsigned int sqEntries;
+	_Atomic unsigned int* cqHead;
+	_Atomic unsigned int* cqTail;
+	struct io_uring_cqe* cqes;
+	unsigned int cqMask;
+} cca_io;
+
+// the blocking way, for the thread pool and whatever the ring doesn't take
+void cca_io_run(cca_io_request* request) {
+	request->started = cca_trace_now();
+	if (request->type == CCA_IO_LOAD)
+		request->ok = cca_load_file(request->name, &request->content);
+	else
+		request->ok = cca_bytecode_store(request->bytecode, request->name, request->mode);
+}
+
+void cca_io_complete(cca_io* io, cca_io_request* request) {
+	cca_trace_span(request->type == CCA_IO_LOAD ? "load" : "write", request->name, request->started);
+	if (request->type == CCA_IO_STORE)
+		cca_bytecode_free(request->bytecode);
+
+	pthread_mutex_lock(&io->lock);
+	atomic_store(&request->done, TRUE);
+	pthread_cond_broadcast(&io->finished);
+	pthread_mutex_unlock(&io->lock);
+	atomic_fetch_sub(&io->outstanding, 1);
+}
+
+void* cca_io_thread(void* argument) {
+	cca_io* io = argument;
+	if (io->trace != NULL)
+		cca_trace_thread(io->trace, "io thread");
+
+	while (TRUE) {
+		pthread_mutex_lock(&io->lock);
+		while (io->queue == NULL && !io->closing)
+			pthread_cond_wait(&io->queued, &io->lock);
+		cca_io_request* request = io->queue;
+		if (request != NULL) {
+			io->queue = request->next;
+			if (io->queue == NULL)
+				io->queueTail = NULL;
+		}
+		pthread_mutex_unlock(&io->lock);
+
+		if (request == NULL)
+			return NULL;
+		cca_io_run(request);
+		cca_io_complete(io, request);
+	}
+}
+
+struct io_uring_sqe* cca_io_uring_sqe(cca_io* io, cca_io_request* request, unsigned char opcode, unsigned int tag) {
+	unsigned int tail = atomic_load_explicit(io->sqTail, memory_order_relaxed);
+	unsigned int index = tail & io->sqMask;
+
+	// the kernel takes the entries off the ring as they are submitted
+	if (tail - atomic_load_explicit(io->sqHead, memory_order_acquire) >= io->sqEntries) {
+		long submitted = syscall(SYS_io_uring_enter, io->ring, io->toSubmit, 0, 0, NULL, 0);
+		if (submitted > 0)
+			io->toSubmit -= submitted;
+	}
+
+	struct io_uring_sqe* sqe = &io->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = opcode;
+	sqe->user_data = (unsigned long long) (size_t) request | tag;
+	io->sqArray[index] = index;
+	atomic_store_explicit(io->sqTail, tail + 1, memory_order_release);
+	++io->toSubmit;
+	return sqe;
+}
+
+void cca_io_uring_wake(cca_io* io) {
+	struct io_uring_sqe* sqe = cca_io_uring_sqe(io, NULL, IORING_OP_READ, CCA_IO_TAG_WAKE);
+	sqe->fd = io->wake;
+	sqe->addr = (unsigned long long) (size_t) &io->wakeCount;
+	sqe->len = sizeof(io->wakeCount);
+}
+
+BOOL cca_io_uring_open(cca_io* io) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	io->ring = syscall(SYS_io_uring_setup, CCA_IO_ENTRIES, &params);
+	if (io->ring < 0)
+		return FALSE;
+
+	// every operation this needs, and waiting with a timeout
+	struct io_uring_probe* probe = calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+	BOOL supported = syscall(SYS_io_uring_register, io->ring, IORING_REGISTER_PROBE, probe, 256) == 0
+		&& (params.features & IORING_FEAT_EXT_ARG) != 0;
+	unsigned char operations[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE };
+	for (int i = 0; supported && i < sizeof(operations); i++) {
+		if (operations[i] > probe->last_op || !(probe->ops[operations[i]].flags & IO_URING_OP_SUPPORTED))
+			supported = FALSE;
+	}
+	free(probe);
+
+	io->wake = supported ? eventfd(0, EFD_CLOEXEC) : -1;
+	if (io->wake < 0) {
+		close(io->ring);
+		return FALSE;
+	}
+
+	io->sqMemorySize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	io->cqMemorySize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (io->cqMemorySize > io->sqMemorySize)
+			io->sqMemorySize = io->cqMemorySize;
+		io->cqMemorySize = 0;
+	}
+
+	io->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	io->sqMemory = mmap(NULL, io->sqMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring, IORING_OFF_SQ_RING);
+	io->cqMemory = io->cqMemorySize == 0 ? io->sqMemory
+		: mmap(NULL, io->cqMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring, IORING_OFF_CQ_RING);
+	io->sqes = mmap(NULL, io->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring, IORING_OFF_SQES);
+	if (io->sqMemory == MAP_FAILED || io->cqMemory == MAP_FAILED || io->sqes == MAP_FAILED) {
+		close(io->wake);
+		close(io->ring);
+		return FALSE;
+	}
+
+	char* sq = io->sqMemory;
+	char* cq = io->cqMemory;
+	io->sqHead = (_Atomic unsigned int*) (sq + params.sq_off.head);
+	io->sqTail = (_Atomic unsigned int*) (sq + params.sq_off.tail);
+	io->sqArray = (unsigned int*) (sq + params.sq_off.array);
+	io->sqMask = *(unsigned int*) (sq + params.sq_off.ring_mask);
+	io->sqEntries = params.sq_entries;
+	io->cqHead = (_Atomic unsigned int*) (cq + params.cq_off.head);
+	io->cqTail = (_Atomic unsigned int*) (cq + params.cq_off.tail);
+	io->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+	io->cqMask = *(unsigned int*) (cq + params.cq_off.ring_mask);
+
+	cca_io_uring_wake(io);
+	return TRUE;
+}
+
+// threads are only used when uring is FALSE or io_uring can't be had, returns whether it is io_uring. the thread
+// that polls records its own spans once it called cca_trace_thread
+BOOL cca_io_open(cca_io* io, BOOL uring, cca_trace* trace) {
+	memset(io, 0, sizeof(cca_io));
+	io->trace = trace;
+	pthread_mutex_init(&io->lock, NULL);
+	pthread_cond_init(&io->queued, NULL);
+	pthread_cond_init(&io->finished, NULL);
+
+	io->uring = uring && cca_io_uring_open(io);
+	if (io->uring)
+		return TRUE;
+
+	for (; io->threadCount < CCA_IO_THREADS; io->threadCount++) {
+		if (pthread_create(&io->threads[io->threadCount], NULL, cca_io_thread, io) != 0)
+			break;
+	}
+	if (io->threadCount == 0)
+		puts("[WARNING] could not start any i/o threads, files are read and written as they are needed");
+	return FALSE;
+}
+
+void cca_io_queue(cca_io* io, cca_io_request* request) {
+	atomic_store(&request->done, FALSE);
+	request->next = NULL;
+	atomic_fetch_add(&io->outstanding, 1);
+
+	// nobody would pick it up
+	if (!io->uring && io->threadCount == 0) {
+		cca_io_run(request);
+		cca_io_complete(io, request);
+		return;
+	}
+
+	pthread_mutex_lock(&io->lock);
+	if (io->queueTail != NULL)
+		io->queueTail->next = request;
+	else
+		io->queue = request;
+	io->queueTail = request;
+	pthread_cond_signal(&io->queued);
+	pthread_mutex_unlock(&io->lock);
+
+	if (io->uring) {
+		unsigned long long one = 1;
+		if (write(io->wake, &one, sizeof(one)) < 0)
+			puts("[WARNING] could not wake the i/o thread");
+	}
+}
+
+void cca_io_load(cca_io* io, cca_io_request* request, char* name) {
+	request->type = CCA_IO_LOAD;
+	request->name = name;
+	cca_io_queue(io, request);
+}
+
+void cca_io_store(cca_io* io, cca_io_request* request, char* name, cca_bytecode* bytecode, int mode) {
+	request->type = CCA_IO_STORE;
+	request->name = name;
+	request->bytecode = bytecode;
+	request->mode = mode;
+	cca_io_queue(io, request);
+}
+
+void cca_io_wait(cca_io* io, cca_io_request* request) {
+	if (atomic_load(&request->done))
+		return;
+
+	pthread_mutex_lock(&io->lock);
+	while (!atomic_load(&request->done))
+		pthread_cond_wait(&io->finished, &io->lock);
+	pthread_mutex_unlock(&io->lock);
+}
+
+void cca_io_uring_finish(cca_io* io, cca_io_request* request, BOOL ok) {
+	if (request->fd >= 0) {
+		struct io_uring_sqe* sqe = cca_io_uring_sqe(io, NULL, IORING_OP_CLOSE, CCA_IO_TAG_CLOSE);
+		sqe->fd = request->fd;
+	}
+
+	request->ok = ok;
+	--io->active;
+	cca_io_complete(io, request);
+}
+
+// the next read or write of whatever is left
+void cca_io_uring_transfer(cca_io* io, cca_io_request* request) {
+	struct io_uring_sqe* sqe = cca_io_uring_sqe(io, request, request->type == CCA_IO_LOAD ? IORING_OP_READ : IORING_OP_WRITE, CCA_IO_TAG_STEP);
+	char* bytes = request->type == CCA_IO_LOAD ? request->content.content : request->bytecode->bytecode;
+	sqe->fd = request->fd;
+	sqe->addr = (unsigned long long) (size_t) (bytes + request->position);
+	sqe->len = request->size - request->position;
+	sqe->off = request->position;
+	request->pending = 1;
+}
+
+void cca_io_uring_start(cca_io* io, cca_io_request* request) {
+	request->started = cca_trace_now();
+	request->fd = -1;
+	request->position = 0;
+	request->ok = TRUE;
+
+	if (request->type == CCA_IO_STORE && request->bytecode->spliceCount != 0) {
+		cca_io_run(request);
+		cca_io_complete(io, request);
+		return;
+	}
+
+	++io->active;
+	struct io_uring_sqe* sqe = cca_io_uring_sqe(io, request, IORING_OP_OPENAT, CCA_IO_TAG_STEP);
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long long) (size_t) request->name;
+	sqe->open_flags = request->type == CCA_IO_LOAD ? O_RDONLY | O_CLOEXEC : O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	sqe->len = request->mode;
+	request->pending = 1;
+
+	// the size comes alongside, so the read goes out as soon as the file is open
+	if (request->type == CCA_IO_LOAD) {
+		sqe = cca_io_uring_sqe(io, request, IORING_OP_STATX, CCA_IO_TAG_STATX);
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long long) (size_t) request->name;
+		sqe->len = STATX_SIZE;
+		sqe->off = (unsigned long long) (size_t) &request->info;
+		request->pending = 2;
+	} else {
+		request->size = request->bytecode->bytecodeLength;
+	}
+}
+
+void cca_io_uring_step(cca_io* io, cca_io_request* request, unsigned int tag, int result) {
+	if (tag == CCA_IO_TAG_STATX) {
+		request->size = request->info.stx_size;
+		if (result < 0)
+			request->ok = FALSE;
+	} else if (request->fd < 0) {
+		// the open, a failed one leaves fd negative
+		if (result < 0) {
+			printf("[ERROR] could not %s file: %s\n", request->type == CCA_IO_LOAD ? "open" : "write", request->name);
+			request->ok = FALSE;
+		}
+		request->fd = result;
+	} else if (result < 0) {
+		printf("[ERROR] could not %s file: %s\n", request->type == CCA_IO_LOAD ? "read" : "write", request->name);
+		if (request->type == CCA_IO_LOAD)
+			free(request->content.content);
+		cca_io_uring_finish(io, request, FALSE);
+		return;
+	} else {
+		// a read that ends early means the file got shorter
+		request->position += result;
+		if (result == 0 && request->type == CCA_IO_LOAD)
+			request->size = request->position;
+		if (result == 0 && request->position < request->size) {
+			printf("[ERROR] could not write file: %s\n", request->name);
+			cca_io_uring_finish(io, request, FALSE);
+			return;
+		}
+	}
+
+	if (--request->pending != 0)
+		return;
+
+	if (!request->ok) {
+		if (request->fd >= 0)
+			printf("[ERROR] could not read file: %s\n", request->name);
+		cca_io_uring_finish(io, request, FALSE);
+		return;
+	}
+
+	if (request->type == CCA_IO_LOAD && request->content.content == NULL)
+		request->content.content = malloc(request->size + 1);
+
+	if (request->position < request->size) {
+		cca_io_uring_transfer(io, request);
+		return;
+	}
+
+	if (request->type == CCA_IO_LOAD) {
+		request->content.content[request->size] = '\0';
+		request->content.fileSize = request->size;
+	}
+	cca_io_uring_finish(io, request, TRUE);
+}
+
+// moves whatever can be moved, waits up to CCA_IO_WAIT_NANOSECONDS for something to happen. only one thread polls
+void cca_io_poll(cca_io* io) {
+	if (!io->uring) {
+		struct timespec pause = { 0, CCA_IO_WAIT_NANOSECONDS };
+		nanosleep(&pause, NULL);
+		return;
+	}
+
+	pthread_mutex_lock(&io->lock);
+	while (io->queue != NULL && io->active < CCA_IO_DEPTH) {
+		cca_io_request* request = io->queue;
+		io->queue = request->next;
+		if (io->queue == NULL)
+			io->queueTail = NULL;
+		request->content.content = NULL;
+
+		// completing takes the lock
+		pthread_mutex_unlock(&io->lock);
+		cca_io_uring_start(io, request);
+		pthread_mutex_lock(&io->lock);
+	}
+	pthread_mutex_unlock(&io->lock);
+
+	struct __kernel_timespec timeout = { 0, CCA_IO_WAIT_NANOSECONDS };
+	struct io_uring_getevents_arg arguments = { 0, _NSIG / 8, 0, (unsigned long long) (size_t) &timeout };
+	long submitted = syscall(SYS_io_uring_enter, io->ring, io->toSubmit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+		&arguments, sizeof(arguments));
+	if (submitted > 0)
+		io->toSubmit -= submitted;
+
+	unsigned int head = atomic_load_explicit(io->cqHead, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(io->cqTail, memory_order_acquire);
+	for (; head != tail; head++) {
+		struct io_uring_cqe* cqe = &io->cqes[head & io->cqMask];
+		cca_io_request* request = (cca_io_request*) (size_t) (cqe->user_data & ~3ull);
+		unsigned int tag = cqe->user_data & 3;
+		int result = cqe->res;
+
+		// let the kernel have the entry back before more go out
+		atomic_store_explicit(io->cqHead, head + 1, memory_order_release);
+		if (tag == CCA_IO_TAG_WAKE)
+			cca_io_uring_wake(io);
+		else if (tag != CCA_IO_TAG_CLOSE)
+			cca_io_uring_step(io, request, tag, result);
+	}
+}
+
+// waits for the requests still out and stops the threads
+void cca_io_close(cca_io* io) {
+	while (atomic_load(&io->outstanding) != 0)
+		cca_io_poll(io);
+
+	if (io->uring) {
+		// the closes still in the ring
+		syscall(SYS_io_uring_enter, io->ring, io->toSubmit, 0, 0, NULL, 0);
+		munmap(io->sqes, io->sqesSize);
+		if (io->cqMemory != io->sqMemory)
+			munmap(io->cqMemory, io->cqMemorySize);
+		munmap(io->sqMemory, io->sqMemorySize);
+		close(io->wake);
+		close(io->ring);
+	}
+
+	pthread_mutex_lock(&io->lock);
+	io->closing = TRUE;
+	pthread_cond_broadcast(&io->queued);
+	pthread_mutex_unlock(&io->lock);
+	for (unsigned int i = 0; i < io->threadCount; i++)
+		pthread_join(io->threads[i], NULL);
+
+	pthread_mutex_destroy(&io->lock);
+	pthread_cond_destroy(&io->queued);
+	pthread_cond_destroy(&io->finished);
+}
+
+#endif
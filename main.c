@@ -1,22 +1,217 @@
 #include <stdio.h>
 #include <string.h>
 #include "assembler.h"
+#include "batch.h"
+
+#ifdef __GLIBC__
+// counts the allocations for --stats, they still go to the glibc allocator
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* pointer, size_t size);
+
+void* malloc(size_t size) {
+	++cca_malloc_count;
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+	++cca_malloc_count;
+	return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+	++cca_realloc_count;
+	return __libc_realloc(pointer, size);
+}
+#endif
 
 int main(int argc, char* argv[]) {
-	if (argc > 1) {
-		if (argc > 2 && (strcmp(argv[1], "-w") == 0 || strcmp(argv[1], "--watch") == 0)) {
+#ifdef __GLIBC__
+	cca_allocations_counted = TRUE;
+#endif
+	cca_options options = {0};
+	cca_stats stats = {0};
+	cca_trace trace;
+	char* traceName = NULL;
+	unsigned int jobs = 1;
+	unsigned int fileCount = 0;
+	BOOL watch = FALSE;
+	BOOL printStats = FALSE;
+	BOOL perfCounters = FALSE;
+	BOOL uring = TRUE;
+	cca_report report = {0};
+	BOOL printReport = FALSE;
+	FILE* reportFile = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--watch") == 0) {
+			watch = TRUE;
+		} else if (strcmp(argv[i], "-O") == 0) {
+			// every optimization pass
+			options.foldIdenticalCode = TRUE;
+			options.foldConstants = TRUE;
+			options.optimizeData = TRUE;
+		} else if (strcmp(argv[i], "--icf") == 0) {
+			options.foldIdenticalCode = TRUE;
+		} else if (strcmp(argv[i], "--fold-constants") == 0) {
+			options.foldConstants = TRUE;
+		} else if (strcmp(argv[i], "--optimize-data") == 0) {
+			options.optimizeData = TRUE;
+		} else if (strcmp(argv[i], "--encoding=compact") == 0) {
+			options.encoding = CCA_ENCODING_COMPACT;
+		} else if (strcmp(argv[i], "--encoding=wide") == 0) {
+			options.encoding = CCA_ENCODING_WIDE;
+		} else if (strcmp(argv[i], "--encoding=standard") == 0) {
+			options.encoding = CCA_ENCODING_STANDARD;
+		} else if (strcmp(argv[i], "--flat") == 0) {
+			// the old output without a container
+			options.flat = TRUE;
+		} else if (strcmp(argv[i], "--emit-native") == 0) {
+			// an x86-64 executable instead of bytecode
+			options.native = TRUE;
+		} else if (strncmp(argv[i], "--fuse=", 7) == 0) {
+			// superinstructions, all of them or a list like cmp-num-je,inc-cmp-jne
+			if (!cca_fusion_parse(argv[i] + 7, &options.fusions))
+				return 1;
+		} else if (strcmp(argv[i], "-g") == 0 || strcmp(argv[i], "--debug-info") == 0) {
+			// a line table, in the container or next to flat output as test.ccmap
+			options.debugInfo = TRUE;
+		} else if (strcmp(argv[i], "--dump-tokens") == 0) {
+			options.dumpTokens = TRUE;
+		} else if (strcmp(argv[i], "--stats") == 0) {
+			// time, work and allocations of every phase
+			options.stats = &stats;
+			printStats = TRUE;
+		} else if (strcmp(argv[i], "--perf-counters") == 0) {
+			// cycles, instructions and misses of every phase
+			options.stats = &stats;
+			perfCounters = TRUE;
+		} else if (strcmp(argv[i], "--report") == 0) {
+			// opcodes, forms and routines of the code
+			options.report = &report;
+			printReport = TRUE;
+		} else if (strncmp(argv[i], "--report-csv=", 13) == 0) {
+			// the same appended to a csv, for every module of a build
+			options.report = &report;
+			reportFile = fopen(argv[i] + 13, "a");
+			if (reportFile == NULL) {
+				printf("[ERROR] could not write the report to '%s'\n", argv[i] + 13);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			// - writes to stdout
+			options.outputName = argv[++i];
+		} else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			// a timeline of every file and phase for perfetto
+			traceName = argv[++i];
+		} else if (strncmp(argv[i], "-j", 2) == 0) {
+			// files assembled at once, -j4 or -j 4
+			char* count = argv[i][2] != '\0' ? argv[i] + 2 : i + 1 < argc ? argv[++i] : "1";
+			jobs = strtoul(count, NULL, 10);
+			if (jobs == 0)
+				jobs = 1;
+		} else if (strcmp(argv[i], "--io=threads") == 0) {
+			// blocking i/o on a few threads instead of io_uring for many files
+			uring = FALSE;
+		} else if (strcmp(argv[i], "--block-index") == 0) {
+			options.blockIndex = TRUE;
+		} else if (strncmp(argv[i], "--spill-base=", 13) == 0) {
+			options.spillBase = strtoul(argv[i] + 13, NULL, 0);
+		} else if (argv[i][0] != '-' || argv[i][1] == '\0') {
+			// - reads from stdin
+			argv[fileCount++] = argv[i];
+		} else {
+			printf("[WARNING] unknown option '%s'\n", argv[i]);
+		}
+	}
+
+	if (traceName != NULL && !cca_trace_open(&trace, traceName))
+		return 1;
+
+	// the output gets stdout to itself, everything that is printed goes to stderr
+	if (options.outputName != NULL && strcmp(options.outputName, "-") == 0) {
+		fflush(stdout);
+		cca_standard_output = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	}
+
+	if (fileCount == 1) {
+		char* fileName = argv[0];
+		options.sourceName = fileName;
+		if (perfCounters)
+			cca_stats_perf_open(&stats);
+		if (traceName != NULL)
+			cca_trace_thread(&trace, "main");
+
+		if (watch) {
 			// watching
-			printf("watching %s...\n", argv[2]);
+			printf("watching %s...\n", fileName);
 		} else {
 			// assembling
-			printf("assembling '%s'\n", argv[1]);
-			if (cca_assemble(argv[1])) {
+			printf("assembling '%s'\n", fileName);
+			cca_trace_begin(fileName, fileName);
+			if (cca_assemble(fileName, &options)) {
 				puts("done!");
 			} else {
 				puts("failed to assemble due to errors");
 			}
+			cca_trace_end();
+
+			if (printStats)
+				cca_stats_print(&stats);
+			if (perfCounters)
+				cca_stats_print_perf(&stats);
+			cca_stats_perf_close(&stats);
+			if (printReport)
+				cca_report_print(&report);
+			if (reportFile != NULL)
+				cca_report_csv(&report, reportFile);
+			cca_report_free(&report);
 		}
+	} else if (fileCount > 1) {
+		// every file into its own <name>.ccb
+		if (options.outputName != NULL)
+			puts("[WARNING] -o names the output of a single file, every file gets its own name");
+		cca_batch batch = {0};
+		batch.files = calloc(fileCount, sizeof(cca_batch_file));
+		batch.fileCount = fileCount;
+		batch.options = &options;
+		batch.trace = traceName != NULL ? &trace : NULL;
+		batch.perfCounters = perfCounters;
+		batch.uring = uring;
+		for (unsigned int i = 0; i < fileCount; i++) {
+			batch.files[i].source = argv[i];
+			batch.files[i].output = cca_output_name(argv[i], options.native ? "" : ".ccb");
+		}
+
+		printf("assembling %u files on %u threads\n", fileCount, jobs < fileCount ? jobs : fileCount);
+		unsigned int assembled = cca_assemble_batch(&batch, jobs);
+
+		for (unsigned int i = 0; i < fileCount; i++) {
+			cca_batch_file* file = &batch.files[i];
+			if (!file->ok)
+				printf("failed to assemble '%s' due to errors\n", file->source);
+			if (printStats || perfCounters || printReport)
+				printf("%s:\n", file->source);
+			if (printStats)
+				cca_stats_print(&file->stats);
+			if (perfCounters)
+				cca_stats_print_perf(&file->stats);
+			if (printReport)
+				cca_report_print(&file->report);
+			if (reportFile != NULL)
+				cca_report_csv(&file->report, reportFile);
+			cca_report_free(&file->report);
+			free(file->output);
+		}
+		printf("assembled %u of %u files, i/o through %s\n", assembled, fileCount, batch.uring ? "io_uring" : "threads");
+		free(batch.files);
 	}
 
+	if (traceName != NULL)
+		cca_trace_close(&trace);
+	if (reportFile != NULL)
+		fclose(reportFile);
+
 	return 1;
-}
\ No newline at end of file
+}
@@ -0,0 +1,537 @@
+#ifndef ccvm_assembler_native
+#define ccvm_assembler_native
+
+// native x86-64 backend, included by assembler.h
+//
+// translates the program into a static linux elf executable without any outside tools. registers a-d live in
+// r12d-r15d, the value stack is a region rbx points into, memory is a mapped array rbp points at with the data
+// section at address 0, and call and ret use the native stack for return addresses. compares keep their flags in
+// r10 (frs and the start clear it to 0) so instructions between a cmp and its jump can't destroy them, a jump right
+// after its cmp uses the host flags directly. the stack isn't checked, so only verified programs are safe. a small
+// runtime handles stp, division by zero and the syscall stubs ccvm-run has
+#define CCA_NATIVE_TEXT_ADDRESS 0x400000
+#define CCA_NATIVE_MEMORY_ADDRESS 0x10000000
+#define CCA_NATIVE_MEMORY_SIZE (1 << 20)
+#define CCA_NATIVE_STACK_SIZE (1 << 18)
+#define CCA_NATIVE_ELF_HEADERS (64 + 2 * 56)
+
+#define CCA_NATIVE_RAX 0
+#define CCA_NATIVE_RCX 1
+#define CCA_NATIVE_RDX 2
+#define CCA_NATIVE_RBX 3
+#define CCA_NATIVE_RBP 5
+#define CCA_NATIVE_R10 10
+#define CCA_NATIVE_REGISTER(r) (12 + (r))
+
+// jumps into the runtime instead of to an instruction
+#define CCA_NATIVE_STOP 0xfffffff0
+#define CCA_NATIVE_ERROR 0xfffffff1
+#define CCA_NATIVE_SYSCALL 0xfffffff2
+
+typedef struct cca_native_fixup {
+	unsigned int at;
+	unsigned int target;
+} cca_native_fixup;
+
+typedef struct cca_native {
+	cca_bytecode text;
+	cca_native_fixup* fixups;
+	unsigned int fixupCount;
+	unsigned int fixupCapacity;
+} cca_native;
+
+void cca_native_rex(cca_native* native, BOOL wide, unsigned int reg, unsigned int rm) {
+	unsigned char rex = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0);
+	if (rex != 0x40)
+		cca_bytecode_add_byte(&native->text, rex);
+}
+
+// 'op rm, reg' between two 32 bit registers
+void cca_native_rr(cca_native* native, unsigned char opcode, unsigned int reg, unsigned int rm) {
+	cca_native_rex(native, FALSE, reg, rm);
+	cca_bytecode_add_byte(&native->text, opcode);
+	cca_bytecode_add_byte(&native->text, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// the forms that take an opcode extension instead of a second register
+void cca_native_group(cca_native* native, unsigned char opcode, unsigned int digit, unsigned int rm) {
+	cca_native_rr(native, opcode, digit, rm);
+}
+
+// 'op reg, [rbp + address]' and the other way around
+void cca_native_memory(cca_native* native, unsigned char opcode, unsigned int reg, unsigned int address) {
+	cca_native_rex(native, FALSE, reg, 0);
+	cca_bytecode_add_byte(&native->text, opcode);
+	cca_bytecode_add_byte(&native->text, 0x85 | (reg & 7) << 3);
+	cca_bytecode_add_uint_le(&native->text, address);
+}
+
+// 'op reg, [rbx + displacement]', the value stack
+void cca_native_stack(cca_native* native, unsigned char opcode, unsigned int reg, char displacement) {
+	cca_native_rex(native, FALSE, reg, 0);
+	cca_bytecode_add_byte(&native->text, opcode);
+	cca_bytecode_add_byte(&native->text, 0x43 | (reg & 7) << 3);
+	cca_bytecode_add_byte(&native->text, displacement);
+}
+
+void cca_native_bytes(cca_native* native, char* bytes, unsigned int length) {
+	cca_bytecode_add_bytes(&native->text, bytes, length);
+}
+
+void cca_native_bswap(cca_native* native, unsigned int reg) {
+	cca_native_rex(native, FALSE, 0, reg);
+	cca_bytecode_add_byte(&native->text, 0x0f);
+	cca_bytecode_add_byte(&native->text, 0xc8 | (reg & 7));
+}
+
+void cca_native_push_slot(cca_native* native) {
+	// add rbx, 4
+	cca_native_bytes(native, "\x48\x83\xc3\x04", 4);
+}
+
+void cca_native_pop_slot(cca_native* native) {
+	// sub rbx, 4
+	cca_native_bytes(native, "\x48\x83\xeb\x04", 4);
+}
+
+// a 32 bit relative jump or call to an instruction or the runtime, patched once everything is placed
+void cca_native_branch(cca_native* native, char* opcode, unsigned int length, unsigned int target) {
+	cca_native_bytes(native, opcode, length);
+
+	++native->fixupCount;
+	if (native->fixupCount >= native->fixupCapacity) {
+		native->fixupCapacity *= 2;
+		native->fixups = realloc(native->fixups, native->fixupCapacity * sizeof(cca_native_fixup));
+	}
+	native->fixups[native->fixupCount - 1].at = native->text.bytecodeLength;
+	native->fixups[native->fixupCount - 1].target = target;
+
+	cca_bytecode_add_uint_le(&native->text, 0);
+}
+
+// short jumps inside the runtime
+unsigned int cca_native_jump_short(cca_native* native, unsigned char opcode) {
+	cca_bytecode_add_byte(&native->text, opcode);
+	cca_bytecode_add_byte(&native->text, 0);
+	return native->text.bytecodeLength - 1;
+}
+
+void cca_native_land_short(cca_native* native, unsigned int at) {
+	native->text.bytecode[at] = native->text.bytecodeLength - (at + 1);
+}
+
+void cca_native_jump_back(cca_native* native, unsigned char opcode, unsigned int to) {
+	cca_bytecode_add_byte(&native->text, opcode);
+	cca_bytecode_add_byte(&native->text, to - (native->text.bytecodeLength + 1));
+}
+
+void cca_native_save_flags(cca_native* native) {
+	// pushfq, pop r10
+	cca_native_bytes(native, "\x9c\x41\x5a", 3);
+}
+
+void cca_native_divide(cca_native* native, unsigned int divisor) {
+	// test divisor, divisor / jz error / xor edx, edx / div divisor
+	cca_native_rr(native, 0x85, divisor, divisor);
+	cca_native_branch(native, "\x0f\x84", 2, CCA_NATIVE_ERROR);
+	cca_native_bytes(native, "\x31\xd2", 2);
+	cca_native_group(native, 0xf7, 6, divisor);
+}
+
+unsigned char cca_native_alu(unsigned char opcode) {
+	switch (opcode) {
+		case CCA_OP_ADD_REG: case CCA_OP_ADD: return 0x01;
+		case CCA_OP_SUB_REG: case CCA_OP_SUB: return 0x29;
+		case CCA_OP_AND_REG: case CCA_OP_AND: return 0x21;
+		case CCA_OP_OR_REG: case CCA_OP_OR: return 0x09;
+		default: return 0x31;
+	}
+}
+
+// jcc opcodes and the bit of the saved flags each one tests
+unsigned char cca_native_condition(unsigned char opcode) {
+	switch (opcode) {
+		case CCA_OP_JE: return 0x84;
+		case CCA_OP_JNE: return 0x85;
+		case CCA_OP_JG: return 0x8f;
+		case CCA_OP_JS: return 0x88;
+		default: return 0x80;
+	}
+}
+
+unsigned int cca_native_flag(unsigned char opcode) {
+	switch (opcode) {
+		case CCA_OP_JE: case CCA_OP_JNE: return 0x40;
+		case CCA_OP_JS: return 0x80;
+		default: return 0x800;
+	}
+}
+
+BOOL cca_native_instruction(cca_native* native, cca_program* program, cca_block_list* blocks, unsigned int index, unsigned int* targets) {
+	cca_instruction* instruction = &program->instructions[index];
+	int target = cca_opcode_target(instruction->opcode);
+
+	// a label anywhere but in the target of a branch is the address it stands for, like the vm reads it
+	cca_operand operands[CCA_MAX_OPERANDS];
+	for (int i = 0; i < CCA_MAX_OPERANDS; i++) {
+		operands[i] = instruction->operands[i];
+		if (operands[i].type == CCA_OPERAND_MARKER && i != target) {
+			operands[i].type = CCA_OPERAND_ADDRESS;
+			operands[i].value = program->markers[operands[i].value].marks + operands[i].offset;
+		}
+	}
+	unsigned int first = CCA_NATIVE_REGISTER(operands[0].value);
+	unsigned int second = CCA_NATIVE_REGISTER(operands[1].value);
+
+	for (int i = 0; i < 2; i++) {
+		if (operands[i].type == CCA_OPERAND_ADDRESS && target < 0 && operands[i].value > CCA_NATIVE_MEMORY_SIZE - 4) {
+			printf("[ERROR] address %u is outside of memory\n", operands[i].value);
+			return FALSE;
+		}
+	}
+
+	switch (instruction->opcode) {
+		case CCA_OP_STP:
+			cca_native_branch(native, "\xe9", 1, CCA_NATIVE_STOP);
+			break;
+
+		case CCA_OP_PSH_NUM:
+			// mov dword [rbx], num
+			cca_native_bytes(native, "\xc7\x03", 2);
+			cca_bytecode_add_uint_le(&native->text, operands[0].value);
+			cca_native_push_slot(native);
+			break;
+		case CCA_OP_PSH_REG:
+			cca_native_stack(native, 0x89, first, 0);
+			cca_native_push_slot(native);
+			break;
+		case CCA_OP_PSH_ADDR:
+			cca_native_memory(native, 0x8b, CCA_NATIVE_RAX, operands[0].value);
+			cca_native_bswap(native, CCA_NATIVE_RAX);
+			cca_native_stack(native, 0x89, CCA_NATIVE_RAX, 0);
+			cca_native_push_slot(native);
+			break;
+		case CCA_OP_POP_REG:
+			cca_native_pop_slot(native);
+			cca_native_stack(native, 0x8b, first, 0);
+			break;
+		case CCA_OP_POP_ADDR:
+			cca_native_pop_slot(native);
+			cca_native_stack(native, 0x8b, CCA_NATIVE_RAX, 0);
+			cca_native_bswap(native, CCA_NATIVE_RAX);
+			cca_native_memory(native, 0x89, CCA_NATIVE_RAX, operands[0].value);
+			break;
+		case CCA_OP_DUP:
+			cca_native_stack(native, 0x8b, CCA_NATIVE_RAX, -4);
+			cca_native_stack(native, 0x89, CCA_NATIVE_RAX, 0);
+			cca_native_push_slot(native);
+			break;
+
+		case CCA_OP_MOV_REG_NUM:
+			cca_native_rex(native, FALSE, 0, first);
+			cca_bytecode_add_byte(&native->text, 0xb8 | (first & 7));
+			cca_bytecode_add_uint_le(&native->text, operands[1].value);
+			break;
+		case CCA_OP_MOV_ADDR_NUM:
+			// mov dword [rbp + address], num with the number already in memory order
+			cca_native_bytes(native, "\xc7\x85", 2);
+			cca_bytecode_add_uint_le(&native->text, operands[0].value);
+			cca_bytecode_add_uint(&native->text, operands[1].value);
+			break;
+		case CCA_OP_MOV_REG_ADDR:
+			cca_native_memory(native, 0x8b, first, operands[1].value);
+			cca_native_bswap(native, first);
+			break;
+		case CCA_OP_MOV_ADDR_REG:
+			cca_native_rr(native, 0x89, second, CCA_NATIVE_RAX);
+			cca_native_bswap(native, CCA_NATIVE_RAX);
+			cca_native_memory(native, 0x89, CCA_NATIVE_RAX, operands[0].value);
+			break;
+		case CCA_OP_MOV_REG_REG:
+			cca_native_rr(native, 0x89, second, first);
+			break;
+
+		case CCA_OP_ADD_REG: case CCA_OP_SUB_REG: case CCA_OP_AND_REG: case CCA_OP_OR_REG: case CCA_OP_XOR_REG:
+			cca_native_rr(native, cca_native_alu(instruction->opcode), second, first);
+			break;
+		case CCA_OP_MUL_REG:
+			// imul first, second
+			cca_native_rex(native, FALSE, first, second);
+			cca_native_bytes(native, "\x0f\xaf", 2);
+			cca_bytecode_add_byte(&native->text, 0xc0 | (first & 7) << 3 | (second & 7));
+			break;
+		case CCA_OP_DIV_REG:
+			cca_native_rr(native, 0x89, first, CCA_NATIVE_RAX);
+			cca_native_divide(native, second);
+			cca_native_rr(native, 0x89, CCA_NATIVE_RAX, first);
+			break;
+		case CCA_OP_NOT_REG: cca_native_group(native, 0xf7, 2, first); break;
+		case CCA_OP_INC_REG: cca_native_group(native, 0xff, 0, first); break;
+		case CCA_OP_DEC_REG: cca_native_group(native, 0xff, 1, first); break;
+
+		case CCA_OP_ADD: case CCA_OP_SUB: case CCA_OP_AND: case CCA_OP_OR: case CCA_OP_XOR:
+			// y in eax, then 'op [rbx - 4], eax'
+			cca_native_pop_slot(native);
+			cca_native_stack(native, 0x8b, CCA_NATIVE_RAX, 0);
+			cca_native_stack(native, cca_native_alu(instruction->opcode), CCA_NATIVE_RAX, -4);
+			break;
+		case CCA_OP_MUL:
+			cca_native_pop_slot(native);
+			cca_native_stack(native, 0x8b, CCA_NATIVE_RAX, 0);
+			// imul eax, [rbx - 4]
+			cca_native_bytes(native, "\x0f\xaf\x43\xfc", 4);
+			cca_native_stack(native, 0x89, CCA_NATIVE_RAX, -4);
+			break;
+		case CCA_OP_DIV:
+			cca_native_pop_slot(native);
+			cca_native_stack(native, 0x8b, CCA_NATIVE_RCX, 0);
+			cca_native_stack(native, 0x8b, CCA_NATIVE_RAX, -4);
+			cca_native_divide(native, CCA_NATIVE_RCX);
+			cca_native_stack(native, 0x89, CCA_NATIVE_RAX, -4);
+			break;
+		case CCA_OP_NOT: cca_native_stack(native, 0xf7, 2, -4); break;
+		case CCA_OP_INC: cca_native_stack(native, 0xff, 0, -4); break;
+		case CCA_OP_DEC: cca_native_stack(native, 0xff, 1, -4); break;
+
+		case CCA_OP_CMP_REG_REG:
+			cca_native_rr(native, 0x39, second, first);
+			cca_native_save_flags(native);
+			break;
+		case CCA_OP_CMP_REG_NUM:
+			cca_native_group(native, 0x81, 7, first);
+			cca_bytecode_add_uint_le(&native->text, operands[1].value);
+			cca_native_save_flags(native);
+			break;
+		case CCA_OP_CMP_NUM:
+			cca_native_pop_slot(native);
+			cca_native_stack(native, 0x8b, CCA_NATIVE_RAX, 0);
+			// cmp eax, num
+			cca_bytecode_add_byte(&native->text, 0x3d);
+			cca_bytecode_add_uint_le(&native->text, operands[0].value);
+			cca_native_save_flags(native);
+			break;
+		case CCA_OP_FRS:
+			// xor r10d, r10d
+			cca_native_bytes(native, "\x45\x31\xd2", 3);
+			break;
+
+		case CCA_OP_JE: case CCA_OP_JNE: case CCA_OP_JG: case CCA_OP_JS: case CCA_OP_JO: {
+			char jcc[2] = { 0x0f, cca_native_condition(instruction->opcode) };
+			unsigned char previous = index > 0 ? program->instructions[index - 1].opcode : CCA_OP_STP;
+			BOOL afterCompare = previous == CCA_OP_CMP_REG_REG || previous == CCA_OP_CMP_REG_NUM || previous == CCA_OP_CMP_NUM;
+
+			if (afterCompare && blocks->blocks[blocks->blockOf[index]].start != index) {
+				cca_native_branch(native, jcc, 2, targets[index]);
+			} else if (instruction->opcode == CCA_OP_JG) {
+				// greater needs all of the flags back, unless they were cleared: test r10d, 2 / jz over / push r10 / popfq
+				cca_native_bytes(native, "\x41\xf7\xc2\x02\x00\x00\x00\x74\x09\x41\x52\x9d", 12);
+				cca_native_branch(native, jcc, 2, targets[index]);
+			} else {
+				// test r10d, flag
+				cca_native_bytes(native, "\x41\xf7\xc2", 3);
+				cca_bytecode_add_uint_le(&native->text, cca_native_flag(instruction->opcode));
+				jcc[1] = instruction->opcode == CCA_OP_JNE ? 0x84 : 0x85;
+				cca_native_branch(native, jcc, 2, targets[index]);
+			}
+			break;
+		}
+		case CCA_OP_JMP:
+			cca_native_branch(native, "\xe9", 1, targets[index]);
+			break;
+		case CCA_OP_CALL:
+			cca_native_branch(native, "\xe8", 1, targets[index]);
+			break;
+		case CCA_OP_RET:
+			cca_bytecode_add_byte(&native->text, 0xc3);
+			break;
+		case CCA_OP_SYSCALL:
+			cca_native_branch(native, "\xe8", 1, CCA_NATIVE_SYSCALL);
+			break;
+
+		default:
+			printf("[ERROR] '%s' has no native translation\n", cca_opcodes[instruction->opcode].mnemonic);
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+// stp, division by zero and syscall, returns where each of them starts
+void cca_native_runtime(cca_native* native, unsigned int* stop, unsigned int* error, unsigned int* syscall) {
+	// stop: xor edi, edi / jmp exit
+	*stop = native->text.bytecodeLength;
+	cca_native_bytes(native, "\x31\xff\xeb\x05", 4);
+	// error: mov edi, 1
+	*error = native->text.bytecodeLength;
+	cca_native_bytes(native, "\xbf\x01\x00\x00\x00", 5);
+	// exit: mov eax, 60 / syscall
+	unsigned int exit = native->text.bytecodeLength;
+	cca_native_bytes(native, "\xb8\x3c\x00\x00\x00\x0f\x05", 7);
+
+	// syscall stubs, the number is in r12d (a) and the argument in r13d (b)
+	*syscall = native->text.bytecodeLength;
+
+	// 0, exit: cmp r12d, 0 / jne / mov edi, r13d / jmp exit
+	cca_native_bytes(native, "\x41\x83\xfc\x00", 4);
+	unsigned int notExit = cca_native_jump_short(native, 0x75);
+	cca_native_bytes(native, "\x44\x89\xef", 3);
+	cca_native_jump_back(native, 0xeb, exit);
+	cca_native_land_short(native, notExit);
+
+	// 1, print the string at b: rsi = rbp + r13, rdx = its length
+	cca_native_bytes(native, "\x41\x83\xfc\x01", 4);
+	unsigned int notPrint = cca_native_jump_short(native, 0x75);
+	cca_native_bytes(native, "\x44\x89\xee\x48\x01\xee\x31\xd2", 8);
+	unsigned int scan = native->text.bytecodeLength;
+	// cmp byte [rsi + rdx], 0 / je / inc edx / jmp scan
+	cca_native_bytes(native, "\x80\x3c\x16\x00", 4);
+	unsigned int scanned = cca_native_jump_short(native, 0x74);
+	cca_native_bytes(native, "\xff\xc2", 2);
+	cca_native_jump_back(native, 0xeb, scan);
+	cca_native_land_short(native, scanned);
+	// write(1, rsi, rdx), a = 0
+	cca_native_bytes(native, "\xbf\x01\x00\x00\x00\xb8\x01\x00\x00\x00\x0f\x05\x45\x31\xe4\xc3", 16);
+	cca_native_land_short(native, notPrint);
+
+	// 2, print b as a number: digits go backwards into a buffer on the native stack
+	cca_native_bytes(native, "\x41\x83\xfc\x02", 4);
+	unsigned int notNumber = cca_native_jump_short(native, 0x75);
+	// sub rsp, 32 / lea rsi, [rsp + 32] / dec rsi / mov byte [rsi], 10 / mov eax, r13d / mov ecx, 10
+	cca_native_bytes(native, "\x48\x83\xec\x20\x48\x8d\x74\x24\x20\x48\xff\xce\xc6\x06\x0a\x44\x89\xe8\xb9\x0a\x00\x00\x00", 23);
+	unsigned int digit = native->text.bytecodeLength;
+	// xor edx, edx / div ecx / add dl, '0' / dec rsi / mov [rsi], dl / test eax, eax / jnz digit
+	cca_native_bytes(native, "\x31\xd2\xf7\xf1\x80\xc2\x30\x48\xff\xce\x88\x16\x85\xc0", 14);
+	cca_native_jump_back(native, 0x75, digit);
+	// lea rdx, [rsp + 32] / sub rdx, rsi / write(1, rsi, rdx) / add rsp, 32 / a = 0
+	cca_native_bytes(native, "\x48\x8d\x54\x24\x20\x48\x29\xf2\xbf\x01\x00\x00\x00\xb8\x01\x00\x00\x00\x0f\x05\x48\x83\xc4\x20\x45\x31\xe4\xc3", 28);
+	cca_native_land_short(native, notNumber);
+
+	// anything else: a = 0xffffffff
+	cca_native_bytes(native, "\x41\xbc\xff\xff\xff\xff\xc3", 7);
+}
+
+void cca_native_u16(cca_bytecode* bytecode, unsigned int n) {
+	cca_bytecode_add_byte(bytecode, n & 0xff);
+	cca_bytecode_add_byte(bytecode, (n >> 8) & 0xff);
+}
+
+void cca_native_u64(cca_bytecode* bytecode, unsigned long long n) {
+	cca_bytecode_add_uint_le(bytecode, n & 0xffffffff);
+	cca_bytecode_add_uint_le(bytecode, n >> 32);
+}
+
+void cca_native_segment(cca_bytecode* bytecode, unsigned int flags, unsigned long long offset, unsigned long long address, unsigned long long fileSize, unsigned long long memorySize) {
+	cca_bytecode_add_uint_le(bytecode, 1);
+	cca_bytecode_add_uint_le(bytecode, flags);
+	cca_native_u64(bytecode, offset);
+	cca_native_u64(bytecode, address);
+	cca_native_u64(bytecode, address);
+	cca_native_u64(bytecode, fileSize);
+	cca_native_u64(bytecode, memorySize);
+	cca_native_u64(bytecode, 0x1000);
+}
+
+// writes the whole executable to bytecode, the program has to be laid out in standard encoding
+BOOL cca_native_emit(cca_program* program, cca_bytecode* data, cca_bytecode* bytecode) {
+	cca_native native = {0};
+	native.text = cca_bytecode_create(100);
+	native.fixupCapacity = 100;
+	native.fixups = malloc(native.fixupCapacity * sizeof(cca_native_fixup));
+
+	unsigned int count = program->instructionCount;
+	unsigned int* starts = malloc((count + 1) * sizeof(unsigned int));
+	unsigned int* targets = malloc((count + 1) * sizeof(unsigned int));
+	cca_block_list blocks = cca_program_blocks(program);
+	BOOL error = FALSE;
+
+	// branch targets as instruction indices, count being the end of the code
+	for (unsigned int i = 0; i < count; i++) {
+		cca_operand* operand = &program->instructions[i].operands[0];
+		targets[i] = CCA_NATIVE_STOP;
+		if (cca_opcode_target(program->instructions[i].opcode) != 0)
+			continue;
+
+		if (operand->type == CCA_OPERAND_MARKER && operand->offset == 0) {
+			targets[i] = program->markers[operand->value].instruction;
+		} else if (operand->type == CCA_OPERAND_ADDRESS || operand->type == CCA_OPERAND_MARKER) {
+			// a label with a number added is a place in the code like an address
+			unsigned int address = operand->type == CCA_OPERAND_MARKER ? program->markers[operand->value].marks + operand->offset : operand->value;
+			targets[i] = CCA_MARKER_UNDEFINED;
+			for (unsigned int j = 0; j <= count; j++) {
+				if ((j < count ? program->instructions[j].offset : program->codeLength) == address)
+					targets[i] = j;
+			}
+
+			if (targets[i] == CCA_MARKER_UNDEFINED) {
+				printf("[ERROR] the branch to %u doesn't land on an instruction\n", address);
+				error = TRUE;
+			}
+		}
+	}
+
+	// mov ebp, memory / mov ebx, stack / clear a-d and the flags
+	cca_bytecode_add_byte(&native.text, 0xbd);
+	cca_bytecode_add_uint_le(&native.text, CCA_NATIVE_MEMORY_ADDRESS);
+	cca_bytecode_add_byte(&native.text, 0xbb);
+	cca_bytecode_add_uint_le(&native.text, CCA_NATIVE_MEMORY_ADDRESS + CCA_NATIVE_MEMORY_SIZE);
+	cca_native_bytes(&native, "\x45\x31\xe4\x45\x31\xed\x45\x31\xf6\x45\x31\xff\x45\x31\xd2", 15);
+
+	for (unsigned int i = 0; i < count && !error; i++) {
+		starts[i] = native.text.bytecodeLength;
+		error = !cca_native_instruction(&native, program, &blocks, i, targets);
+	}
+
+	// running off the end stops, like in ccvm-run
+	starts[count] = native.text.bytecodeLength;
+	cca_native_branch(&native, "\xe9", 1, CCA_NATIVE_STOP);
+
+	unsigned int stop, runtimeError, syscall;
+	cca_native_runtime(&native, &stop, &runtimeError, &syscall);
+
+	for (unsigned int i = 0; i < native.fixupCount && !error; i++) {
+		unsigned int target = native.fixups[i].target;
+		unsigned int to = target == CCA_NATIVE_STOP ? stop : target == CCA_NATIVE_ERROR ? runtimeError : target == CCA_NATIVE_SYSCALL ? syscall : starts[target];
+		unsigned int relative = to - (native.fixups[i].at + 4);
+
+		for (int b = 0; b < 4; b++)
+			native.text.bytecode[native.fixups[i].at + b] = (relative >> (b * 8)) & 0xff;
+	}
+
+	if (!error) {
+		unsigned int textEnd = CCA_NATIVE_ELF_HEADERS + native.text.bytecodeLength;
+		unsigned int dataOffset = (textEnd + 0xfff) & ~0xfff;
+
+		// elf header: 64 bit, little endian, executable for x86-64
+		cca_bytecode_add_bytes(bytecode, "\x7f" "ELF\x02\x01\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16);
+		cca_native_u16(bytecode, 2);
+		cca_native_u16(bytecode, 0x3e);
+		cca_bytecode_add_uint_le(bytecode, 1);
+		cca_native_u64(bytecode, CCA_NATIVE_TEXT_ADDRESS + CCA_NATIVE_ELF_HEADERS);
+		cca_native_u64(bytecode, 64);
+		cca_native_u64(bytecode, 0);
+		cca_bytecode_add_uint_le(bytecode, 0);
+		cca_native_u16(bytecode, 64);
+		cca_native_u16(bytecode, 56);
+		cca_native_u16(bytecode, 2);
+		cca_native_u16(bytecode, 0);
+		cca_native_u16(bytecode, 0);
+		cca_native_u16(bytecode, 0);
+
+		// code readable and executable, memory with the data in front and the value stack behind it writable
+		cca_native_segment(bytecode, 5, 0, CCA_NATIVE_TEXT_ADDRESS, textEnd, textEnd);
+		cca_native_segment(bytecode, 6, dataOffset, CCA_NATIVE_MEMORY_ADDRESS, data->bytecodeLength, CCA_NATIVE_MEMORY_SIZE + CCA_NATIVE_STACK_SIZE);
+
+		cca_bytecode_add_bytes(bytecode, native.text.bytecode, native.text.bytecodeLength);
+		cca_bytecode_align(bytecode, 0x1000);
+		cca_bytecode_add_bytes(bytecode, data->bytecode, data->bytecodeLength);
+	}
+
+	cca_block_list_free(&blocks);
+	free(starts);
+	free(targets);
+	free(native.fixups);
+	free(native.text.bytecode);
+	return !error;
+}
+
+#endif
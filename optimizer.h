@@ -0,0 +1,606 @@
+#ifndef ccvm_assembler_optimizer
+#define ccvm_assembler_optimizer
+
+// optimization passes over the instructions of a cca_program, included by assembler.h
+
+// drops every instruction flagged in removed, markers move on to the next instruction that is kept
+void cca_program_remove_instructions(cca_program* program, BOOL* removed) {
+	unsigned int count = program->instructionCount;
+	unsigned int* newIndex = malloc((count + 1) * sizeof(unsigned int));
+	unsigned int newCount = 0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		newIndex[i] = newCount;
+		if (!removed[i])
+			program->instructions[newCount++] = program->instructions[i];
+	}
+	newIndex[count] = newCount;
+
+	for (int m = 0; m < program->markerCount; m++)
+		program->markers[m].instruction = newIndex[program->markers[m].instruction];
+
+	program->instructionCount = newCount;
+	free(newIndex);
+}
+
+// identical code folding
+//
+// a routine is the code from one marker up to the next one. routines that encode to the same bytes, where marker
+// operands are compared by the routine they point to instead of by offset, are folded into the first copy and
+// every marker of the removed copy is redirected to the survivor.
+typedef struct cca_routine {
+	unsigned int start;
+	unsigned int end;
+	unsigned int hash;
+	BOOL removable;
+	BOOL removed;
+} cca_routine;
+
+int cca_routine_compare_hash(const void* a, const void* b) {
+	const cca_routine* left = *(const cca_routine**) a;
+	const cca_routine* right = *(const cca_routine**) b;
+
+	if (left->hash != right->hash)
+		return left->hash < right->hash ? -1 : 1;
+
+	return left->start < right->start ? -1 : (left->start > right->start);
+}
+
+unsigned int cca_routine_hash(cca_program* program, cca_routine* routine) {
+	unsigned int hash = cca_hash_uint(2166136261u, routine->end - routine->start);
+
+	for (unsigned int i = routine->start; i < routine->end; i++) {
+		cca_instruction* instruction = &program->instructions[i];
+		hash = cca_hash_uint(hash, instruction->opcode);
+
+		for (int j = 0; j < cca_opcodes[instruction->opcode].operandCount; j++) {
+			cca_operand operand = instruction->operands[j];
+			hash = cca_hash_uint(hash, operand.type);
+
+			if (operand.type == CCA_OPERAND_MARKER) {
+				// references into the routine itself are hashed relative to its start
+				unsigned int target = program->markers[operand.value].instruction;
+				hash = cca_hash_uint(hash, operand.offset);
+				if (target >= routine->start && target < routine->end)
+					hash = cca_hash_uint(cca_hash_uint(hash, 1), target - routine->start);
+				else
+					hash = cca_hash_uint(cca_hash_uint(hash, 2), target);
+			} else {
+				hash = cca_hash_uint(hash, operand.value);
+			}
+		}
+	}
+
+	return hash;
+}
+
+BOOL cca_routines_equal(cca_program* program, cca_routine* a, cca_routine* b) {
+	if (a->end - a->start != b->end - b->start)
+		return FALSE;
+
+	for (unsigned int i = 0; i < a->end - a->start; i++) {
+		cca_instruction* left = &program->instructions[a->start + i];
+		cca_instruction* right = &program->instructions[b->start + i];
+
+		if (left->opcode != right->opcode)
+			return FALSE;
+
+		for (int j = 0; j < cca_opcodes[left->opcode].operandCount; j++) {
+			if (left->operands[j].type != right->operands[j].type)
+				return FALSE;
+
+			if (left->operands[j].type == CCA_OPERAND_MARKER) {
+				unsigned int leftTarget = program->markers[left->operands[j].value].instruction;
+				unsigned int rightTarget = program->markers[right->operands[j].value].instruction;
+				BOOL leftInside = leftTarget >= a->start && leftTarget < a->end;
+				BOOL rightInside = rightTarget >= b->start && rightTarget < b->end;
+
+				if (leftInside != rightInside || left->operands[j].offset != right->operands[j].offset)
+					return FALSE;
+				if (leftInside && leftTarget - a->start != rightTarget - b->start)
+					return FALSE;
+				if (!leftInside && leftTarget != rightTarget)
+					return FALSE;
+			} else if (left->operands[j].value != right->operands[j].value) {
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+unsigned int cca_optimize_fold_identical_code(cca_program* program) {
+	unsigned int count = program->instructionCount;
+
+	// every instruction a marker points at starts a routine
+	BOOL* starts = calloc(count + 1, sizeof(BOOL));
+	unsigned int routineCount = 0;
+	for (int i = 0; i < program->markerCount; i++) {
+		unsigned int instruction = program->markers[i].instruction;
+		if (instruction < count && !starts[instruction]) {
+			starts[instruction] = TRUE;
+			++routineCount;
+		}
+	}
+
+	if (routineCount < 2) {
+		free(starts);
+		return 0;
+	}
+
+	cca_routine* routines = malloc(routineCount * sizeof(cca_routine));
+	cca_routine** sorted = malloc(routineCount * sizeof(cca_routine*));
+	unsigned int r = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		if (!starts[i])
+			continue;
+
+		if (r > 0)
+			routines[r - 1].end = i;
+		routines[r].start = i;
+		routines[r].end = count;
+		routines[r].removed = FALSE;
+		++r;
+	}
+
+	// a copy can only be dropped when nothing falls through into it and it does not fall through itself
+	for (r = 0; r < routineCount; r++) {
+		cca_routine* routine = &routines[r];
+		routine->removable = routine->start > 0
+			&& cca_opcode_is_terminator(program->instructions[routine->start - 1].opcode)
+			&& cca_opcode_is_terminator(program->instructions[routine->end - 1].opcode);
+	}
+
+	// folding redirects markers, which can make more routines identical, so repeat until nothing changes
+	unsigned int folded = 0;
+	BOOL changed = TRUE;
+	while (changed) {
+		changed = FALSE;
+
+		unsigned int sortedCount = 0;
+		for (r = 0; r < routineCount; r++) {
+			if (routines[r].removed)
+				continue;
+			routines[r].hash = cca_routine_hash(program, &routines[r]);
+			sorted[sortedCount++] = &routines[r];
+		}
+
+		qsort(sorted, sortedCount, sizeof(cca_routine*), cca_routine_compare_hash);
+
+		for (unsigned int group = 0; group < sortedCount;) {
+			unsigned int groupEnd = group + 1;
+			while (groupEnd < sortedCount && sorted[groupEnd]->hash == sorted[group]->hash)
+				++groupEnd;
+
+			for (unsigned int i = group + 1; i < groupEnd; i++) {
+				cca_routine* copy = sorted[i];
+				if (!copy->removable)
+					continue;
+
+				for (unsigned int j = group; j < i; j++) {
+					cca_routine* survivor = sorted[j];
+					if (survivor->removed || !cca_routines_equal(program, survivor, copy))
+						continue;
+
+					for (int m = 0; m < program->markerCount; m++) {
+						if (program->markers[m].instruction == copy->start)
+							program->markers[m].instruction = survivor->start;
+					}
+
+					copy->removed = TRUE;
+					changed = TRUE;
+					++folded;
+					break;
+				}
+			}
+
+			group = groupEnd;
+		}
+	}
+
+	// drop the folded routines
+	if (folded > 0) {
+		BOOL* removed = calloc(count, sizeof(BOOL));
+		for (r = 0; r < routineCount; r++) {
+			if (routines[r].removed) {
+				for (unsigned int i = routines[r].start; i < routines[r].end; i++)
+					removed[i] = TRUE;
+			}
+		}
+
+		cca_program_remove_instructions(program, removed);
+		free(removed);
+	}
+
+	free(starts);
+	free(routines);
+	free(sorted);
+	return folded;
+}
+
+// constant propagation and folding
+//
+// walks every basic block keeping track of the registers and stack slots whose value is known at assembly time.
+// arithmetic on known values becomes a single mov or psh, the instructions that produced the operands are dropped,
+// and conditional jumps after a known comparison become a jmp or disappear
+#define CCA_NO_INSTRUCTION 0xffffffff
+#define CCA_CONSTANT_STACK_DEPTH 64
+
+typedef struct cca_constant {
+	BOOL known;
+	unsigned int value;
+	// the instruction that pushed the slot, if it can be dropped once the slot is folded away
+	unsigned int producer;
+} cca_constant;
+
+typedef struct cca_constant_state {
+	cca_constant registers[4];
+	// a 'mov' whose result nobody has read yet, it is dead when the register is overwritten
+	unsigned int writers[4];
+	cca_constant stack[CCA_CONSTANT_STACK_DEPTH];
+	unsigned int stackDepth;
+	BOOL flagsKnown;
+	unsigned int flags;
+} cca_constant_state;
+
+void cca_constant_state_forget(cca_constant_state* state) {
+	for (int r = 0; r < 4; r++) {
+		state->registers[r].known = FALSE;
+		state->writers[r] = CCA_NO_INSTRUCTION;
+	}
+	state->stackDepth = 0;
+	state->flagsKnown = FALSE;
+}
+
+void cca_constant_push(cca_constant_state* state, BOOL known, unsigned int value, unsigned int producer) {
+	if (state->stackDepth == CCA_CONSTANT_STACK_DEPTH) {
+		memmove(state->stack, state->stack + 1, (CCA_CONSTANT_STACK_DEPTH - 1) * sizeof(cca_constant));
+		--state->stackDepth;
+	}
+
+	cca_constant slot = { known, value, known ? producer : CCA_NO_INSTRUCTION };
+	state->stack[state->stackDepth++] = slot;
+}
+
+cca_constant cca_constant_pop(cca_constant_state* state) {
+	cca_constant unknown = { FALSE, 0, CCA_NO_INSTRUCTION };
+	if (state->stackDepth == 0)
+		return unknown;
+	return state->stack[--state->stackDepth];
+}
+
+// a slot can be folded away when its value is known and the instruction that pushed it can be dropped
+BOOL cca_constant_foldable(cca_constant slot) {
+	return slot.known && slot.producer != CCA_NO_INSTRUCTION;
+}
+
+void cca_constant_read(cca_constant_state* state, unsigned int reg) {
+	state->writers[reg] = CCA_NO_INSTRUCTION;
+}
+
+// records a write of reg by instruction, dropping the previous write if it was never read
+unsigned int cca_constant_write(cca_constant_state* state, BOOL* removed, unsigned int reg, unsigned int instruction) {
+	unsigned int dropped = 0;
+	if (state->writers[reg] != CCA_NO_INSTRUCTION) {
+		removed[state->writers[reg]] = TRUE;
+		dropped = 1;
+	}
+	state->writers[reg] = instruction;
+	return dropped;
+}
+
+void cca_instruction_make(cca_instruction* instruction, unsigned char opcode, cca_operand first, cca_operand second) {
+	instruction->opcode = opcode;
+	instruction->operands[0] = first;
+	instruction->operands[1] = second;
+}
+
+unsigned int cca_optimize_fold_constants(cca_program* program) {
+	unsigned int count = program->instructionCount;
+	unsigned int folded = 0;
+
+	BOOL* removed = calloc(count, sizeof(BOOL));
+	BOOL* blockStarts = calloc(count + 1, sizeof(BOOL));
+	for (int m = 0; m < program->markerCount; m++)
+		blockStarts[program->markers[m].instruction] = TRUE;
+
+	cca_constant_state state;
+	cca_constant_state_forget(&state);
+	cca_operand none = { CCA_OPERAND_NONE, 0 };
+
+	for (unsigned int i = 0; i < count; i++) {
+		// anything can jump to a marker
+		if (blockStarts[i])
+			cca_constant_state_forget(&state);
+
+		cca_instruction* instruction = &program->instructions[i];
+		cca_operand first = instruction->operands[0];
+		cca_operand second = instruction->operands[1];
+		unsigned int result = 0;
+
+		switch (instruction->opcode) {
+			case CCA_OP_MOV_REG_NUM: {
+				folded += cca_constant_write(&state, removed, first.value, i);
+				state.registers[first.value].known = TRUE;
+				state.registers[first.value].value = second.value;
+				break;
+			}
+			case CCA_OP_MOV_REG_REG: {
+				if (state.registers[second.value].known) {
+					cca_operand number = { CCA_OPERAND_NUMBER, state.registers[second.value].value };
+					cca_instruction_make(instruction, CCA_OP_MOV_REG_NUM, first, number);
+					folded += cca_constant_write(&state, removed, first.value, i);
+					state.registers[first.value] = state.registers[second.value];
+					break;
+				}
+				cca_constant_read(&state, second.value);
+				folded += cca_constant_write(&state, removed, first.value, i);
+				state.registers[first.value].known = FALSE;
+				break;
+			}
+			case CCA_OP_MOV_REG_ADDR: {
+				folded += cca_constant_write(&state, removed, first.value, i);
+				state.registers[first.value].known = FALSE;
+				break;
+			}
+			case CCA_OP_MOV_ADDR_REG: {
+				cca_constant_read(&state, second.value);
+				break;
+			}
+			case CCA_OP_ADD_REG: case CCA_OP_SUB_REG: case CCA_OP_MUL_REG: case CCA_OP_DIV_REG:
+			case CCA_OP_AND_REG: case CCA_OP_OR_REG: case CCA_OP_XOR_REG: {
+				cca_constant x = state.registers[first.value];
+				cca_constant y = state.registers[second.value];
+				if (x.known && y.known && cca_evaluate(instruction->opcode, x.value, y.value, &result)) {
+					cca_operand number = { CCA_OPERAND_NUMBER, result };
+					cca_instruction_make(instruction, CCA_OP_MOV_REG_NUM, first, number);
+					folded += 1 + cca_constant_write(&state, removed, first.value, i);
+					state.registers[first.value].value = result;
+					break;
+				}
+				cca_constant_read(&state, first.value);
+				cca_constant_read(&state, second.value);
+				state.registers[first.value].known = FALSE;
+				break;
+			}
+			case CCA_OP_NOT_REG: case CCA_OP_INC_REG: case CCA_OP_DEC_REG: {
+				cca_constant x = state.registers[first.value];
+				if (x.known && cca_evaluate(instruction->opcode, x.value, 0, &result)) {
+					cca_operand number = { CCA_OPERAND_NUMBER, result };
+					cca_instruction_make(instruction, CCA_OP_MOV_REG_NUM, first, number);
+					folded += 1 + cca_constant_write(&state, removed, first.value, i);
+					state.registers[first.value].value = result;
+					break;
+				}
+				cca_constant_read(&state, first.value);
+				state.registers[first.value].known = FALSE;
+				break;
+			}
+			case CCA_OP_PSH_NUM: {
+				cca_constant_push(&state, TRUE, first.value, i);
+				break;
+			}
+			case CCA_OP_PSH_REG: {
+				cca_constant_read(&state, first.value);
+				cca_constant_push(&state, state.registers[first.value].known, state.registers[first.value].value, i);
+				break;
+			}
+			case CCA_OP_PSH_ADDR: {
+				cca_constant_push(&state, FALSE, 0, i);
+				break;
+			}
+			case CCA_OP_DUP: {
+				if (state.stackDepth == 0) {
+					cca_constant_push(&state, FALSE, 0, i);
+					break;
+				}
+				// the copy depends on the original being pushed, so the original has to stay
+				cca_constant top = state.stack[state.stackDepth - 1];
+				state.stack[state.stackDepth - 1].producer = CCA_NO_INSTRUCTION;
+				cca_constant_push(&state, top.known, top.value, i);
+				break;
+			}
+			case CCA_OP_POP_REG: {
+				cca_constant top = cca_constant_pop(&state);
+				if (cca_constant_foldable(top)) {
+					// a value pushed in this block and popped again becomes a plain mov
+					cca_operand number = { CCA_OPERAND_NUMBER, top.value };
+					cca_instruction_make(instruction, CCA_OP_MOV_REG_NUM, first, number);
+					removed[top.producer] = TRUE;
+					folded += 1 + cca_constant_write(&state, removed, first.value, i);
+				} else {
+					folded += cca_constant_write(&state, removed, first.value, CCA_NO_INSTRUCTION);
+				}
+				state.registers[first.value].known = top.known;
+				state.registers[first.value].value = top.value;
+				break;
+			}
+			case CCA_OP_POP_ADDR: {
+				cca_constant_pop(&state);
+				break;
+			}
+			case CCA_OP_ADD: case CCA_OP_SUB: case CCA_OP_MUL: case CCA_OP_DIV:
+			case CCA_OP_AND: case CCA_OP_OR: case CCA_OP_XOR: {
+				cca_constant y = cca_constant_pop(&state);
+				cca_constant x = cca_constant_pop(&state);
+				if (cca_constant_foldable(x) && cca_constant_foldable(y) && cca_evaluate(instruction->opcode, x.value, y.value, &result)) {
+					cca_operand number = { CCA_OPERAND_NUMBER, result };
+					cca_instruction_make(instruction, CCA_OP_PSH_NUM, number, none);
+					removed[x.producer] = TRUE;
+					removed[y.producer] = TRUE;
+					cca_constant_push(&state, TRUE, result, i);
+					folded += 2;
+					break;
+				}
+				cca_constant_push(&state, FALSE, 0, i);
+				break;
+			}
+			case CCA_OP_NOT: case CCA_OP_INC: case CCA_OP_DEC: {
+				cca_constant x = cca_constant_pop(&state);
+				if (cca_constant_foldable(x) && cca_evaluate(instruction->opcode, x.value, 0, &result)) {
+					cca_operand number = { CCA_OPERAND_NUMBER, result };
+					cca_instruction_make(instruction, CCA_OP_PSH_NUM, number, none);
+					removed[x.producer] = TRUE;
+					cca_constant_push(&state, TRUE, result, i);
+					folded += 1;
+					break;
+				}
+				cca_constant_push(&state, FALSE, 0, i);
+				break;
+			}
+			case CCA_OP_CMP_REG_REG: {
+				cca_constant_read(&state, first.value);
+				cca_constant_read(&state, second.value);
+				state.flagsKnown = state.registers[first.value].known && state.registers[second.value].known;
+				state.flags = cca_compare_flags(state.registers[first.value].value, state.registers[second.value].value);
+				break;
+			}
+			case CCA_OP_CMP_REG_NUM: {
+				cca_constant_read(&state, first.value);
+				state.flagsKnown = state.registers[first.value].known;
+				state.flags = cca_compare_flags(state.registers[first.value].value, second.value);
+				break;
+			}
+			case CCA_OP_CMP_NUM: {
+				cca_constant x = cca_constant_pop(&state);
+				state.flagsKnown = x.known;
+				state.flags = cca_compare_flags(x.value, first.value);
+				break;
+			}
+			case CCA_OP_FRS: {
+				state.flagsKnown = TRUE;
+				state.flags = 0;
+				break;
+			}
+			case CCA_OP_JE: case CCA_OP_JNE: case CCA_OP_JG: case CCA_OP_JS: case CCA_OP_JO: {
+				if (state.flagsKnown) {
+					++folded;
+					if (cca_branch_taken(instruction->opcode, state.flags)) {
+						instruction->opcode = CCA_OP_JMP;
+						cca_constant_state_forget(&state);
+					} else {
+						removed[i] = TRUE;
+					}
+					break;
+				}
+
+				// the target sees the registers and the stack as they are now
+				for (int r = 0; r < 4; r++)
+					state.writers[r] = CCA_NO_INSTRUCTION;
+				for (unsigned int s = 0; s < state.stackDepth; s++)
+					state.stack[s].producer = CCA_NO_INSTRUCTION;
+				break;
+			}
+			case CCA_OP_MOV_ADDR_NUM: {
+				break;
+			}
+			default: {
+				// jumps, calls, syscalls and the like can look at and change everything
+				cca_constant_state_forget(&state);
+				break;
+			}
+		}
+	}
+
+	cca_program_remove_instructions(program, removed);
+
+	free(removed);
+	free(blockStarts);
+	return folded;
+}
+
+
+// superinstruction fusion
+//
+// replaces the instruction sequences of the enabled fusions with their superinstruction. a sequence is only fused
+// when nothing but its first instruction is a marker target, so nothing can jump into the middle of it. runs last,
+// the other passes only know the standard forms
+unsigned int cca_optimize_fuse(cca_program* program, unsigned int fusions) {
+	unsigned int count = program->instructionCount;
+	BOOL* removed = calloc(count + 1, sizeof(BOOL));
+	BOOL* targeted = calloc(count + 1, sizeof(BOOL));
+	unsigned int fused = 0;
+
+	for (int m = 0; m < program->markerCount; m++)
+		targeted[program->markers[m].instruction] = TRUE;
+
+	for (unsigned int i = 0; i < count; i++) {
+		for (unsigned int f = 0; f < cca_fusion_count; f++) {
+			cca_fusion* fusion = &cca_fusions[f];
+			if (!(fusions & (1u << f)) || i + fusion->length > count)
+				continue;
+
+			BOOL matches = TRUE;
+			for (unsigned int p = 0; p < fusion->length && matches; p++) {
+				if (program->instructions[i + p].opcode != fusion->parts[p] || (p > 0 && targeted[i + p]))
+					matches = FALSE;
+			}
+
+			cca_instruction* parts = &program->instructions[i];
+			if (matches && fusion->same[0] != fusion->same[1]) {
+				cca_operand* left = &parts[fusion->same[0] / 2].operands[fusion->same[0] % 2];
+				cca_operand* right = &parts[fusion->same[1] / 2].operands[fusion->same[1] % 2];
+				// a register and a number can have the same value
+				matches = left->type == right->type && left->value == right->value && left->offset == right->offset;
+			}
+			if (!matches)
+				continue;
+
+			cca_instruction instruction = {0};
+			instruction.opcode = fusion->opcode;
+			instruction.file = parts[0].file;
+			instruction.line = parts[0].line;
+			instruction.column = parts[0].column;
+			for (int o = 0; o < cca_opcodes[fusion->opcode].operandCount; o++)
+				instruction.operands[o] = parts[fusion->sources[o] / 2].operands[fusion->sources[o] % 2];
+
+			parts[0] = instruction;
+			for (unsigned int p = 1; p < fusion->length; p++)
+				removed[i + p] = TRUE;
+
+			i += fusion->length - 1;
+			++fused;
+			break;
+		}
+	}
+
+	cca_program_remove_instructions(program, removed);
+
+	free(removed);
+	free(targeted);
+	return fused;
+}
+
+// turns a comma separated list of fusion names, or all, into the mask cca_optimize_fuse takes
+BOOL cca_fusion_parse(char* list, unsigned int* fusions) {
+	if (strcmp(list, "all") == 0) {
+		*fusions = (1u << cca_fusion_count) - 1;
+		return TRUE;
+	}
+
+	while (*list != '\0') {
+		unsigned int length = strcspn(list, ",");
+		BOOL found = FALSE;
+
+		for (unsigned int f = 0; f < cca_fusion_count; f++) {
+			if (strlen(cca_fusions[f].name) == length && strncmp(cca_fusions[f].name, list, length) == 0) {
+				*fusions |= 1u << f;
+				found = TRUE;
+			}
+		}
+
+		if (!found) {
+			printf("[ERROR] unknown fusion '%.*s'\n", length, list);
+			return FALSE;
+		}
+
+		list += length;
+		if (*list == ',')
+			++list;
+	}
+
+	return TRUE;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,510 @@
+#ifndef ccvm_assembler_regalloc
+#define ccvm_assembler_regalloc
+
+// register allocation, included by assembler.h
+//
+// virtual registers get mapped onto a-d by linear scan over live intervals taken from the control flow graph.
+// a call flows into the called routine and every ret flows back to every return site, so a value that stays in a
+// register across a call never shares it with a register the callee touches. values that don't fit in a-d live in
+// memory slots from the spill base upwards.
+#define CCA_REGISTER_SPILLED 0xffffffff
+
+typedef unsigned long long cca_bitset_word;
+
+BOOL cca_bitset_test(cca_bitset_word* set, unsigned int bit) {
+	return (set[bit / 64] >> (bit % 64)) & 1;
+}
+
+void cca_bitset_set(cca_bitset_word* set, unsigned int bit) {
+	set[bit / 64] |= 1ull << (bit % 64);
+}
+
+void cca_bitset_clear(cca_bitset_word* set, unsigned int bit) {
+	set[bit / 64] &= ~(1ull << (bit % 64));
+}
+
+// registers read and written by an instruction. the vm leaves the registers of a syscall to the syscall, so it may
+// read and write all of a-d
+unsigned int cca_instruction_uses(cca_instruction* instruction, unsigned int* registers) {
+	switch (instruction->opcode) {
+		case CCA_OP_MOV_ADDR_REG:
+		case CCA_OP_MOV_REG_REG: {
+			registers[0] = instruction->operands[1].value;
+			return 1;
+		}
+		case CCA_OP_PSH_REG: case CCA_OP_NOT_REG: case CCA_OP_INC_REG: case CCA_OP_DEC_REG:
+		case CCA_OP_CMP_REG_NUM: {
+			registers[0] = instruction->operands[0].value;
+			return 1;
+		}
+		case CCA_OP_ADD_REG: case CCA_OP_SUB_REG: case CCA_OP_MUL_REG: case CCA_OP_DIV_REG:
+		case CCA_OP_AND_REG: case CCA_OP_OR_REG: case CCA_OP_XOR_REG: case CCA_OP_CMP_REG_REG: {
+			registers[0] = instruction->operands[0].value;
+			registers[1] = instruction->operands[1].value;
+			return 2;
+		}
+		case CCA_OP_SYSCALL: {
+			for (int r = 0; r < CCA_REGISTER_COUNT; r++)
+				registers[r] = r;
+			return CCA_REGISTER_COUNT;
+		}
+		default: return 0;
+	}
+}
+
+unsigned int cca_instruction_defs(cca_instruction* instruction, unsigned int* registers) {
+	switch (instruction->opcode) {
+		case CCA_OP_MOV_REG_NUM: case CCA_OP_MOV_REG_ADDR: case CCA_OP_MOV_REG_REG: case CCA_OP_POP_REG:
+		case CCA_OP_ADD_REG: case CCA_OP_SUB_REG: case CCA_OP_MUL_REG: case CCA_OP_DIV_REG:
+		case CCA_OP_AND_REG: case CCA_OP_OR_REG: case CCA_OP_XOR_REG:
+		case CCA_OP_NOT_REG: case CCA_OP_INC_REG: case CCA_OP_DEC_REG: {
+			registers[0] = instruction->operands[0].value;
+			return 1;
+		}
+		case CCA_OP_SYSCALL: {
+			for (int r = 0; r < CCA_REGISTER_COUNT; r++)
+				registers[r] = r;
+			return CCA_REGISTER_COUNT;
+		}
+		default: return 0;
+	}
+}
+
+// the first memory slot that is neither header data nor an address the program uses itself
+unsigned int cca_default_spill_base(cca_program* program, unsigned int headerLength) {
+	unsigned int base = headerLength;
+
+	for (int i = 0; i < program->instructionCount; i++) {
+		cca_instruction* instruction = &program->instructions[i];
+		cca_opcode_info info = cca_opcodes[instruction->opcode];
+
+		for (int j = 0; j < info.operandCount; j++) {
+			if (info.operands[j] == CCA_OPERAND_ADDRESS && instruction->operands[j].type == CCA_OPERAND_ADDRESS && instruction->operands[j].value + 4 > base)
+				base = instruction->operands[j].value + 4;
+		}
+	}
+
+	return (base + 3) & ~3u;
+}
+
+typedef struct cca_interval {
+	unsigned int reg;
+	unsigned int start;
+	unsigned int end;
+} cca_interval;
+
+int cca_interval_compare_start(const void* a, const void* b) {
+	const cca_interval* left = *(const cca_interval**) a;
+	const cca_interval* right = *(const cca_interval**) b;
+
+	if (left->start != right->start)
+		return left->start < right->start ? -1 : 1;
+
+	return left->reg < right->reg ? -1 : (left->reg > right->reg);
+}
+
+void cca_interval_extend(cca_interval* intervals, unsigned int reg, unsigned int position) {
+	if (reg < CCA_REGISTER_VIRTUAL)
+		return;
+
+	cca_interval* interval = &intervals[reg - CCA_REGISTER_VIRTUAL];
+	if (position < interval->start)
+		interval->start = position;
+	if (position > interval->end)
+		interval->end = position;
+}
+
+// the block control continues in when the branch of an instruction is taken, blocks.length if it leaves the code
+unsigned int cca_branch_target_block(cca_program* program, cca_block_list* blocks, cca_instruction* instruction) {
+	return blocks->blockOf[program->markers[instruction->operands[0].value].instruction];
+}
+
+void cca_program_emit(cca_instruction** instructions, unsigned int* count, unsigned int* capacity, cca_instruction instruction) {
+	++*count;
+	if (*count >= *capacity) {
+		*capacity *= 2;
+		*instructions = realloc(*instructions, *capacity * sizeof(cca_instruction));
+	}
+	(*instructions)[*count - 1] = instruction;
+}
+
+cca_instruction cca_instruction_create(unsigned char opcode, char firstType, unsigned int first, char secondType, unsigned int second) {
+	cca_instruction instruction = {0};
+	instruction.opcode = opcode;
+	instruction.operands[0].type = firstType;
+	instruction.operands[0].value = first;
+	instruction.operands[1].type = secondType;
+	instruction.operands[1].value = second;
+	return instruction;
+}
+
+// replaces every virtual register, returns the number of virtual registers that had to be spilled
+unsigned int cca_allocate_registers(cca_program* program, unsigned int spillBase) {
+	unsigned int count = program->instructionCount;
+	unsigned int virtualCount = 0;
+	unsigned int registers[CCA_REGISTER_COUNT];
+
+	for (unsigned int i = 0; i < count; i++) {
+		cca_instruction* instruction = &program->instructions[i];
+		for (int j = 0; j < cca_opcodes[instruction->opcode].operandCount; j++) {
+			cca_operand operand = instruction->operands[j];
+			if (operand.type == CCA_OPERAND_REGISTER && operand.value >= CCA_REGISTER_VIRTUAL && operand.value - CCA_REGISTER_VIRTUAL + 1 > virtualCount)
+				virtualCount = operand.value - CCA_REGISTER_VIRTUAL + 1;
+		}
+	}
+
+	if (virtualCount == 0)
+		return 0;
+
+	// control flow graph
+	cca_block_list blocks = cca_program_blocks(program);
+	unsigned int variables = CCA_REGISTER_VIRTUAL + virtualCount;
+	unsigned int words = (variables + 63) / 64;
+
+	cca_bitset_word* use = calloc(blocks.length * words, sizeof(cca_bitset_word));
+	cca_bitset_word* def = calloc(blocks.length * words, sizeof(cca_bitset_word));
+	cca_bitset_word* liveIn = calloc(blocks.length * words, sizeof(cca_bitset_word));
+	cca_bitset_word* liveOut = calloc(blocks.length * words, sizeof(cca_bitset_word));
+	cca_bitset_word* returnIn = calloc(words, sizeof(cca_bitset_word));
+	cca_bitset_word* live = calloc(words, sizeof(cca_bitset_word));
+
+	unsigned int* returnSites = malloc((blocks.length + 1) * sizeof(unsigned int));
+	unsigned int returnSiteCount = 0;
+
+	for (unsigned int b = 0; b < blocks.length; b++) {
+		cca_bitset_word* blockUse = &use[b * words];
+		cca_bitset_word* blockDef = &def[b * words];
+
+		for (unsigned int i = blocks.blocks[b].start; i < blocks.blocks[b].end; i++) {
+			unsigned int useCount = cca_instruction_uses(&program->instructions[i], registers);
+			for (unsigned int u = 0; u < useCount; u++) {
+				if (!cca_bitset_test(blockDef, registers[u]))
+					cca_bitset_set(blockUse, registers[u]);
+			}
+
+			unsigned int defCount = cca_instruction_defs(&program->instructions[i], registers);
+			for (unsigned int d = 0; d < defCount; d++)
+				cca_bitset_set(blockDef, registers[d]);
+		}
+
+		cca_instruction* last = &program->instructions[blocks.blocks[b].end - 1];
+		if (last->opcode == CCA_OP_CALL && blocks.blocks[b].end < count)
+			returnSites[returnSiteCount++] = b + 1;
+	}
+
+	// liveness, iterated backwards until nothing changes
+	BOOL changed = TRUE;
+	while (changed) {
+		changed = FALSE;
+
+		memset(returnIn, 0, words * sizeof(cca_bitset_word));
+		for (unsigned int s = 0; s < returnSiteCount; s++) {
+			for (unsigned int w = 0; w < words; w++)
+				returnIn[w] |= liveIn[returnSites[s] * words + w];
+		}
+
+		for (int b = blocks.length - 1; b >= 0; b--) {
+			cca_instruction* last = &program->instructions[blocks.blocks[b].end - 1];
+			cca_bitset_word* out = &liveOut[b * words];
+			BOOL fallsThrough = !cca_opcode_is_terminator(last->opcode) && b + 1 < blocks.length;
+			unsigned int target = blocks.length;
+			BOOL escapes = FALSE;
+
+			if (cca_opcode_is_conditional_jump(last->opcode) || last->opcode == CCA_OP_JMP || last->opcode == CCA_OP_CALL) {
+				// a label with a number added can land anywhere in a block
+				if (last->operands[0].type == CCA_OPERAND_MARKER && last->operands[0].offset == 0)
+					target = cca_branch_target_block(program, &blocks, last);
+				else
+					escapes = TRUE;
+			}
+
+			for (unsigned int w = 0; w < words; w++) {
+				cca_bitset_word value = 0;
+				if (fallsThrough)
+					value |= liveIn[(b + 1) * words + w];
+				if (target < blocks.length)
+					value |= liveIn[target * words + w];
+				if (last->opcode == CCA_OP_RET)
+					value |= returnIn[w];
+				if (escapes)
+					value = ~0ull;
+
+				out[w] = value;
+				value = use[b * words + w] | (value & ~def[b * words + w]);
+				if (value != liveIn[b * words + w]) {
+					liveIn[b * words + w] = value;
+					changed = TRUE;
+				}
+			}
+		}
+	}
+
+	// live intervals of the virtual registers, and where each of a-d is busy
+	cca_interval* intervals = malloc(virtualCount * sizeof(cca_interval));
+	for (unsigned int v = 0; v < virtualCount; v++) {
+		intervals[v].reg = v + CCA_REGISTER_VIRTUAL;
+		intervals[v].start = 0xffffffff;
+		intervals[v].end = 0;
+	}
+
+	unsigned char* busy = calloc(count, sizeof(unsigned char));
+	for (unsigned int b = 0; b < blocks.length; b++) {
+		unsigned int start = blocks.blocks[b].start;
+		unsigned int end = blocks.blocks[b].end;
+		memcpy(live, &liveOut[b * words], words * sizeof(cca_bitset_word));
+
+		for (unsigned int v = 0; v < variables; v++) {
+			if (cca_bitset_test(live, v))
+				cca_interval_extend(intervals, v, end - 1);
+		}
+
+		for (int p = end - 1; p >= (int) start; p--) {
+			for (int r = 0; r < CCA_REGISTER_COUNT; r++)
+				busy[p] |= cca_bitset_test(live, r) << r;
+
+			unsigned int defCount = cca_instruction_defs(&program->instructions[p], registers);
+			for (unsigned int d = 0; d < defCount; d++) {
+				cca_interval_extend(intervals, registers[d], p);
+				if (registers[d] < CCA_REGISTER_COUNT)
+					busy[p] |= 1 << registers[d];
+				cca_bitset_clear(live, registers[d]);
+			}
+
+			unsigned int useCount = cca_instruction_uses(&program->instructions[p], registers);
+			for (unsigned int u = 0; u < useCount; u++) {
+				cca_interval_extend(intervals, registers[u], p);
+				if (registers[u] < CCA_REGISTER_COUNT)
+					busy[p] |= 1 << registers[u];
+				cca_bitset_set(live, registers[u]);
+			}
+
+			for (int r = 0; r < CCA_REGISTER_COUNT; r++)
+				busy[p] |= cca_bitset_test(live, r) << r;
+		}
+
+		for (unsigned int v = CCA_REGISTER_VIRTUAL; v < variables; v++) {
+			if (cca_bitset_test(live, v))
+				cca_interval_extend(intervals, v, start);
+		}
+	}
+
+	// busyBefore[r * (count + 1) + p] counts the instructions before p where r is busy
+	unsigned int* busyBefore = malloc(CCA_REGISTER_COUNT * (count + 1) * sizeof(unsigned int));
+	for (int r = 0; r < CCA_REGISTER_COUNT; r++) {
+		busyBefore[r * (count + 1)] = 0;
+		for (unsigned int p = 0; p < count; p++)
+			busyBefore[r * (count + 1) + p + 1] = busyBefore[r * (count + 1) + p] + ((busy[p] >> r) & 1);
+	}
+
+	// linear scan
+	unsigned int* assignment = malloc(virtualCount * sizeof(unsigned int));
+	cca_interval** sorted = malloc(virtualCount * sizeof(cca_interval*));
+	unsigned int sortedCount = 0;
+	for (unsigned int v = 0; v < virtualCount; v++) {
+		assignment[v] = CCA_REGISTER_SPILLED;
+		if (intervals[v].start != 0xffffffff)
+			sorted[sortedCount++] = &intervals[v];
+	}
+
+	qsort(sorted, sortedCount, sizeof(cca_interval*), cca_interval_compare_start);
+
+	cca_interval* active[CCA_REGISTER_COUNT];
+	unsigned int activeCount = 0;
+	unsigned int spilled = 0;
+
+	for (unsigned int s = 0; s < sortedCount; s++) {
+		cca_interval* current = sorted[s];
+
+		// expire the intervals that ended before this one starts
+		unsigned int kept = 0;
+		for (unsigned int a = 0; a < activeCount; a++) {
+			if (active[a]->end >= current->start)
+				active[kept++] = active[a];
+		}
+		activeCount = kept;
+
+		unsigned int taken = 0;
+		for (unsigned int a = 0; a < activeCount; a++)
+			taken |= 1 << assignment[active[a]->reg - CCA_REGISTER_VIRTUAL];
+
+		unsigned int fits = 0;
+		for (int r = 0; r < CCA_REGISTER_COUNT; r++) {
+			unsigned int* before = &busyBefore[r * (count + 1)];
+			if (before[current->end + 1] == before[current->start])
+				fits |= 1 << r;
+		}
+
+		int chosen = -1;
+		for (int r = 0; r < CCA_REGISTER_COUNT && chosen < 0; r++) {
+			if ((fits & ~taken) & (1 << r))
+				chosen = r;
+		}
+
+		if (chosen >= 0) {
+			assignment[current->reg - CCA_REGISTER_VIRTUAL] = chosen;
+			active[activeCount++] = current;
+			continue;
+		}
+
+		// nothing free, spill whichever of this and the active intervals lives longest
+		int victim = -1;
+		for (unsigned int a = 0; a < activeCount; a++) {
+			unsigned int reg = assignment[active[a]->reg - CCA_REGISTER_VIRTUAL];
+			if (active[a]->end > current->end && (fits & (1 << reg)) && (victim < 0 || active[a]->end > active[victim]->end))
+				victim = a;
+		}
+
+		if (victim >= 0) {
+			assignment[current->reg - CCA_REGISTER_VIRTUAL] = assignment[active[victim]->reg - CCA_REGISTER_VIRTUAL];
+			assignment[active[victim]->reg - CCA_REGISTER_VIRTUAL] = CCA_REGISTER_SPILLED;
+			active[victim] = current;
+		}
+
+		++spilled;
+	}
+
+	// rewrite the code, spilled registers go through memory
+	unsigned int newCapacity = count + 16;
+	unsigned int newCount = 0;
+	cca_instruction* rewritten = malloc(newCapacity * sizeof(cca_instruction));
+	unsigned int* newIndex = malloc((count + 1) * sizeof(unsigned int));
+
+	for (unsigned int i = 0; i < count; i++) {
+		cca_instruction instruction = program->instructions[i];
+		cca_opcode_info info = cca_opcodes[instruction.opcode];
+		BOOL inMemory[2] = { FALSE, FALSE };
+		unsigned int slots[2] = { 0, 0 };
+		unsigned int physical = 0;
+
+		newIndex[i] = newCount;
+
+		for (int j = 0; j < info.operandCount; j++) {
+			cca_operand* operand = &instruction.operands[j];
+			if (operand->type != CCA_OPERAND_REGISTER)
+				continue;
+
+			if (operand->value >= CCA_REGISTER_VIRTUAL) {
+				unsigned int v = operand->value - CCA_REGISTER_VIRTUAL;
+				if (assignment[v] == CCA_REGISTER_SPILLED) {
+					inMemory[j] = TRUE;
+					slots[j] = spillBase + v * 4;
+					continue;
+				}
+				operand->value = assignment[v];
+			}
+			physical |= 1 << operand->value;
+		}
+
+		if (!inMemory[0] && !inMemory[1]) {
+			cca_program_emit(&rewritten, &newCount, &newCapacity, instruction);
+			continue;
+		}
+
+		cca_operand first = instruction.operands[0];
+		cca_operand second = instruction.operands[1];
+
+		switch (instruction.opcode) {
+			case CCA_OP_MOV_REG_NUM: {
+				cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_MOV_ADDR_NUM, CCA_OPERAND_ADDRESS, slots[0], second.type, second.value));
+				break;
+			}
+			case CCA_OP_MOV_REG_ADDR: {
+				cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_PSH_ADDR, second.type, second.value, CCA_OPERAND_NONE, 0));
+				cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_POP_ADDR, CCA_OPERAND_ADDRESS, slots[0], CCA_OPERAND_NONE, 0));
+				break;
+			}
+			case CCA_OP_MOV_ADDR_REG: {
+				cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_PSH_ADDR, CCA_OPERAND_ADDRESS, slots[1], CCA_OPERAND_NONE, 0));
+				cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_POP_ADDR, first.type, first.value, CCA_OPERAND_NONE, 0));
+				break;
+			}
+			case CCA_OP_MOV_REG_REG: {
+				if (inMemory[0] && inMemory[1]) {
+					cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_PSH_ADDR, CCA_OPERAND_ADDRESS, slots[1], CCA_OPERAND_NONE, 0));
+					cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_POP_ADDR, CCA_OPERAND_ADDRESS, slots[0], CCA_OPERAND_NONE, 0));
+				} else if (inMemory[0]) {
+					cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_MOV_ADDR_REG, CCA_OPERAND_ADDRESS, slots[0], CCA_OPERAND_REGISTER, second.value));
+				} else {
+					cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_MOV_REG_ADDR, CCA_OPERAND_REGISTER, first.value, CCA_OPERAND_ADDRESS, slots[1]));
+				}
+				break;
+			}
+			case CCA_OP_PSH_REG: {
+				cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_PSH_ADDR, CCA_OPERAND_ADDRESS, slots[0], CCA_OPERAND_NONE, 0));
+				break;
+			}
+			case CCA_OP_POP_REG: {
+				cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_POP_ADDR, CCA_OPERAND_ADDRESS, slots[0], CCA_OPERAND_NONE, 0));
+				break;
+			}
+			default: {
+				// borrow a register that the instruction doesn't use, saving it on the stack around the instruction
+				unsigned int scratch[2] = { 0, 0 };
+				BOOL shared = inMemory[0] && inMemory[1] && slots[0] == slots[1];
+				unsigned int defCount = cca_instruction_defs(&instruction, registers);
+
+				for (int j = 0; j < 2; j++) {
+					if (!inMemory[j])
+						continue;
+					if (j == 1 && shared) {
+						scratch[1] = scratch[0];
+					} else {
+						unsigned int r = 0;
+						while (physical & (1 << r))
+							++r;
+						physical |= 1 << r;
+						scratch[j] = r;
+						cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_PSH_REG, CCA_OPERAND_REGISTER, r, CCA_OPERAND_NONE, 0));
+						cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_MOV_REG_ADDR, CCA_OPERAND_REGISTER, r, CCA_OPERAND_ADDRESS, slots[j]));
+					}
+					instruction.operands[j].value = scratch[j];
+				}
+
+				cca_program_emit(&rewritten, &newCount, &newCapacity, instruction);
+
+				if (inMemory[0] && defCount > 0)
+					cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_MOV_ADDR_REG, CCA_OPERAND_ADDRESS, slots[0], CCA_OPERAND_REGISTER, scratch[0]));
+
+				for (int j = 1; j >= 0; j--) {
+					if (inMemory[j] && !(j == 1 && shared))
+						cca_program_emit(&rewritten, &newCount, &newCapacity, cca_instruction_create(CCA_OP_POP_REG, CCA_OPERAND_REGISTER, scratch[j], CCA_OPERAND_NONE, 0));
+				}
+				break;
+			}
+		}
+
+		// spill code stands in for the instruction, it gets its source position
+		for (unsigned int j = newIndex[i]; j < newCount; j++) {
+			rewritten[j].file = instruction.file;
+			rewritten[j].line = instruction.line;
+			rewritten[j].column = instruction.column;
+		}
+	}
+	newIndex[count] = newCount;
+
+	for (int m = 0; m < program->markerCount; m++)
+		program->markers[m].instruction = newIndex[program->markers[m].instruction];
+
+	free(program->instructions);
+	program->instructions = rewritten;
+	program->instructionCount = newCount;
+	program->instructionCapacity = newCapacity;
+
+	cca_block_list_free(&blocks);
+	free(use);
+	free(def);
+	free(liveIn);
+	free(liveOut);
+	free(returnIn);
+	free(live);
+	free(returnSites);
+	free(intervals);
+	free(busy);
+	free(busyBefore);
+	free(assignment);
+	free(sorted);
+	free(newIndex);
+	return spilled;
+}
+
+#endif
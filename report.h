@@ -0,0 +1,245 @@
+#ifndef ccvm_assembler_report
+#define ccvm_assembler_report
+
+// what the emitted code is made of, for --report and --report-csv
+//
+// instructions are counted by the form they were encoded in, so mov 0x06 and mov 0x0a show up apart, and summed
+// up by mnemonic. a routine is the code from one marker to the next, code in front of the first marker is (start).
+// the csv has one row per size, mnemonic, form and routine and is appended to, so a build can collect every
+// module it assembles in one file
+#define CCA_REPORT_LARGEST 10
+
+typedef struct cca_report_routine {
+	char* name;
+	unsigned int offset;
+	unsigned int instructions;
+	unsigned int bytes;
+} cca_report_routine;
+
+typedef struct cca_report_opcode {
+	char* mnemonic;
+	unsigned int count;
+	unsigned int bytes;
+} cca_report_opcode;
+
+typedef struct cca_report {
+	char* module;
+	unsigned int instructionCount;
+	unsigned int forms[256];
+	unsigned int formBytes[256];
+
+	unsigned int headerSize;
+	unsigned int codeSize;
+	unsigned int outputSize;
+
+	cca_report_routine* routines;
+	unsigned int routineCount;
+} cca_report;
+
+// the operands of a form the way the report names them, mov reg,num8
+void cca_report_form_name(unsigned char opcode, char* name, unsigned int size) {
+	cca_opcode_info* info = &cca_opcodes[opcode];
+	unsigned int length = snprintf(name, size, "%s", info->mnemonic);
+
+	for (int i = 0; i < info->operandCount && length < size; i++) {
+		char* kind = "";
+		switch (info->operands[i]) {
+			case CCA_OPERAND_REGISTER: kind = "reg"; break;
+			case CCA_OPERAND_NUMBER: kind = "num"; break;
+			case CCA_OPERAND_ADDRESS: kind = "addr"; break;
+			case CCA_OPERAND_MARKER: kind = "label"; break;
+			case CCA_OPERAND_RELATIVE: kind = "rel"; break;
+		}
+
+		length += snprintf(name + length, size - length, "%s%s", i == 0 ? " " : ",", kind);
+		if (info->sizes[i] != 0 && info->operands[i] != CCA_OPERAND_REGISTER && length < size)
+			length += snprintf(name + length, size - length, "%u", info->sizes[i] * 8);
+	}
+}
+
+int cca_report_routine_compare_size(const void* a, const void* b) {
+	cca_report_routine* x = (cca_report_routine*) a;
+	cca_report_routine* y = (cca_report_routine*) b;
+
+	if (x->bytes != y->bytes)
+		return x->bytes > y->bytes ? -1 : 1;
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+int cca_report_opcode_compare_size(const void* a, const void* b) {
+	cca_report_opcode* x = (cca_report_opcode*) a;
+	cca_report_opcode* y = (cca_report_opcode*) b;
+
+	if (x->bytes != y->bytes)
+		return x->bytes > y->bytes ? -1 : 1;
+	return strcmp(x->mnemonic, y->mnemonic);
+}
+
+// counts a program that is laid out, before it goes anywhere
+void cca_report_program(cca_report* report, cca_program* program, unsigned int headerSize) {
+	// wide code is addressed in words
+	unsigned int unit = program->encoding == CCA_ENCODING_WIDE ? CCA_WIDE_WORD : 1;
+
+	report->instructionCount = program->instructionCount;
+	report->headerSize = headerSize;
+	report->codeSize = program->codeLength * unit;
+	for (int i = 0; i < program->instructionCount; i++) {
+		cca_instruction* instruction = &program->instructions[i];
+		++report->forms[instruction->encoding];
+		if (program->encoding == CCA_ENCODING_WIDE)
+			report->formBytes[instruction->encoding] += cca_wide_word_count(instruction->encoding) * CCA_WIDE_WORD;
+		else
+			report->formBytes[instruction->encoding] += cca_instruction_size(instruction);
+	}
+
+	cca_marker* markers = malloc((program->markerCount + 1) * sizeof(cca_marker));
+	memcpy(markers, program->markers, program->markerCount * sizeof(cca_marker));
+	qsort(markers, program->markerCount, sizeof(cca_marker), cca_marker_compare_offset);
+
+	// markers at the same place are one routine under the last of their names
+	report->routines = malloc((program->markerCount + 1) * sizeof(cca_report_routine));
+	report->routineCount = 0;
+	unsigned int instruction = 0;
+	for (int i = -1; i < (int) program->markerCount; i++) {
+		unsigned int start = i < 0 ? 0 : markers[i].marks;
+		unsigned int end = i + 1 < program->markerCount ? markers[i + 1].marks : program->codeLength;
+		if (end <= start)
+			continue;
+
+		cca_report_routine* routine = &report->routines[report->routineCount++];
+		routine->name = strdup(i < 0 ? "(start)" : markers[i].name);
+		routine->offset = start * unit;
+		routine->bytes = (end - start) * unit;
+		routine->instructions = 0;
+		while (instruction < program->instructionCount && program->instructions[instruction].offset < end) {
+			++routine->instructions;
+			++instruction;
+		}
+	}
+
+	free(markers);
+}
+
+void cca_report_free(cca_report* report) {
+	for (unsigned int i = 0; i < report->routineCount; i++)
+		free(report->routines[i].name);
+	free(report->routines);
+	report->routines = NULL;
+}
+
+// the forms summed up by mnemonic, returns how many there are
+unsigned int cca_report_opcodes(cca_report* report, cca_report_opcode* opcodes) {
+	unsigned int count = 0;
+
+	for (int i = 0; i < 256; i++) {
+		if (report->forms[i] == 0)
+			continue;
+
+		int j = 0;
+		while (j < count && strcmp(opcodes[j].mnemonic, cca_opcodes[i].mnemonic) != 0)
+			++j;
+		if (j == count)
+			opcodes[count++] = (cca_report_opcode) { cca_opcodes[i].mnemonic, 0, 0 };
+		opcodes[j].count += report->forms[i];
+		opcodes[j].bytes += report->formBytes[i];
+	}
+
+	qsort(opcodes, count, sizeof(cca_report_opcode), cca_report_opcode_compare_size);
+	return count;
+}
+
+void cca_report_print(cca_report* report) {
+	double codeSize = report->codeSize != 0 ? report->codeSize : 1;
+
+	printf("%-24s %10s\n", "size", "bytes");
+	printf("%-24s %10u\n", "header", report->headerSize);
+	printf("%-24s %10u\n", "code", report->codeSize);
+	printf("%-24s %10u\n", "output", report->outputSize);
+
+	cca_report_opcode opcodes[256];
+	unsigned int opcodeCount = cca_report_opcodes(report, opcodes);
+	printf("\n%-24s %10s %10s %7s\n", "opcode", "count", "bytes", "code");
+	for (unsigned int i = 0; i < opcodeCount; i++) {
+		printf("%-24s %10u %10u %6.1f%%\n", opcodes[i].mnemonic, opcodes[i].count, opcodes[i].bytes,
+			opcodes[i].bytes * 100 / codeSize);
+	}
+
+	printf("\n%-24s %6s %10s %10s %7s\n", "form", "opcode", "count", "bytes", "code");
+	for (unsigned int i = 0; i < opcodeCount; i++) {
+		for (int j = 0; j < 256; j++) {
+			if (report->forms[j] == 0 || strcmp(cca_opcodes[j].mnemonic, opcodes[i].mnemonic) != 0)
+				continue;
+
+			char name[48];
+			cca_report_form_name(j, name, sizeof(name));
+			printf("%-24s   0x%02x %10u %10u %6.1f%%\n", name, j, report->forms[j], report->formBytes[j],
+				report->formBytes[j] * 100 / codeSize);
+		}
+	}
+
+	cca_report_routine* largest = malloc((report->routineCount + 1) * sizeof(cca_report_routine));
+	memcpy(largest, report->routines, report->routineCount * sizeof(cca_report_routine));
+	qsort(largest, report->routineCount, sizeof(cca_report_routine), cca_report_routine_compare_size);
+
+	printf("\n%u routines, %.1f bytes on average\n", report->routineCount,
+		report->routineCount != 0 ? report->codeSize / (double) report->routineCount : 0.0);
+	printf("%-24s %10s %10s %10s %7s\n", "largest routine", "offset", "count", "bytes", "code");
+	for (unsigned int i = 0; i < report->routineCount && i < CCA_REPORT_LARGEST; i++) {
+		printf("%-24s %10u %10u %10u %6.1f%%\n", largest[i].name, largest[i].offset, largest[i].instructions,
+			largest[i].bytes, largest[i].bytes * 100 / codeSize);
+	}
+
+	free(largest);
+}
+
+void cca_report_csv_string(FILE* file, char* string) {
+	fputc('"', file);
+	for (; *string != '\0'; string++) {
+		if (*string == '"')
+			fputc('"', file);
+		fputc(*string, file);
+	}
+	fputc('"', file);
+}
+
+void cca_report_csv_row(FILE* file, cca_report* report, char* kind, char* name, int opcode, unsigned int count, unsigned int bytes) {
+	cca_report_csv_string(file, report->module != NULL ? report->module : "");
+	fprintf(file, ",%s,", kind);
+	cca_report_csv_string(file, name);
+	if (opcode >= 0)
+		fprintf(file, ",0x%02x,%u,%u\n", opcode, count, bytes);
+	else
+		fprintf(file, ",,%u,%u\n", count, bytes);
+}
+
+// appends the report to file, the columns go in front when it is empty
+void cca_report_csv(cca_report* report, FILE* file) {
+	fseek(file, 0, SEEK_END);
+	if (ftell(file) == 0)
+		fputs("module,kind,name,opcode,count,bytes\n", file);
+
+	cca_report_csv_row(file, report, "size", "header", -1, 1, report->headerSize);
+	cca_report_csv_row(file, report, "size", "code", -1, report->instructionCount, report->codeSize);
+	cca_report_csv_row(file, report, "size", "output", -1, 1, report->outputSize);
+
+	cca_report_opcode opcodes[256];
+	unsigned int opcodeCount = cca_report_opcodes(report, opcodes);
+	for (unsigned int i = 0; i < opcodeCount; i++)
+		cca_report_csv_row(file, report, "opcode", opcodes[i].mnemonic, -1, opcodes[i].count, opcodes[i].bytes);
+
+	for (int i = 0; i < 256; i++) {
+		if (report->forms[i] == 0)
+			continue;
+
+		char name[48];
+		cca_report_form_name(i, name, sizeof(name));
+		cca_report_csv_row(file, report, "form", name, i, report->forms[i], report->formBytes[i]);
+	}
+
+	for (unsigned int i = 0; i < report->routineCount; i++) {
+		cca_report_routine* routine = &report->routines[i];
+		cca_report_csv_row(file, report, "routine", routine->name, -1, routine->instructions, routine->bytes);
+	}
+}
+
+#endif
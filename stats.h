@@ -0,0 +1,241 @@
+#ifndef ccvm_assembler_stats
+#define ccvm_assembler_stats
+
+// phase statistics for --stats and --perf-counters
+//
+// every phase records its wall time, what it went through and how many bytes it wrote. allocations are counted
+// by whoever replaces malloc, the assembler does in main.c, everything else reports them as not counted. peak rss
+// is the high water mark of the process when the phase ends
+//
+// with perf counters the phases also run inside one perf_event_open group, so the counters are scheduled onto
+// the pmu together and the ratios between them hold. counters the kernel won't give us, in containers and vms
+// without a pmu mostly, are left out and shown as -
+#include <time.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+
+#define CCA_STATS_MAX_PHASES 24
+#define CCA_PERF_COUNTERS 6
+#define CCA_PERF_CYCLES 0
+#define CCA_PERF_INSTRUCTIONS 1
+#define CCA_PERF_BRANCH_MISSES 2
+#define CCA_PERF_L1D_MISSES 3
+#define CCA_PERF_LLC_MISSES 4
+#define CCA_PERF_PAGE_FAULTS 5
+#define CCA_PERF_UNAVAILABLE -1
+
+// per thread, so every thread counts its own phases
+_Thread_local unsigned long long cca_malloc_count = 0;
+_Thread_local unsigned long long cca_realloc_count = 0;
+BOOL cca_allocations_counted = FALSE;
+_Atomic BOOL cca_perf_warned = FALSE;
+
+typedef struct cca_phase_stats {
+	char* name;
+	double seconds;
+	unsigned long long items;
+	char* unit;
+	unsigned long long bytes;
+	unsigned long long mallocs;
+	unsigned long long reallocs;
+	long peakRss;
+	long long counters[CCA_PERF_COUNTERS];
+} cca_phase_stats;
+
+typedef struct cca_stats {
+	cca_phase_stats phases[CCA_STATS_MAX_PHASES];
+	unsigned int phaseCount;
+
+	// source bytes, what the misses are counted against
+	unsigned long long sourceSize;
+
+	// file descriptors of the counters, -1 for the ones that didn't open, and the one leading the group
+	BOOL perf;
+	int counters[CCA_PERF_COUNTERS];
+	int leader;
+
+	// the phase that is running
+	struct timespec start;
+	unsigned long long mallocs;
+	unsigned long long reallocs;
+} cca_stats;
+
+typedef struct cca_perf_counter {
+	char* name;
+	unsigned int type;
+	unsigned long long config;
+} cca_perf_counter;
+
+cca_perf_counter cca_perf_counters[CCA_PERF_COUNTERS] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ "L1D-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ "LLC-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS }
+};
+
+// opens the counters of this process in user space, returns FALSE when none of them could be opened
+BOOL cca_stats_perf_open(cca_stats* stats) {
+	stats->perf = TRUE;
+	stats->leader = -1;
+	int firstError = 0;
+
+	for (int i = 0; i < CCA_PERF_COUNTERS; i++) {
+		struct perf_event_attr attributes;
+		memset(&attributes, 0, sizeof(attributes));
+		attributes.size = sizeof(attributes);
+		attributes.type = cca_perf_counters[i].type;
+		attributes.config = cca_perf_counters[i].config;
+		attributes.disabled = stats->leader == -1;
+		attributes.exclude_kernel = 1;
+		attributes.exclude_hv = 1;
+		attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		stats->counters[i] = syscall(SYS_perf_event_open, &attributes, 0, -1, stats->leader, 0);
+		if (stats->counters[i] < 0 && firstError == 0)
+			firstError = errno;
+		if (stats->counters[i] >= 0 && stats->leader == -1)
+			stats->leader = stats->counters[i];
+	}
+
+	if (stats->counters[CCA_PERF_CYCLES] < 0 && !atomic_exchange(&cca_perf_warned, TRUE))
+		printf("[WARNING] hardware counters are not available (%s), only the ones that are get counted\n", strerror(firstError));
+	return stats->leader != -1;
+}
+
+void cca_stats_perf_close(cca_stats* stats) {
+	if (!stats->perf)
+		return;
+
+	for (int i = 0; i < CCA_PERF_COUNTERS; i++) {
+		if (stats->counters[i] >= 0)
+			close(stats->counters[i]);
+	}
+	stats->perf = FALSE;
+}
+
+// stats can be NULL everywhere, then nothing is recorded. the phases go in the trace either way
+void cca_stats_begin(cca_stats* stats, char* name) {
+	cca_trace_begin(name, NULL);
+	if (stats == NULL || stats->phaseCount >= CCA_STATS_MAX_PHASES)
+		return;
+
+	cca_phase_stats* phase = &stats->phases[stats->phaseCount];
+	memset(phase, 0, sizeof(cca_phase_stats));
+	phase->name = name;
+	stats->mallocs = cca_malloc_count;
+	stats->reallocs = cca_realloc_count;
+
+	if (stats->perf && stats->leader >= 0) {
+		ioctl(stats->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(stats->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stats->start);
+}
+
+void cca_stats_end(cca_stats* stats, unsigned long long items, char* unit, unsigned long long bytes) {
+	cca_trace_end();
+	if (stats == NULL || stats->phaseCount >= CCA_STATS_MAX_PHASES)
+		return;
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (stats->perf && stats->leader >= 0)
+		ioctl(stats->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	cca_phase_stats* phase = &stats->phases[stats->phaseCount++];
+	for (int i = 0; i < CCA_PERF_COUNTERS; i++) {
+		// value, time enabled and time running, scaled up when the counters had to share the pmu
+		unsigned long long values[3];
+		phase->counters[i] = CCA_PERF_UNAVAILABLE;
+		if (!stats->perf || stats->counters[i] < 0 || read(stats->counters[i], values, sizeof(values)) != sizeof(values) || values[2] == 0)
+			continue;
+		phase->counters[i] = values[2] < values[1] ? (long long) ((double) values[0] * values[1] / values[2]) : (long long) values[0];
+	}
+
+	phase->seconds = (end.tv_sec - stats->start.tv_sec) + (end.tv_nsec - stats->start.tv_nsec) / 1e9;
+	phase->items = items;
+	phase->unit = unit;
+	phase->bytes = bytes;
+	phase->mallocs = cca_malloc_count - stats->mallocs;
+	phase->reallocs = cca_realloc_count - stats->reallocs;
+	phase->peakRss = usage.ru_maxrss;
+}
+
+void cca_stats_print(cca_stats* stats) {
+	double seconds = 0;
+	unsigned long long mallocs = 0;
+	unsigned long long reallocs = 0;
+
+	printf("%-16s %10s %24s %12s %10s %10s %10s\n", "phase", "ms", "processed", "bytes", "mallocs", "reallocs", "peak rss");
+	for (unsigned int i = 0; i < stats->phaseCount; i++) {
+		cca_phase_stats* phase = &stats->phases[i];
+		char items[32] = "-";
+		char bytes[32] = "-";
+		char mallocCount[32] = "-";
+		char reallocCount[32] = "-";
+
+		if (phase->unit != NULL)
+			snprintf(items, sizeof(items), "%llu %s", phase->items, phase->unit);
+		if (phase->bytes != 0)
+			snprintf(bytes, sizeof(bytes), "%llu", phase->bytes);
+		if (cca_allocations_counted) {
+			snprintf(mallocCount, sizeof(mallocCount), "%llu", phase->mallocs);
+			snprintf(reallocCount, sizeof(reallocCount), "%llu", phase->reallocs);
+		}
+
+		printf("%-16s %10.3f %24s %12s %10s %10s %7.1f MB\n", phase->name, phase->seconds * 1e3, items, bytes,
+			mallocCount, reallocCount, phase->peakRss / 1024.0);
+		seconds += phase->seconds;
+		mallocs += phase->mallocs;
+		reallocs += phase->reallocs;
+	}
+
+	if (cca_allocations_counted)
+		printf("%-16s %10.3f %24s %12s %10llu %10llu\n", "total", seconds * 1e3, "", "", mallocs, reallocs);
+	else
+		printf("%-16s %10.3f %24s %12s %10s %10s\n", "total", seconds * 1e3, "", "", "-", "-");
+}
+
+void cca_stats_print_ratio(long long count, double per, char* format) {
+	if (count == CCA_PERF_UNAVAILABLE || per <= 0)
+		printf(" %12s", "-");
+	else
+		printf(format, count / per);
+}
+
+void cca_stats_print_perf(cca_stats* stats) {
+	printf("%-16s %14s %14s %6s %12s %12s %12s %12s\n", "phase", "cycles", "instructions", "ipc", "br-miss/KB", "L1D-miss/KB",
+		"LLC-miss/KB", "faults/KB");
+
+	for (unsigned int i = 0; i < stats->phaseCount; i++) {
+		cca_phase_stats* phase = &stats->phases[i];
+		long long* counters = phase->counters;
+		double kilobytes = stats->sourceSize / 1024.0;
+		printf("%-16s", phase->name);
+
+		for (int j = CCA_PERF_CYCLES; j <= CCA_PERF_INSTRUCTIONS; j++) {
+			if (counters[j] == CCA_PERF_UNAVAILABLE)
+				printf(" %14s", "-");
+			else
+				printf(" %14lld", counters[j]);
+		}
+
+		if (counters[CCA_PERF_CYCLES] > 0 && counters[CCA_PERF_INSTRUCTIONS] != CCA_PERF_UNAVAILABLE)
+			printf(" %6.2f", (double) counters[CCA_PERF_INSTRUCTIONS] / counters[CCA_PERF_CYCLES]);
+		else
+			printf(" %6s", "-");
+
+		for (int j = CCA_PERF_BRANCH_MISSES; j <= CCA_PERF_PAGE_FAULTS; j++)
+			cca_stats_print_ratio(counters[j], kilobytes, " %12.2f");
+		printf("\n");
+	}
+}
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef ccvm_assembler_trace
+#define ccvm_assembler_trace
+
+// timeline of files and phases for --trace, written in the chrome trace event format that perfetto and
+// chrome://tracing open without a network
+//
+// every thread that records gets its own ring of events it alone writes to, the thread writing the file drains
+// them while the others run. head and tail are the only shared state, so recording an event is a few stores and
+// no lock. a full ring drops events and counts them instead of waiting
+#include <time.h>
+#include <stdatomic.h>
+
+#define CCA_TRACE_RING_SIZE 4096
+#define CCA_TRACE_MAX_THREADS 256
+
+typedef struct cca_trace_event {
+	char* name;
+	char* file;
+	double timestamp;
+	// of a complete event, one that was timed rather than begun and ended
+	double duration;
+	char phase;
+} cca_trace_event;
+
+typedef struct cca_trace_ring {
+	cca_trace_event events[CCA_TRACE_RING_SIZE];
+	_Atomic unsigned long long head;
+	_Atomic unsigned long long tail;
+	unsigned long long dropped;
+	unsigned int thread;
+	char name[32];
+} cca_trace_ring;
+
+typedef struct cca_trace {
+	FILE* file;
+	BOOL first;
+	struct timespec start;
+	_Atomic(cca_trace_ring*) rings[CCA_TRACE_MAX_THREADS];
+	_Atomic unsigned int ringCount;
+} cca_trace;
+
+// the ring of the calling thread, NULL when it doesn't record
+_Thread_local cca_trace_ring* cca_trace_current = NULL;
+_Thread_local cca_trace* cca_trace_owner = NULL;
+
+BOOL cca_trace_open(cca_trace* trace, char* fileName) {
+	memset(trace, 0, sizeof(cca_trace));
+	trace->file = fopen(fileName, "w");
+	if (trace->file == NULL) {
+		printf("[ERROR] could not write the trace to '%s'\n", fileName);
+		return FALSE;
+	}
+
+	trace->first = TRUE;
+	clock_gettime(CLOCK_MONOTONIC, &trace->start);
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", trace->file);
+	return TRUE;
+}
+
+// gives the calling thread a ring, threads past the limit aren't recorded
+void cca_trace_thread(cca_trace* trace, char* name) {
+	unsigned int index = atomic_fetch_add(&trace->ringCount, 1);
+	if (index >= CCA_TRACE_MAX_THREADS)
+		return;
+
+	cca_trace_ring* ring = calloc(1, sizeof(cca_trace_ring));
+	ring->thread = index + 1;
+	snprintf(ring->name, sizeof(ring->name), "%s", name);
+	cca_trace_current = ring;
+	cca_trace_owner = trace;
+
+	cca_trace_event event = { ring->name, NULL, 0, 0, 'M' };
+	ring->events[0] = event;
+	atomic_store_explicit(&ring->head, 1, memory_order_relaxed);
+	atomic_store_explicit(&trace->rings[index], ring, memory_order_release);
+}
+
+// microseconds since the trace was opened, 0 on threads that don't record
+double cca_trace_now() {
+	if (cca_trace_current == NULL)
+		return 0;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - cca_trace_owner->start.tv_sec) * 1e6 + (now.tv_nsec - cca_trace_owner->start.tv_nsec) / 1e3;
+}
+
+void cca_trace_record_at(char* name, char* file, char phase, double timestamp, double duration) {
+	cca_trace_ring* ring = cca_trace_current;
+	if (ring == NULL)
+		return;
+
+	unsigned long long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= CCA_TRACE_RING_SIZE) {
+		++ring->dropped;
+		return;
+	}
+
+	cca_trace_event* event = &ring->events[head % CCA_TRACE_RING_SIZE];
+	event->name = name;
+	event->file = file;
+	event->timestamp = timestamp;
+	event->duration = duration;
+	event->phase = phase;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void cca_trace_record(char* name, char* file, char phase) {
+	if (cca_trace_current != NULL)
+		cca_trace_record_at(name, file, phase, cca_trace_now(), 0);
+}
+
+void cca_trace_begin(char* name, char* file) {
+	cca_trace_record(name, file, 'B');
+}
+
+// ends whatever the thread began last
+void cca_trace_end() {
+	cca_trace_record(NULL, NULL, 'E');
+}
+
+// something that ran from started until now, for work that overlaps on one thread and can't nest like begin and end
+void cca_trace_span(char* name, char* file, double started) {
+	if (cca_trace_current != NULL)
+		cca_trace_record_at(name, file, 'X', started, cca_trace_now() - started);
+}
+
+void cca_trace_string(FILE* file, char* string) {
+	fputc('"', file);
+	for (; *string != '\0'; string++) {
+		if (*string == '"' || *string == '\\')
+			fputc('\\', file);
+		if ((unsigned char) *string < 0x20)
+			fprintf(file, "\\u%04x", *string);
+		else
+			fputc(*string, file);
+	}
+	fputc('"', file);
+}
+
+// writes out what the rings hold so far, only ever called from one thread
+void cca_trace_drain(cca_trace* trace) {
+	unsigned int ringCount = atomic_load(&trace->ringCount);
+	for (unsigned int i = 0; i < ringCount && i < CCA_TRACE_MAX_THREADS; i++) {
+		cca_trace_ring* ring = atomic_load_explicit(&trace->rings[i], memory_order_acquire);
+		if (ring == NULL)
+			continue;
+
+		unsigned long long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		unsigned long long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		for (; tail < head; tail++) {
+			cca_trace_event* event = &ring->events[tail % CCA_TRACE_RING_SIZE];
+			fputs(trace->first ? "" : ",\n", trace->file);
+			trace->first = FALSE;
+
+			if (event->phase == 'M') {
+				fprintf(trace->file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", ring->thread);
+				cca_trace_string(trace->file, event->name);
+				fputs("}}", trace->file);
+				continue;
+			}
+
+			fprintf(trace->file, "{\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u", event->phase, event->timestamp, ring->thread);
+			if (event->phase == 'X')
+				fprintf(trace->file, ",\"dur\":%.3f", event->duration);
+			if (event->name != NULL) {
+				fprintf(trace->file, ",\"cat\":\"%s\",\"name\":", event->file != NULL ? "file" : "phase");
+				cca_trace_string(trace->file, event->name);
+			}
+			if (event->file != NULL) {
+				fputs(",\"args\":{\"file\":", trace->file);
+				cca_trace_string(trace->file, event->file);
+				fputc('}', trace->file);
+			}
+			fputc('}', trace->file);
+		}
+
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+	}
+}
+
+void cca_trace_close(cca_trace* trace) {
+	cca_trace_drain(trace);
+
+	unsigned long long dropped = 0;
+	unsigned int ringCount = atomic_load(&trace->ringCount);
+	for (unsigned int i = 0; i < ringCount && i < CCA_TRACE_MAX_THREADS; i++) {
+		cca_trace_ring* ring = atomic_load(&trace->rings[i]);
+		dropped += ring->dropped;
+		free(ring);
+	}
+
+	fputs("\n]}\n", trace->file);
+	fclose(trace->file);
+	if (dropped != 0)
+		printf("[WARNING] the trace dropped %llu events, its rings were full\n", dropped);
+}
+
+#endif
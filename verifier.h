@@ -0,0 +1,198 @@
+#ifndef ccvm_assembler_verifier
+#define ccvm_assembler_verifier
+
+// bytecode verifier
+//
+// decodes the finished code again and proves what a vm would otherwise check while running: every instruction
+// decodes, registers are a-d, jumps and calls land on instructions, the stack never runs dry and has the same depth
+// whichever way an instruction is reached, and ret only runs inside a routine that was called. all callers of a
+// routine have to call it at the same depth and get back the depth its rets leave
+#define CCA_VERIFIER_MAIN 0xfffffffe
+
+typedef struct cca_verifier {
+	cca_instruction* instructions;
+	unsigned int count;
+	unsigned int* indexAt;
+
+	unsigned int* depth;
+	unsigned int* routine;
+	unsigned int* returnDepth;
+
+	unsigned int* worklist;
+	unsigned int worklistLength;
+	BOOL* queued;
+} cca_verifier;
+
+void cca_verifier_queue(cca_verifier* verifier, unsigned int index) {
+	if (!verifier->queued[index]) {
+		verifier->queued[index] = TRUE;
+		verifier->worklist[verifier->worklistLength++] = index;
+	}
+}
+
+BOOL cca_verifier_reach(cca_verifier* verifier, unsigned int index, unsigned int depth, unsigned int routine) {
+	if (index >= verifier->count) {
+		puts("[WARNING] not verified, execution runs past the end of the code");
+		return FALSE;
+	}
+
+	unsigned int offset = verifier->instructions[index].offset;
+	if (verifier->routine[index] == CCA_MARKER_UNDEFINED) {
+		verifier->routine[index] = routine;
+		verifier->depth[index] = depth;
+		cca_verifier_queue(verifier, index);
+	} else if (verifier->routine[index] != routine) {
+		printf("[WARNING] not verified, the instruction at %u is shared between routines\n", offset);
+		return FALSE;
+	} else if (verifier->depth[index] != depth) {
+		printf("[WARNING] not verified, the stack depth at %u is %u on one path and %u on another\n", offset, verifier->depth[index], depth);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOL cca_verifier_flow(cca_verifier* verifier, unsigned int* maxStackDepth) {
+	if (verifier->count == 0)
+		return TRUE;
+	if (!cca_verifier_reach(verifier, 0, 0, CCA_VERIFIER_MAIN))
+		return FALSE;
+
+	while (verifier->worklistLength > 0) {
+		unsigned int index = verifier->worklist[--verifier->worklistLength];
+		verifier->queued[index] = FALSE;
+
+		cca_instruction* instruction = &verifier->instructions[index];
+		unsigned int routine = verifier->routine[index];
+		unsigned int pops, pushes;
+		cca_stack_effect(instruction->opcode, &pops, &pushes);
+
+		if (verifier->depth[index] < pops) {
+			printf("[WARNING] not verified, the stack runs dry at %u\n", instruction->offset);
+			return FALSE;
+		}
+
+		unsigned int depth = verifier->depth[index] - pops + pushes;
+		if (depth > *maxStackDepth)
+			*maxStackDepth = depth;
+
+		unsigned int target = CCA_MARKER_UNDEFINED;
+		int targetOperand = cca_opcode_target(instruction->opcode);
+		if (targetOperand >= 0)
+			target = verifier->indexAt[instruction->operands[targetOperand].value];
+
+		switch (instruction->opcode) {
+			case CCA_OP_STP:
+				break;
+			case CCA_OP_RET:
+				if (routine == CCA_VERIFIER_MAIN) {
+					printf("[WARNING] not verified, ret at %u outside of a called routine\n", instruction->offset);
+					return FALSE;
+				}
+
+				if (verifier->returnDepth[routine] == CCA_MARKER_UNDEFINED) {
+					// callers seen so far can continue now
+					verifier->returnDepth[routine] = depth;
+					for (unsigned int i = 0; i < verifier->count; i++) {
+						cca_instruction* call = &verifier->instructions[i];
+						if (call->opcode == CCA_OP_CALL && verifier->routine[i] != CCA_MARKER_UNDEFINED && verifier->indexAt[call->operands[0].value] == routine)
+							cca_verifier_queue(verifier, i);
+					}
+				} else if (verifier->returnDepth[routine] != depth) {
+					printf("[WARNING] not verified, the routine at %u returns with different stack depths\n", verifier->instructions[routine].offset);
+					return FALSE;
+				}
+				break;
+			case CCA_OP_CALL:
+				if (!cca_verifier_reach(verifier, target, depth, target))
+					return FALSE;
+				if (verifier->returnDepth[target] != CCA_MARKER_UNDEFINED && !cca_verifier_reach(verifier, index + 1, verifier->returnDepth[target], routine))
+					return FALSE;
+				break;
+			case CCA_OP_JMP:
+				if (!cca_verifier_reach(verifier, target, depth, routine))
+					return FALSE;
+				break;
+			default:
+				if (target != CCA_MARKER_UNDEFINED && !cca_verifier_reach(verifier, target, depth, routine))
+					return FALSE;
+				if (!cca_verifier_reach(verifier, index + 1, depth, routine))
+					return FALSE;
+				break;
+		}
+	}
+
+	return TRUE;
+}
+
+BOOL cca_verify(unsigned char* code, unsigned int length, char encoding, unsigned int* maxStackDepth) {
+	unsigned int units = encoding == CCA_ENCODING_WIDE ? length / CCA_WIDE_WORD : length;
+
+	cca_verifier verifier = {0};
+	verifier.instructions = malloc((units + 1) * sizeof(cca_instruction));
+	verifier.indexAt = malloc((units + 1) * sizeof(unsigned int));
+	for (unsigned int i = 0; i <= units; i++)
+		verifier.indexAt[i] = CCA_MARKER_UNDEFINED;
+
+	BOOL verified = TRUE;
+	*maxStackDepth = 0;
+
+	for (unsigned int offset = 0; offset < units;) {
+		unsigned int size = cca_decode_instruction(code, length, encoding, offset, &verifier.instructions[verifier.count]);
+		if (size == 0) {
+			printf("[WARNING] not verified, can't decode the instruction at %u\n", offset);
+			verified = FALSE;
+			break;
+		}
+
+		verifier.indexAt[offset] = verifier.count++;
+		offset += size;
+	}
+
+	for (unsigned int i = 0; i < verifier.count && verified; i++) {
+		cca_instruction* instruction = &verifier.instructions[i];
+
+		for (int j = 0; j < CCA_MAX_OPERANDS; j++) {
+			if (instruction->operands[j].type == CCA_OPERAND_REGISTER && instruction->operands[j].value >= CCA_REGISTER_COUNT) {
+				printf("[WARNING] not verified, register %u at %u doesn't exist\n", instruction->operands[j].value, instruction->offset);
+				verified = FALSE;
+			}
+		}
+
+		int targetOperand = cca_opcode_target(instruction->opcode);
+		if (targetOperand >= 0) {
+			unsigned int target = instruction->operands[targetOperand].value;
+			if (target >= units || verifier.indexAt[target] == CCA_MARKER_UNDEFINED) {
+				printf("[WARNING] not verified, the branch at %u to %u doesn't land on an instruction\n", instruction->offset, target);
+				verified = FALSE;
+			}
+		}
+	}
+
+	if (verified) {
+		verifier.depth = malloc(verifier.count * sizeof(unsigned int));
+		verifier.routine = malloc(verifier.count * sizeof(unsigned int));
+		verifier.returnDepth = malloc(verifier.count * sizeof(unsigned int));
+		verifier.worklist = malloc(verifier.count * sizeof(unsigned int));
+		verifier.queued = calloc(verifier.count, sizeof(BOOL));
+		for (unsigned int i = 0; i < verifier.count; i++)
+			verifier.routine[i] = verifier.returnDepth[i] = CCA_MARKER_UNDEFINED;
+
+		verified = cca_verifier_flow(&verifier, maxStackDepth);
+
+		free(verifier.depth);
+		free(verifier.routine);
+		free(verifier.returnDepth);
+		free(verifier.worklist);
+		free(verifier.queued);
+	}
+
+	free(verifier.instructions);
+	free(verifier.indexAt);
+
+	if (!verified)
+		*maxStackDepth = 0;
+	return verified;
+}
+
+#endif